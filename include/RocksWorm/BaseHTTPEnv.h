@@ -7,9 +7,20 @@ HTTP[S] request formulation (URL rewriting, headers, etc.).
 #pragma once
 
 #include <string>
+#include <algorithm>
 #include <vector>
+#include <map>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 #include <unistd.h>
 #include "HTTP.h"
+#include "HTTPRangeCache.h"
+#include "HTTPDiskCache.h"
 #include "rocksdb/db.h"
 #include "rocksdb/env.h"
 #include "rocksdb/options.h"
@@ -21,7 +32,35 @@ struct HTTPEnvOptions {
     // instances expected to communicate with the same endpoint (e.g.
     // s3.amazonaws.com)
     HTTP::CURLpool *connpool = nullptr;
+
+    // Asynchronous HTTP client, used to perform many range reads concurrently.
+    // If null, the env will create a private client upon first use. Like the
+    // connection pool, one client may be shared between HTTP Env instances.
+    HTTP::AsyncClient *async_client = nullptr;
     
+    // In-memory cache of file pages read over HTTP, beneath the RocksDB block
+    // cache. If null, no such caching is performed. The caller retains
+    // ownership, and the cache may be shared between HTTP Env instances.
+    HTTPRangeCache *range_cache = nullptr;
+
+    // Persistent cache of file pages on local storage, consulted after the
+    // in-memory range cache (whose page size it must share). Pages are
+    // validated against the ETag and size of the object they came from, so
+    // the server must provide ETag headers. The caller retains ownership and
+    // must have opened the cache.
+    HTTPDiskCache *disk_cache = nullptr;
+
+    // Base URLs of mirrors serving identical copies of the files under the
+    // env's base URL (e.g. replicas in other buckets or regions). Files in the
+    // same directory as the base URL (such as the stripes of a RocksWorm
+    // file) are expected alongside each mirror's copy. Each request goes to
+    // the mirror with the lowest recent latency and error rate, and a
+    // retryable failure moves on to the next-best mirror straight away,
+    // incurring the retry delay only once every mirror has failed. Caches
+    // are shared across the mirrors, though the disk cache persists pages
+    // only if the mirrors serve the same ETags.
+    std::vector<std::string> mirror_urls;
+
     // Parameters controlling HTTP retry logic. Connection errors, 5xx
     // response codes, and interrupted requests/responses can be retried.
 
@@ -32,6 +71,48 @@ struct HTTPEnvOptions {
     // On each subsequent retry, the delay is multiplied by this factor
     unsigned int retry_backoff_factor = 2;
 
+    // Read-ahead for sequential access patterns in random access files, such
+    // as db iterators scanning through an SST. Upon consecutive reads, the
+    // file fetches a window beyond the requested range, starting at
+    // readahead_initial_size and doubling with each further sequential read
+    // up to readahead_max_size, and prefetches the next window in the
+    // background. Set readahead_max_size to 0 to disable.
+    size_t readahead_initial_size = 65536;
+    size_t readahead_max_size = 4194304;
+
+    // With a range cache, small reads are widened to an aligned fetch unit
+    // sized to the bandwidth-delay product of the connection, as estimated
+    // from the latency and throughput of recent GETs, and the surplus pages
+    // are kept in the range cache. The fetch unit is a power-of-two multiple
+    // of the cache page size, up to fetch_unit_max. Set to 0 to disable.
+    size_t fetch_unit_max = 1048576;
+
+    // Sequential files (e.g. the MANIFEST read upon opening a db) are read in
+    // chunks of this size, with the next chunk fetched in the background
+    // while reads are served from the current one. Set to 0 to read exactly
+    // the requested ranges instead.
+    size_t sequential_chunk_size = 1048576;
+
+    // Batched reads (RocksWormHTTPEnv::MultiRead) merge ranges separated by
+    // no more than multi_range_gap bytes, and then request up to
+    // multi_range_max of the merged ranges in each multi-range GET. If the
+    // server doesn't support multi-range requests, the env falls back to
+    // concurrent single-range GETs.
+    size_t multi_range_gap = 16384;
+    unsigned int multi_range_max = 64;
+
+    // RocksWormHTTPEnv loads the region of packed SST metadata (see
+    // MakeRocksWormFileFromDB --pack-metadata) along with the manifest, if
+    // it's no larger than this, and then serves table opens from memory.
+    // Set to 0 to read the metadata from each SST instead.
+    size_t metadata_region_max = 67108864;
+
+    // RocksWormHTTPEnv similarly loads the global filter and global index
+    // (see MakeRocksWormFileFromDB --global-filter and --global-index) if
+    // they're no larger than these. Set to 0 to ignore them.
+    size_t global_filter_max = 67108864;
+    size_t global_index_max = 67108864;
+
     // stderr log level for HTTP operations. The base HTTP env logs at the
     // following levels:
     //   ERROR  request failures
@@ -60,6 +141,115 @@ public:
     }
 };
 
+// One of several range reads of a file to be performed concurrently by
+// BaseHTTPEnv::RetryGetMany. scratch must have room for n bytes; result and
+// status are filled in upon completion.
+struct HTTPReadRequest {
+    uint64_t offset = 0;
+    size_t n = 0;
+    char *scratch = nullptr;
+    rocksdb::Slice result;
+    rocksdb::Status status;
+};
+
+// The mirrors tried so far by one request, with its retries
+struct HTTPMirrorAttempts {
+    std::vector<bool> tried;
+    size_t mirror = 0;
+
+    // whether any mirror remains to be tried before the retry delay
+    bool untried() const { return std::find(tried.begin(), tried.end(), false) != tried.end(); }
+};
+
+// A single asynchronous attempt to GET a range of a file into a private
+// buffer, used for speculative prefetching. See BaseHTTPEnv::StartGet
+struct HTTPAsyncGet {
+    uint64_t offset = 0;
+    size_t n = 0;
+    std::unique_ptr<char[]> buf;
+    std::string url;
+    long response_code = -1;
+    HTTP::headers response_headers;
+    size_t response_size = 0;
+    uint64_t start_micros = 0;
+    HTTPMirrorAttempts mirror;
+    std::future<CURLcode> result;
+    // instead of the above, when the range or disk cache is configured
+    std::future<rocksdb::Status> read_range;
+
+    // whether the GET has completed, so that FinishGet won't block
+    bool ready() const {
+        const std::chrono::seconds now(0);
+        return read_range.valid() ? read_range.wait_for(now) == std::future_status::ready
+                                  : result.wait_for(now) == std::future_status::ready;
+    }
+};
+
+// Online estimate of the per-request latency L and throughput B of GETs,
+// fitting t = L + s/B to the response sizes s and durations t of completed
+// requests by exponentially-weighted least squares, so that recent requests
+// count the most.
+class HTTPFetchModel {
+    mutable std::mutex mu_;
+    double alpha_;
+    uint64_t samples_;
+    double mean_s_, mean_t_, mean_ss_, mean_st_;
+
+public:
+    HTTPFetchModel(double alpha = 0.05)
+        : alpha_(alpha), samples_(0), mean_s_(0), mean_t_(0), mean_ss_(0), mean_st_(0) {}
+
+    void Observe(size_t bytes, double seconds);
+
+    // Provide the current estimate (seconds, bytes per second), if the
+    // observations so far support one
+    bool Estimate(double& latency, double& bandwidth) const;
+
+    // The power-of-two multiple of page_size, up to max_unit, covering the
+    // estimated bandwidth-delay product; page_size absent an estimate
+    size_t FetchUnit(size_t page_size, size_t max_unit) const;
+};
+
+// Health of the mirrors of an env's base URL (the base URL itself being the
+// first): exponentially-weighted moving averages of each mirror's request
+// durations and error rate, by which the mirrors are ranked. Errors are
+// forgiven over time, halving their weight every error_half_life seconds, so
+// that a mirror which failed is eventually tried again.
+class HTTPMirrorSet {
+    struct Mirror {
+        std::string base_url, base_dir;
+        uint64_t samples = 0;
+        double latency = 0, error_rate = 0;
+        std::chrono::steady_clock::time_point last_error;
+    };
+    mutable std::mutex mu_;
+    double alpha_, error_half_life_;
+    std::vector<Mirror> mirrors_;
+
+    double Cost(const Mirror& m, std::chrono::steady_clock::time_point now) const;
+
+public:
+    HTTPMirrorSet(const std::string& base_url, const std::vector<std::string>& mirror_urls,
+                  double alpha = 0.1, double error_half_life = 30.0);
+
+    size_t size() const { return mirrors_.size(); }
+
+    // Record the outcome of a request to the i'th mirror
+    void Observe(size_t i, bool ok, double seconds);
+
+    // The expected cost (in seconds) of a request to the i'th mirror: its
+    // average latency, inflated by its recent error rate. Mirrors not yet
+    // sampled cost nothing, so each is tried early on.
+    double Cost(size_t i) const;
+
+    // The lowest-cost mirror not yet tried (tried mustn't be all true)
+    size_t Best(const std::vector<bool>& tried) const;
+
+    // Rewrite a URL formulated for the base URL (or for another file in its
+    // directory) to the corresponding URL on the i'th mirror
+    std::string Rewrite(const std::string& url, size_t i) const;
+};
+
 class BaseHTTPEnv : public rocksdb::Env {
     friend class BaseHTTPRandomAccessFile;
     friend class BaseHTTPSequentialFile;
@@ -68,12 +258,52 @@ protected:
     std::string base_url_;
     rocksdb::Env *inner_env_;
     HTTP::CURLpool *connpool_;
+    HTTP::AsyncClient *async_client_;
+    std::once_flag async_client_once_;
     HTTPEnvOptions opts_;
     StdErrLogger http_logger_;
+    std::mutex validators_mu_;
+    std::map<std::string, std::string> validators_;
+    std::atomic<bool> multi_range_unsupported_;
+    HTTPFetchModel fetch_model_;
+    HTTPMirrorSet mirrors_;
+
+    // GETs in flight through SharedGet, by file name. Flight::buf is the
+    // scratch buffer of the thread performing the GET, which waits for other
+    // threads blocked on copying from it before returning. If other threads
+    // registered to copy are still busy fetching the rest of their own
+    // ranges, it leaves them a private copy instead.
+    struct Flight {
+        uint64_t offset;
+        size_t n;
+        char *buf;
+        std::unique_ptr<char[]> own_buf;
+        bool done = false;
+        rocksdb::Status status;
+        std::string etag;
+        unsigned int waiters = 0, blocked = 0;
+        std::condition_variable cv;
+    };
+    std::mutex flights_mu_;
+    std::multimap<std::string, std::shared_ptr<Flight>> flights_;
+
+    // Worker threads running StartGet's reads through the caches (each of
+    // which blocks a thread for its duration), started as needed up to
+    // kMaxWorkers; further reads queue in work_.
+    static const size_t kMaxWorkers = 16;
+    std::mutex workers_mu_;
+    std::condition_variable workers_cv_;
+    std::deque<std::function<void()>> work_;
+    std::vector<std::thread> workers_;
+    size_t idle_workers_;
+    bool workers_stop_;
+    void Schedule(std::function<void()> job);
+    void Work();
 
     // Formulate the URL and request headers to HEAD the named file. May be
     // overridden by subclasses to e.g. add authorization headers. The base
-    // method just appends fname to base_url.
+    // method just appends fname to base_url. URLs are formulated for
+    // base_url, and then rewritten for the chosen mirror, if any.
     virtual rocksdb::Status PrepareHead(const std::string& fname,
                                         std::string& url, HTTP::headers& request_headers);
     // Formulate the URL and request headers to GET the specified byte range
@@ -82,12 +312,101 @@ protected:
     virtual rocksdb::Status PrepareGet(const std::string& fname, uint64_t offset, size_t n,
                                        std::string& url, HTTP::headers& request_headers);
 
+    // Resolve the named file, upon opening it, to a byte range of an
+    // underlying object: files then read [base_offset, base_offset+size) of
+    // the object (of object_size bytes) by passing its name to the methods
+    // below. The base method takes each file to be a whole object of the same
+    // name, whose size GetFileSize determines. Subclasses may map many files
+    // onto one object.
+    virtual rocksdb::Status ResolveFile(const std::string& fname, std::string& object, uint64_t& object_size,
+                                        uint64_t& base_offset, uint64_t& size);
+
     // Perform a HEAD request for the named file, with retry logic
     virtual rocksdb::Status RetryHead(const std::string& fname, HTTP::headers& response_headers);
     // Perform a GET request for the specified range of the name file, with
     // retry logic
     virtual rocksdb::Status RetryGet(const std::string& fname, uint64_t offset, size_t n,
                                      HTTP::headers& response_headers, rocksdb::Slice* response_body, char* scratch);
+    // Perform a GET for the last n bytes of the named file (a suffix range
+    // request), with retry logic, learning the file's total size from the
+    // Content-Range response header. The range header is formulated by
+    // rewriting the one PrepareGet produces for [0,n). If the server doesn't
+    // support suffix ranges, falls back to HEAD and then GET.
+    virtual rocksdb::Status RetryGetSuffix(const std::string& fname, size_t n, rocksdb::Slice* response_body,
+                                           char* scratch, uint64_t& file_size);
+    // Determine a validator string for the object underlying the named file,
+    // such that the cached contents of the file are still current if the
+    // validator is unchanged. The base method HEADs the file (once per
+    // process) and combines its ETag and Content-Length.
+    virtual rocksdb::Status GetValidator(const std::string& fname, std::string& validator);
+
+    // Identify the named file's pages in the range and disk caches, by a URL
+    // and name. The base method uses base_url and fname; subclasses reading
+    // objects shared with other envs may key them by the objects' own URLs,
+    // so that their cached pages are shared too.
+    virtual void CacheKey(const std::string& fname, std::string& url, std::string& name) {
+        url = base_url_;
+        name = fname;
+    }
+
+    // Read the specified range of the named file (or object), of the given
+    // total size, through the range and disk caches if configured; that is,
+    // fetching page-aligned ranges over HTTP as needed to fill any missing
+    // pages.
+    virtual rocksdb::Status ReadRange(const std::string& fname, uint64_t file_size, uint64_t offset, size_t n,
+                                      rocksdb::Slice* result, char* scratch);
+
+    // Perform a GET for the specified range of the named file, with retry
+    // logic, unless a GET in flight for the same file already covers it, in
+    // which case wait for that one and copy from it. If a GET in flight
+    // overlaps one end of the range, only the remainder is requested. If etag
+    // is provided, it's set to the ETag response header, if any.
+    rocksdb::Status SharedGet(const std::string& fname, uint64_t offset, size_t n,
+                              rocksdb::Slice* result, char* scratch, std::string* etag = nullptr);
+
+    // Perform GET requests for many ranges of the named file concurrently,
+    // through the asynchronous client, with retry logic applied to each. The
+    // outcome of each request is recorded in its status; the return value is
+    // the first error encountered, if any.
+    virtual rocksdb::Status RetryGetMany(const std::string& fname, std::vector<HTTPReadRequest>& reqs);
+
+    // Perform one multi-range GET for several ranges of the named file, with
+    // retry logic, distributing the multipart/byteranges response into the
+    // requests. The range header combines the ranges PrepareGet formulates for
+    // each request. If the server doesn't honor the multi-range request, falls
+    // back to RetryGetMany (and skips the attempt in the future).
+    virtual rocksdb::Status RetryGetRanges(const std::string& fname, std::vector<HTTPReadRequest>& reqs);
+
+    // Begin a single, asynchronous GET attempt for the specified range of the
+    // named file (or object), of the given total size, into a buffer owned by
+    // g. If this succeeds, FinishGet must be called before g is destroyed.
+    // If the range or disk cache is configured, the range is instead read by
+    // a worker thread through ReadRange, and so through the caches.
+    rocksdb::Status StartGet(const std::string& fname, uint64_t file_size, uint64_t offset, size_t n,
+                             HTTPAsyncGet& g);
+    // Wait for an asynchronous GET to complete, and check its outcome. No
+    // retries are attempted (except by ReadRange).
+    rocksdb::Status FinishGet(HTTPAsyncGet& g, rocksdb::Slice* response_body);
+
+    // Choose the mirror for the next attempt of a request (attempt 0 being
+    // the first): the best one the request hasn't tried yet. Returns true if
+    // the retry delay should precede the attempt, because every mirror has
+    // been tried (whereupon they may all be tried again).
+    bool NextMirror(HTTPMirrorAttempts& attempts, unsigned int attempt);
+    // The number of attempts at each request: one per mirror, plus
+    // HTTPEnvOptions::retry_times
+    unsigned int MaxAttempts() const { return opts_.retry_times + (unsigned int)mirrors_.size(); }
+
+    // Evaluate the outcome of a range GET from the given mirror, logging it
+    // and recording it in the mirror's health. retryable is set if a failure
+    // may succeed on retry: a server or transport error, or a 403 or 404
+    // while other mirrors (which may have the file) remain untried.
+    rocksdb::Status CheckGetResponse(const std::string& url, const HTTPMirrorAttempts& mirror, uint64_t offset, size_t n, CURLcode c,
+                                     long response_code, const HTTP::headers& response_headers,
+                                     size_t response_size, unsigned int millis, bool& retryable);
+
+    // The asynchronous client, created if necessary
+    HTTP::AsyncClient* AsyncClient();
 
     // Censor a URL before putting into the log. Subclasses may wish to remove
     // sensitive information.
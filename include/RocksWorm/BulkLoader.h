@@ -0,0 +1,94 @@
+/*
+BulkLoader: build a RocksDB database, ready for MakeRocksWormFileFromDB,
+directly from key/value pairs, without the memtable and compaction work of
+loading it through Put. The pairs are gathered into batches of about one
+SST's worth, each of which a worker thread writes out with SstFileWriter
+while the next is gathered; the new database then ingests the SSTs, which
+don't overlap, into its bottommost level (and so writes its own MANIFEST,
+CURRENT and IDENTITY). Keys must be added in strictly increasing (bytewise)
+order, unless the loader is told the input is unsorted; then it sorts
+memory-sized runs of the input in parallel, writes them to scratch files,
+and merges them at Finish, keeping the last value added for each key.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <memory>
+#include "rocksdb/options.h"
+#include "rocksdb/table.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+
+// Table options suited to reading over HTTP: large blocks, so that each range
+// request retrieves plenty of data, and full Bloom filters. If partitioned,
+// the index and filters are partitioned too, so that opening a table reads
+// only their top levels, which table readers then hold in memory (as long as
+// cache_index_and_filter_blocks is off, the default), and lookups fetch just
+// the partitions they need.
+rocksdb::BlockBasedTableOptions HTTPTableOptions(bool partitioned = true);
+
+struct BulkLoaderOptions {
+    // Options for the SSTs and the database
+    rocksdb::BlockBasedTableOptions table_options = HTTPTableOptions();
+    rocksdb::CompressionType compression = rocksdb::kSnappyCompression;
+
+    // Uncompressed bytes of keys and values per SST
+    uint64_t target_file_size = 268435456;
+
+    // Batches (or sorted runs) written concurrently. Memory use is about
+    // threads+1 times target_file_size (or sort_buffer_size).
+    unsigned int threads = 4;
+
+    // Whether keys are added in strictly increasing order; if not, the input
+    // is sorted in runs of sort_buffer_size bytes, written to files in
+    // scratch_dir (by default, next to the database as dbpath.bulkload)
+    bool sorted = true;
+    size_t sort_buffer_size = 1073741824;
+    std::string scratch_dir;
+};
+
+class BulkLoader {
+    struct Batch;
+
+    std::string dbpath_, scratch_dir_;
+    bool scratch_created_;
+    BulkLoaderOptions opts_;
+    std::unique_ptr<Batch> batch_;
+    std::string last_key_;
+    bool any_;
+    std::deque<std::future<rocksdb::Status>> in_flight_;
+    std::vector<std::string> ssts_, runs_;  // in key order / input order
+    uint64_t entries_;
+    rocksdb::Status status_;                // first failure, if any
+
+    rocksdb::Status AddSorted(const rocksdb::Slice& key, const rocksdb::Slice& value);
+    // hand the current batch to a worker, to write as the next SST or run
+    rocksdb::Status Submit(bool run);
+    rocksdb::Status WaitForBatches(size_t max_in_flight);
+    rocksdb::Status WriteSST(std::unique_ptr<Batch> batch, const std::string& path);
+    rocksdb::Status WriteRun(std::unique_ptr<Batch> batch, const std::string& path);
+    // merge the sorted runs into the SSTs
+    rocksdb::Status MergeRuns();
+    rocksdb::Status Ingest();
+    void RemoveScratch();
+
+public:
+    // dbpath must not already hold a database
+    BulkLoader(const std::string& dbpath, const BulkLoaderOptions& opts);
+    virtual ~BulkLoader();
+
+    rocksdb::Status Add(const rocksdb::Slice& key, const rocksdb::Slice& value);
+
+    // Write the remaining SSTs and create the database
+    rocksdb::Status Finish();
+
+    // Entries written in key order so far; after Finish, the number of keys
+    // in the database
+    uint64_t entries() const { return entries_; }
+    // SSTs in the database, after Finish
+    size_t ssts() const { return ssts_.size(); }
+};
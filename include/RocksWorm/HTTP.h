@@ -7,6 +7,9 @@
 #include <memory>
 #include <queue>
 #include <mutex>
+#include <vector>
+#include <thread>
+#include <future>
 #include <curl/curl.h>
 
 namespace HTTP {
@@ -66,8 +69,89 @@ CURLcode GET(const std::string url, const headers& request_headers,
              long& response_code, headers& response_headers, std::ostream& response_body,
              CURLpool *pool = nullptr);
 
+// GET with the response body written directly into the caller's buffer, which
+// has room for response_body_capacity bytes. response_body_size is set to the
+// number of bytes received. A response body exceeding the capacity aborts the
+// request with CURLE_WRITE_ERROR.
+CURLcode GET(const std::string url, const headers& request_headers,
+             long& response_code, headers& response_headers,
+             char *response_body, size_t response_body_capacity, size_t& response_body_size,
+             CURLpool *pool = nullptr);
+
 CURLcode HEAD(const std::string url, const headers& request_headers,
               long& response_code, headers& response_headers,
               CURLpool *pool = nullptr);
 
+// PUT or POST the request_body_size bytes at request_body. libcurl supplies a
+// form Content-Type header unless request_headers includes one.
+CURLcode PUT(const std::string url, const headers& request_headers,
+             const char *request_body, size_t request_body_size,
+             long& response_code, headers& response_headers, std::ostream& response_body,
+             CURLpool *pool = nullptr);
+
+CURLcode POST(const std::string url, const headers& request_headers,
+              const char *request_body, size_t request_body_size,
+              long& response_code, headers& response_headers, std::ostream& response_body,
+              CURLpool *pool = nullptr);
+
+CURLcode DELETE(const std::string url, const headers& request_headers,
+                long& response_code, headers& response_headers,
+                CURLpool *pool = nullptr);
+
+// Parse the value of a Content-Range response header, "bytes first-last/total".
+// total is set to UINT64_MAX if unknown ("*").
+bool ParseContentRange(const std::string& value, uint64_t& first, uint64_t& last, uint64_t& total);
+
+// One part of a multipart/byteranges response body: the byte range
+// [offset, offset+size) of the resource, whose contents are at data
+struct ByteRange {
+    uint64_t offset;
+    uint64_t size;
+    const char *data;
+};
+
+// Parse a multipart/byteranges response body (RFC 7233), given the value of
+// the Content-Type response header. The parts point into body.
+bool ParseMultipartByteranges(const std::string& content_type, const char *body, size_t size,
+                              std::vector<ByteRange>& parts);
+
+enum class HTTPmethod;
+
+// Asynchronous HTTP client multiplexing any number of concurrent requests onto
+// one curl multi handle, driven by a single background event-loop thread. The
+// request methods return immediately with a future for the CURLcode; the
+// caller's output parameters must remain valid until that future is ready. One
+// client can be shared by many threads and HTTP Env instances.
+class AsyncClient {
+    struct Transfer;
+
+    CURLM *multi_;
+    int wakeup_[2];
+    std::thread thread_;
+    std::mutex mu_;
+    std::vector<Transfer*> submitted_;
+    bool stop_;
+    CURLpool pool_;
+
+    void Run();
+    void Wakeup();
+    std::future<CURLcode> Submit(HTTPmethod method, const std::string& url, const headers& request_headers,
+                                 long& response_code, headers& response_headers,
+                                 char *response_body, size_t response_body_capacity, size_t *response_body_size);
+
+public:
+    // max_connections bounds the number of server connections open at once;
+    // additional requests queue inside libcurl.
+    AsyncClient(const unsigned int max_connections = 64);
+    virtual ~AsyncClient();
+
+    // Counterpart of the buffer-sink HTTP::GET
+    std::future<CURLcode> GET(const std::string& url, const headers& request_headers,
+                              long& response_code, headers& response_headers,
+                              char *response_body, size_t response_body_capacity, size_t& response_body_size);
+
+    std::future<CURLcode> HEAD(const std::string& url, const headers& request_headers,
+                               long& response_code, headers& response_headers);
+};
+
 }
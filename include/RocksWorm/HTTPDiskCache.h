@@ -0,0 +1,78 @@
+/*
+HTTPDiskCache: persistent cache of fixed-size, aligned pages of files read over
+HTTP, stored in a local directory (e.g. on NVMe) so that they survive process
+restarts. Each page is one file, written to a temporary name and then renamed
+into place, and carrying a checksum over its contents; the directory itself is
+thus the crash-safe index, and torn or corrupt entries are discarded. Each page
+also records a validator for the object it came from (ETag and size), and a
+lookup with a different validator treats the page as stale.
+*/
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+#include "rocksdb/status.h"
+
+class HTTPDiskCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stale = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        uint64_t usage = 0;
+    };
+
+private:
+    std::string dir_;
+    uint64_t capacity_;
+    size_t page_size_;
+
+    // LRU index of the page files, by file name (most recently used first)
+    using entry = std::pair<std::string, uint64_t>;
+    std::mutex mu_;
+    std::list<entry> lru_;
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+    uint64_t usage_;
+    uint64_t tmp_counter_;
+    std::atomic<uint64_t> hits_, misses_, stale_, inserts_, evictions_;
+
+    static std::string Key(const std::string& url, const std::string& fname, uint64_t page);
+    static std::string FileName(const std::string& key);
+    void Touch(const std::string& name);
+    // Remove the page file, unless it has been replaced since being read as
+    // the file with inode ino (zero if none was found)
+    void Forget(const std::string& name, ino_t ino);
+    void Admit(const std::string& name, uint64_t size);
+
+public:
+    // capacity bounds the total size of the page files in the directory.
+    // page_size must match that of any HTTPRangeCache used alongside.
+    HTTPDiskCache(const std::string& dir, uint64_t capacity, size_t page_size = 65536);
+    virtual ~HTTPDiskCache() = default;
+
+    // Create the directory if necessary, and index any pages already there
+    // from a previous process. Must be called before use.
+    rocksdb::Status Open();
+
+    size_t page_size() const { return page_size_; }
+
+    // Look up the page with the given number in the file, whose object
+    // currently has the given validator. On a hit, ans is set to the page
+    // contents.
+    bool Lookup(const std::string& url, const std::string& fname, uint64_t page,
+                const std::string& validator, std::string& ans);
+
+    // Store a page, evicting others as needed to stay within capacity.
+    // Failures are ignored, since the cache is only an optimization.
+    void Insert(const std::string& url, const std::string& fname, uint64_t page,
+                const std::string& validator, const char* data, size_t n);
+
+    Stats GetStats();
+};
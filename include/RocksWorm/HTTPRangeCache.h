@@ -0,0 +1,67 @@
+/*
+HTTPRangeCache: in-memory cache of fixed-size, aligned pages of files read over
+HTTP, for use beneath the RocksDB block cache (e.g. to retain SST footer, index
+and filter regions across DB instances, or after block cache eviction). Pages
+are keyed by (URL, file name, page number), so one cache may be shared between
+HTTP Env instances. The cache is sharded by key hash to reduce lock contention,
+and evicts least-recently used pages to stay within its memory budget.
+*/
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <atomic>
+
+class HTTPRangeCache {
+public:
+    // Counters for sizing the cache
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        size_t usage = 0;
+    };
+
+private:
+    struct Shard {
+        using entry = std::pair<std::string, std::shared_ptr<const std::string>>;
+        std::mutex mu;
+        std::list<entry> lru; // most recently used first
+        std::unordered_map<std::string, std::list<entry>::iterator> index;
+        size_t usage = 0;
+    };
+
+    size_t capacity_, page_size_;
+    unsigned int shard_bits_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<uint64_t> hits_, misses_, inserts_, evictions_;
+
+    static std::string Key(const std::string& url, const std::string& fname, uint64_t page);
+    Shard& ShardFor(const std::string& key);
+
+public:
+    // capacity is the memory budget in bytes for page contents. Each of the
+    // 2^shard_bits shards receives an equal portion.
+    HTTPRangeCache(size_t capacity, size_t page_size = 65536, unsigned int shard_bits = 4);
+    virtual ~HTTPRangeCache() = default;
+
+    size_t page_size() const { return page_size_; }
+    size_t capacity() const { return capacity_; }
+
+    // Look up the page with the given number in the file. On a hit, ans is
+    // set to the page contents, which may be shorter than page_size for the
+    // last page of a file.
+    bool Lookup(const std::string& url, const std::string& fname, uint64_t page,
+                std::shared_ptr<const std::string>& ans);
+
+    // Insert a page (replacing any existing copy), evicting others if needed
+    void Insert(const std::string& url, const std::string& fname, uint64_t page,
+                std::shared_ptr<const std::string> data);
+
+    Stats GetStats();
+};
@@ -0,0 +1,91 @@
+/*
+HTTPMultipartUpload: stream an object of unknown size to an HTTP endpoint as
+an S3-compatible multipart upload. Bytes written through an std::ostream on
+the upload are gathered into parts, and each full part is PUT in the
+background, with up to parallel_parts in flight at once; Finish then uploads
+the last part and completes the upload. Requests aren't signed, so the
+endpoint must accept them as is (e.g. a bucket policy or a signing proxy).
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <streambuf>
+#include <unistd.h>
+#include "HTTP.h"
+#include "rocksdb/status.h"
+
+struct HTTPUploadOptions {
+    // HTTP connection pool. If null, the upload will create a private one
+    HTTP::CURLpool *connpool = nullptr;
+
+    // Size of each part but the last (S3 requires at least 5 MiB), and the
+    // number of parts uploaded concurrently; memory use is about their
+    // product. S3 allows at most 10,000 parts per upload.
+    size_t part_size = 67108864;
+    unsigned int parallel_parts = 4;
+
+    // Retry logic for each request, as in HTTPEnvOptions
+    unsigned int retry_times = 4;
+    useconds_t retry_initial_delay = 500000;
+    unsigned int retry_backoff_factor = 2;
+
+    // Additional headers for each request
+    HTTP::headers request_headers;
+};
+
+class HTTPMultipartUpload : public std::streambuf {
+    std::string url_;
+    HTTPUploadOptions opts_;
+    std::unique_ptr<HTTP::CURLpool> own_connpool_;
+    HTTP::CURLpool *connpool_;
+    std::string upload_id_;
+    uint64_t size_;
+
+    std::unique_ptr<char[]> part_;      // being filled (the put area)
+    std::deque<std::future<rocksdb::Status>> in_flight_;
+    std::mutex mu_;
+    std::vector<std::string> etags_;    // by part number-1, under mu_
+    rocksdb::Status status_;            // first failure, if any
+
+    // append the query parameters to the object URL
+    std::string URL(const std::string& query) const;
+    // perform a request with retry logic, failing on any non-2xx response
+    rocksdb::Status Retry(const std::string& method, const std::string& url, const char *body, size_t n,
+                          HTTP::headers& response_headers, std::string& response_body);
+    rocksdb::Status PutPart(unsigned int part_number, std::unique_ptr<char[]> data, size_t n);
+    // upload the contents of the put area as the next part
+    bool Flush();
+    bool WaitForParts(size_t max_in_flight);
+
+protected:
+    int_type overflow(int_type c) override;
+
+    // Censor URLs appearing in error statuses. By default, strips the query
+    // string, which may carry credentials (e.g. of a presigned URL) as well
+    // as the upload ID. Subclasses may censor differently.
+    virtual std::string CensorURL(const std::string& url) const;
+
+public:
+    HTTPMultipartUpload(const std::string& url, const HTTPUploadOptions& opts);
+    virtual ~HTTPMultipartUpload();
+
+    // Initiate the upload; must be called (successfully) before writing
+    rocksdb::Status Begin();
+    // Upload the last part and complete the upload, or abort it if any part
+    // failed
+    rocksdb::Status Finish();
+    // Abort the upload, discarding the parts uploaded so far
+    void Abort();
+
+    // The first failure among the parts uploaded so far, if any
+    rocksdb::Status status() const { return status_; }
+
+    // Bytes written so far
+    uint64_t size() const { return size_ + (pptr() - pbase()); }
+};
@@ -0,0 +1,50 @@
+/*
+RocksWormDeltaHTTPEnv: a RocksWormHTTPEnv that also reads delta files
+(MakeRocksWormFileFromDB --base), which hold only the files new since a prior
+RocksWorm file of the same database, and refer to the rest where they lie
+within the prior file's objects (the roc file or its stripes), by URL and
+offset. Reads of each file are routed to the object holding it. Pages of
+those objects are cached under their own URLs, so that envs on successive
+deltas of one base share them in the range and disk caches. Before its first
+use, each such object is checked (by HEAD) against the ETag and size the
+delta recorded for it, and the delta is rejected if the object has changed.
+*/
+
+#pragma once
+
+#include "RocksWorm/RocksWormHTTPEnv.h"
+#include <map>
+
+class RocksWormDeltaHTTPEnv : public RocksWormHTTPEnv {
+    // outcomes of checking the objects of prior files, by index
+    std::mutex checked_mu_;
+    std::map<size_t, rocksdb::Status> checked_;
+
+    // Resolve an alias of a prior file's object to its index and URL
+    rocksdb::Status PriorObject(const std::string& object, size_t& i, std::string& url);
+    // Check that the object hasn't changed since the delta was made
+    rocksdb::Status CheckPriorObject(const std::string& object, size_t i, const std::string& url);
+
+protected:
+    bool AcceptsDeltas() const override { return true; }
+
+    // Objects of prior RocksWorm files are resolved by ResolveURL against
+    // the delta's URL, once checked
+    rocksdb::Status ObjectURL(const std::string& object, std::string& url) override;
+
+    // HEADs of prior files' objects (by which they're checked) skip the check
+    rocksdb::Status PrepareHead(const std::string& fname,
+                                std::string& url, HTTP::headers& request_headers) override;
+
+public:
+    // url should be the complete URL to the RocksWorm file, which may or may
+    // not be a delta
+    RocksWormDeltaHTTPEnv(const std::string& url, const HTTPEnvOptions& opts)
+        : RocksWormHTTPEnv(url,opts) {}
+    virtual ~RocksWormDeltaHTTPEnv() = default;
+
+    // Resolve a reference recorded in a delta file against the delta's URL:
+    // as is if absolute ("scheme://..."), against the scheme and host if it
+    // begins with a slash, or else against the delta's directory
+    static std::string ResolveURL(const std::string& base, const std::string& ref);
+};
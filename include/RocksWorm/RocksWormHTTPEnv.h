@@ -1,7 +1,11 @@
 /*
 RocksWormHTTPEnv: an HTTP env that reads from a single RocksWorm file, which is a
 simple file format concatenating the constituent files of a RocksDB database,
-with a manifest. See MakeRocksWorm.cc for format details
+with a manifest. Formats ROC0 and ROC1 are supported; see
+MakeRocksWormFileFromDB.cc and src/RocksWormFormat.h for format details. A
+ROC1 file may have its SSTs striped across several objects, named relative to
+its URL, to which reads of those files are routed. Delta files, which refer
+to files of a prior RocksWorm file, are read by RocksWormDeltaHTTPEnv.
 */
 
 #pragma once
@@ -10,17 +14,165 @@ with a manifest. See MakeRocksWorm.cc for format details
 
 #include "RocksWorm/BaseHTTPEnv.h"
 #include <sstream>
+#include <vector>
+#include <memory>
+#include <mutex>
 #include <map>
+#include <future>
 
-// file name -> <starting offset within roc, file size>
-using RocksWormManifest = std::map<std::string, std::pair<std::uint64_t, std::uint64_t>>;
+// location of a file within the roc file (or one of its stripe objects)
+struct RocksWormManifestEntry {
+    uint32_t object = 0;    // index into RocksWormManifest::objects
+    uint64_t offset = 0;    // within the object
+    uint64_t size = 0;
+    // CRC32C of the file contents, if has_crc32c (format ROC1 and later)
+    uint32_t crc32c = 0;
+    bool has_crc32c = false;
+    // if the file's trailing metadata (e.g. SST index and filter blocks) is
+    // also copied into the metadata region: the offset within the file at
+    // which it begins, and the offset of the copy within the roc file
+    bool has_metadata_copy = false;
+    uint64_t metadata_offset = 0;
+    uint64_t metadata_copy = 0;
+};
+
+// A page of the manifest: consecutive entries, sorted by file name
+using RocksWormManifestPage = std::vector<std::pair<std::string, RocksWormManifestEntry>>;
+
+// Where to find a page of the manifest
+struct RocksWormManifestPageRef {
+    std::string last_name;          // of the page's last entry
+    uint64_t first_index = 0;       // of the page's first entry, within the whole manifest
+    uint64_t count = 0;
+    // the page's location within the roc file (if the manifest is paged)
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t crc32c = 0;
+};
+
+// An object holding files of the database: the roc file itself, or a stripe
+// (MakeRocksWormFileFromDB --stripes), named relative to the roc file's URL,
+// or, in a delta (MakeRocksWormFileFromDB --base), an object of a prior
+// RocksWorm file, given by URL
+struct RocksWormObject {
+    std::string name;       // empty for the roc file; an alias for a prior file's object
+    uint64_t size = 0;
+    std::string url;        // of a prior file's object, as recorded (absolute or relative)
+    std::string etag;       // of a prior file's object when the delta was made (empty if unknown)
+};
+
+// Where a file lies, as reported by RocksWormHTTPEnv::LocateFile
+struct RocksWormFileLocation {
+    std::string object_url;
+    uint64_t object_size = 0;
+    uint64_t offset = 0;    // within the object
+    uint64_t size = 0;
+    uint32_t crc32c = 0;
+    bool has_crc32c = false;
+};
+
+// The manifest, as a directory of pages. Unless the manifest is paged
+// (MakeRocksWormFileFromDB --manifest-page), it consists of a single page
+// loaded along with it; otherwise, only the directory is loaded, and each
+// page is fetched when first needed.
+struct RocksWormManifest {
+    bool paged = false;
+    uint64_t file_count = 0;
+    std::vector<RocksWormManifestPageRef> directory;
+    // the roc file, followed by any stripes
+    std::vector<RocksWormObject> objects;
+    // the region holding all the pages, if paged
+    uint64_t pages_offset = 0;
+    uint64_t pages_size = 0;
+    uint32_t pages_crc32c = 0;
+};
+
+// A copy of an SST's trailing metadata, for the manifest entry with the given
+// index (see RocksWormManifestEntry)
+struct RocksWormMetadataCopy {
+    uint64_t entry = 0;
+    uint64_t metadata_offset = 0;
+    uint64_t metadata_copy = 0;
+};
+
+// The global index (MakeRocksWormFileFromDB --global-index): for each SST,
+// its smallest user key and groups of its consecutive data blocks, each with
+// an upper bound on the group's user keys
+struct RocksWormIndexGroup {
+    std::string largest;
+    uint64_t offset = 0;                // of the first block, within the SST
+    std::vector<uint32_t> block_sizes;  // excluding block trailers
+};
+
+struct RocksWormIndexRun {
+    uint64_t entry = 0;                 // index of the SST's manifest entry
+    std::string smallest;
+    std::vector<RocksWormIndexGroup> groups;
+};
+
+// The trailing portion of the RocksWorm file fetched along with the manifest.
+// Files lying entirely within it (in particular the CURRENT, IDENTITY and
+// MANIFEST files, which the writer places there) are served from memory, as
+// are SST metadata copies within it.
+struct RocksWormTail {
+    uint64_t offset = 0;
+    std::string data;
+    // the metadata copies usable from data, sorted by entry index; applied to
+    // the manifest entries as their pages are loaded
+    std::vector<RocksWormMetadataCopy> metadata_copies;
+    // the global filter over the database's keys, within data, if any
+    rocksdb::Slice global_filter;
+    // the global index, if any, parsed from data
+    std::vector<RocksWormIndexRun> global_index;
+};
+
+// A read of a file within the RocksWorm file, to be performed in a batch by
+// RocksWormHTTPEnv::MultiRead
+struct RocksWormReadRequest : public HTTPReadRequest {
+    std::string fname;
+};
 
 class RocksWormHTTPEnv : public BaseHTTPEnv {
 protected:
-    RocksWormManifest manifest_;
+    // The manifest is loaded once, under manifest_mu_, and then published
+    // immutable through atomic_load/atomic_store, so that readers needn't
+    // lock.
+    std::shared_ptr<const RocksWormManifest> manifest_;
+    std::mutex manifest_mu_;
+    // published (before manifest_) along with the manifest
+    std::shared_ptr<const RocksWormTail> tail_;
+    // the loaded pages of the manifest, parallel to its directory; allocated
+    // before manifest_ is published, after which each page is published like
+    // the manifest once loaded. Each page is loaded by the first thread to
+    // need it, registering the load in page_loads_ (under pages_mu_) for any
+    // others needing the same page meanwhile to wait on; loads of different
+    // pages proceed concurrently.
+    std::unique_ptr<std::shared_ptr<const RocksWormManifestPage>[]> pages_;
+    std::mutex pages_mu_;
+    std::map<size_t, std::shared_future<rocksdb::Status>> page_loads_;
 
-    rocksdb::Status GetTail(size_t n, rocksdb::Slice* ans, char* scratch);
-    rocksdb::Status EnsureManifest();
+    rocksdb::Status GetTail(size_t n, rocksdb::Slice* ans, char* scratch, uint64_t& rocsz);
+    rocksdb::Status EnsureManifest(std::shared_ptr<const RocksWormManifest>& manifest);
+    // Get the i'th page of the manifest, fetching it if we haven't already
+    rocksdb::Status EnsurePage(const RocksWormManifest& manifest, size_t i,
+                               std::shared_ptr<const RocksWormManifestPage>& page);
+    // Fetch and parse the i'th page of the manifest
+    rocksdb::Status LoadPage(const RocksWormManifest& manifest, size_t i,
+                             std::shared_ptr<const RocksWormManifestPage>& page);
+    // Look up the offset and size of the named file within its object
+    rocksdb::Status Locate(const std::string& fname, uint64_t& file_offset, uint64_t& file_size);
+    // Look up the named file's manifest entry
+    rocksdb::Status Lookup(const std::string& fname, RocksWormManifestEntry& entry);
+    // Look up a manifest entry by its index (in file name order)
+    rocksdb::Status LookupIndex(uint64_t index, RocksWormManifestEntry& entry);
+    // Get the URL of the named object (the roc file or a stripe)
+    virtual rocksdb::Status ObjectURL(const std::string& object, std::string& url);
+    // Whether to accept delta files, whose objects include those of prior
+    // RocksWorm files (see RocksWormDeltaHTTPEnv)
+    virtual bool AcceptsDeltas() const { return false; }
+    // If [offset, offset+n) of the roc file lies within the tail, get it
+    bool GetFromTail(uint64_t offset, uint64_t n, std::shared_ptr<const RocksWormTail>& tail,
+                     rocksdb::Slice& contents);
 
 public:
     // url should be the complete URL to the RocksWorm file. The Db using this
@@ -29,70 +181,92 @@ public:
         : BaseHTTPEnv(url,opts) {}
     virtual ~RocksWormHTTPEnv() = default;
 
-    rocksdb::Status GetChildren(const std::string& dir, std::vector<std::string>* result) override {
-        assert(result);
-        if (dir.find('/') != dir.rfind('/')) return rocksdb::Status::InvalidArgument("RocksWormHTTPEnv::GetChildren");
+    // Enumerates all the files, unless the manifest is paged. Listing a paged
+    // manifest in full would take all its pages, while RocksDB lists the
+    // database directory upon each open only to look for write-ahead logs,
+    // which RocksWorm files never hold; so only CURRENT and the MANIFEST it
+    // names are listed, whose pages opening the database loads anyway. Use
+    // ListFiles to enumerate all the files of a paged manifest.
+    rocksdb::Status GetChildren(const std::string& dir, std::vector<std::string>* result) override;
 
-        rocksdb::Status s = EnsureManifest();
-        if (!s.ok()) return s;
-
-        result->clear();
-        for (auto it = manifest_.begin(); it != manifest_.end(); it++) {
-            result->push_back(it->first);
-        }
-        assert(result->size());
-        return rocksdb::Status::OK();
-    }
+    // Enumerate all the files, fetching all the pages of a paged manifest
+    // (in one request, without retaining them)
+    rocksdb::Status ListFiles(std::vector<std::string>* result);
 
     rocksdb::Status GetFileSize(const std::string& fname, uint64_t* file_size) override {
         assert(file_size);
         if (fname.find('/') == std::string::npos) return rocksdb::Status::InvalidArgument("RocksWormHTTPEnv::GetFileSize");
-        rocksdb::Status s = EnsureManifest();
-        if (!s.ok()) return s;
-
-        auto it = manifest_.find(fname.substr(fname.find('/')+1));
-        if (it == manifest_.end()) return rocksdb::Status::NotFound(fname);
-        *file_size = it->second.second;
-        return rocksdb::Status::OK();
+        uint64_t file_offset;
+        return Locate(fname, file_offset, *file_size);
     }
 
+    // Get the CRC32C checksum of the named file's contents, recorded in the
+    // manifest (format ROC1 and later)
+    rocksdb::Status GetFileChecksum(const std::string& fname, uint32_t& crc32c);
+
+    // Locate the named file within the object holding it, e.g. for a delta
+    // file to refer to it (MakeRocksWormFileFromDB --base)
+    rocksdb::Status LocateFile(const std::string& fname, RocksWormFileLocation& ans);
+
+    // Parse the objects section of a ROC1 footer, appending the stripes to
+    // ans (following the roc file itself). Objects of prior RocksWorm files,
+    // named by URL, are appended too if deltas are accepted, and otherwise
+    // rejected as corrupt.
+    static rocksdb::Status ParseObjects(const rocksdb::Slice& section, bool deltas,
+                                        std::vector<RocksWormObject>& ans);
+
+    // Check the global filter over the keys of the database, if the RocksWorm
+    // file has one (MakeRocksWormFileFromDB --global-filter). If false, the
+    // key is definitely absent, so a lookup can be answered without any HTTP
+    // requests. Otherwise (including if there's no filter), the key may be
+    // present.
+    bool MayContain(const rocksdb::Slice& key);
+
+    // Look up a key using the global index, if the RocksWorm file has one
+    // (MakeRocksWormFileFromDB --global-index). The data blocks that may hold
+    // the key (at most one group per SST) are fetched in a single multi-range
+    // request (one per stripe, if striped; after any pages of a paged manifest needed to locate them),
+    // bypassing the range caches, and searched for the key's newest
+    // entry. Returns NotFound if there's none or it's a deletion, and
+    // NotSupported if the file lacks the global index or the entry can't be
+    // interpreted here (e.g. a merge operand); the caller should then fall
+    // back to DB::Get.
+    rocksdb::Status IndexedGet(const rocksdb::Slice& key, std::string* value);
+
+    // Perform many reads of files within the RocksWorm file using a few HTTP
+    // requests, as opposed to one for each read: ranges of the roc file (or
+    // of one stripe) separated by no more than HTTPEnvOptions::multi_range_gap
+    // are merged, and the merged ranges are requested in batches of
+    // multi-range GETs. The
+    // outcome of each read is recorded in its status; the return value is the
+    // first error encountered, if any. Reads bypass the range caches.
+    rocksdb::Status MultiRead(std::vector<RocksWormReadRequest>& reqs);
+
+    rocksdb::Status NewSequentialFile(const std::string& fname,
+                                      std::unique_ptr<rocksdb::SequentialFile>* result,
+                                      const rocksdb::EnvOptions& options) override;
+
+    rocksdb::Status NewRandomAccessFile(const std::string& fname,
+                                        std::unique_ptr<rocksdb::RandomAccessFile>* result,
+                                        const rocksdb::EnvOptions& options) override;
+
+    // Each file within the RocksWorm file is read as a range of the object
+    // holding it (the roc file itself, with the empty object name, a stripe,
+    // or in a delta, an object of a prior file), with absolute offsets; the
+    // manifest isn't consulted again after opening.
+    rocksdb::Status ResolveFile(const std::string& fname, std::string& object, uint64_t& object_size,
+                                uint64_t& base_offset, uint64_t& size) override;
+
+    // Files are validated by the object holding them as a whole
+    rocksdb::Status GetValidator(const std::string& fname, std::string& validator) override;
+
+    // Objects are cached under their own URLs, so that envs on a RocksWorm
+    // file and its deltas (see RocksWormDeltaHTTPEnv) share their pages
+    void CacheKey(const std::string& fname, std::string& url, std::string& name) override;
+
     rocksdb::Status PrepareHead(const std::string& fname,
-                                std::string& url, HTTP::headers& request_headers) override {
-        // only used in EnsureManifest/GetTail to get the total size of the roc file
-        assert(fname.size() == 0);
-        url = base_url_;
-        request_headers.clear();
-        return rocksdb::Status::OK();
-    }
+                                std::string& url, HTTP::headers& request_headers) override;
 
     rocksdb::Status PrepareGet(const std::string& fname, uint64_t offset, size_t n,
-                               std::string& url, HTTP::headers& request_headers) override {
-        if (fname.size() == 0) {
-            // only used in EnsureManifest/GetTail to read the roc manifest
-            return BaseHTTPEnv::PrepareGet(fname, offset, n, url, request_headers);
-        }
-        if (fname.find('/') == std::string::npos) return rocksdb::Status::InvalidArgument("RocksWormHTTPEnv::PrepareGet");
-
-        rocksdb::Status s = EnsureManifest();
-        if (!s.ok()) return s;
-        request_headers.clear();
-        s = BaseHTTPEnv::PrepareGet("", offset, n, url, request_headers);
-        if (!s.ok()) return s;
-
-        auto it = manifest_.find(fname.substr(fname.find('/')+1));
-        if (it == manifest_.end()) return rocksdb::Status::NotFound(fname);
-        uint64_t file_offset = it->second.first, file_size = it->second.second;
-
-        if (offset+n > file_size) {
-            return rocksdb::Status::InvalidArgument("RocksWormHTTPEnv::PrepareGet");
-        }
-
-        url = base_url_;
-
-        std::ostringstream fmt_range;
-        fmt_range << "bytes=" << file_offset+offset << "-" << (file_offset+offset+n-1);
-        request_headers["range"] = fmt_range.str();
-
-        return rocksdb::Status::OK();
-    }
+                               std::string& url, HTTP::headers& request_headers) override;
 };
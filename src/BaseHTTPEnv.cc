@@ -2,28 +2,171 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <math.h>
 #include <sstream>
+#include <future>
+#include <list>
+#include <algorithm>
+#include <inttypes.h>
 using namespace std;
 using namespace rocksdb;
 
 class BaseHTTPRandomAccessFile : public RandomAccessFile {
+    // a window of the file held in memory by read-ahead or prefetching
+    struct Window {
+        uint64_t offset = 0;
+        size_t size = 0;
+        unique_ptr<char[]> data;
+    };
+
+    // maximum number of prefetches in flight per file; further Prefetch
+    // calls are ignored until some are read or dropped
+    static const size_t kMaxPrefetches = 4;
+    // after Hint(RANDOM), length of the sequential run of reads required
+    // before read-ahead resumes
+    static const unsigned int kRandomHintSequentialReads = 4;
+
+    // the file is [base_, base_+sz_) of object_, of object_size_ bytes, as
+    // resolved by BaseHTTPEnv::ResolveFile upon opening; offsets below are
+    // relative to base_, except those of HTTPAsyncGets
     BaseHTTPEnv *env_;
-    string fname_;
+    string object_;
+    uint64_t object_size_;
+    uint64_t base_;
     uint64_t sz_;
 
-    // TODO: detect sequential access patterns (which may occur through
-    // RandomAccessFile being used by db iterators) and perform some read-
-    // ahead/caching. Potentially factorable into a subclass of generic
-    // utility for RocksDB.
+    // Read-ahead state: sequential access patterns (which may occur through
+    // RandomAccessFile being used by db iterators) are detected by each read
+    // beginning where the previous one ended. While they continue, the
+    // read-ahead window doubles up to HTTPEnvOptions::readahead_max_size, the
+    // current window is held in window_, and the next one is prefetched.
+    // Prefetch() and Hint() adjust this policy, and may add prefetches of
+    // their own to those in flight. Prefetches are dropped once reading has
+    // passed them by, or upon a read elsewhere that none of them covers.
+    // Reads don't wait for dropped prefetches: they're set aside in dropped_
+    // until they complete (their buffers receiving the responses meanwhile),
+    // and count against kMaxPrefetches until then.
+    mutable mutex mu_;
+    mutable uint64_t last_end_;
+    mutable unsigned int sequential_reads_;
+    mutable size_t readahead_;
+    mutable Window window_;
+    mutable list<unique_ptr<HTTPAsyncGet>> prefetches_;
+    mutable list<unique_ptr<HTTPAsyncGet>> dropped_;
+    AccessPattern hint_;
+
+    // copy [offset,offset+n) from the current window if it's held there
+    bool ReadWindow(uint64_t offset, size_t n, Slice* result, char* scratch) const {
+        if (!window_.data || offset < window_.offset || offset+n > window_.offset+window_.size) {
+            return false;
+        }
+        memcpy(scratch, window_.data.get() + (offset-window_.offset), n);
+        *result = Slice(scratch, n);
+        return true;
+    }
+
+    // begin an asynchronous GET of [offset,offset+n) unless one in flight
+    // already covers it (or too many are in flight)
+    Status StartPrefetch(uint64_t offset, size_t n) const {
+        ReapDropped();
+        if (prefetches_.size() + dropped_.size() >= kMaxPrefetches) return Status::OK();
+        for (const auto& g : prefetches_) {
+            if (base_+offset >= g->offset && base_+offset+n <= g->offset+g->n) return Status::OK();
+        }
+        unique_ptr<HTTPAsyncGet> g(new HTTPAsyncGet);
+        Status s = env_->StartGet(object_, object_size_, base_+offset, n, *g);
+        if (s.ok()) {
+            prefetches_.push_back(move(g));
+        }
+        return s;
+    }
+
+    // begin prefetching the window following the current one, if sequential
+    // reading is underway
+    void PrefetchNext() const {
+        if (!readahead_ || !window_.data) return;
+        uint64_t next = window_.offset + window_.size;
+        if (next >= sz_) return;
+        StartPrefetch(next, min(uint64_t(readahead_), sz_-next));
+    }
+
+    // set aside prefetches removed from prefetches_, without waiting for them
+    void DropPrefetches(list<unique_ptr<HTTPAsyncGet>>& dropped) const {
+        dropped_.splice(dropped_.end(), dropped);
+        ReapDropped();
+    }
+
+    // discard those dropped prefetches which have completed
+    void ReapDropped() const {
+        for (auto it = dropped_.begin(); it != dropped_.end(); ) {
+            if ((*it)->ready()) {
+                Slice ignore;
+                env_->FinishGet(**it, &ignore);
+                it = dropped_.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    // if a prefetch in flight covers [offset,offset+n), wait for it to
+    // complete and make it the current window, then read from it. Prefetches
+    // lying entirely before offset are dropped along the way.
+    bool ReadPrefetched(uint64_t offset, size_t n, Slice* result, char* scratch,
+                        unique_lock<mutex>& lock) const {
+        list<unique_ptr<HTTPAsyncGet>> passed;
+        unique_ptr<HTTPAsyncGet> g;
+        for (auto it = prefetches_.begin(); it != prefetches_.end(); ) {
+            if (!g && base_+offset >= (*it)->offset && base_+offset+n <= (*it)->offset+(*it)->n) {
+                g = move(*it);
+                it = prefetches_.erase(it);
+            } else if ((*it)->offset+(*it)->n <= base_+offset) {
+                passed.splice(passed.end(), prefetches_, it++);
+            } else {
+                it++;
+            }
+        }
+        DropPrefetches(passed);
+        if (!g) return false;
+
+        lock.unlock();
+        Slice data;
+        Status s = env_->FinishGet(*g, &data);
+        lock.lock();
+        if (!s.ok() || data.size() != g->n) {
+            return false;
+        }
+        window_.offset = g->offset-base_;
+        window_.size = g->n;
+        window_.data = move(g->buf);
+        return ReadWindow(offset, n, result, scratch);
+    }
+
 public:
-    BaseHTTPRandomAccessFile(BaseHTTPEnv* env, const string& fname, uint64_t sz) 
+    BaseHTTPRandomAccessFile(BaseHTTPEnv* env, const string& object, uint64_t object_size, uint64_t base, uint64_t sz) 
         : env_(env)
-        , fname_(fname)
+        , object_(object)
+        , object_size_(object_size)
+        , base_(base)
         , sz_(sz)
+        , last_end_(0)
+        , sequential_reads_(0)
+        , readahead_(0)
+        , hint_(NORMAL)
     {
     }
 
-    Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const {
+    ~BaseHTTPRandomAccessFile() {
+        // the GETs' buffers must outlive them
+        prefetches_.splice(prefetches_.end(), dropped_);
+        for (auto& g : prefetches_) {
+            Slice ignore;
+            env_->FinishGet(*g, &ignore);
+        }
+    }
+
+    Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const override {
         assert(result);
         assert(scratch);
         n = min(n, sz_-offset);
@@ -32,38 +175,358 @@ public:
             return Status::OK();
         }
 
-        HTTP::headers response_headers;
-        return env_->RetryGet(fname_, offset, n, response_headers, result, scratch);
+        const HTTPEnvOptions& opts = env_->opts_;
+        unique_lock<mutex> lock(mu_);
+        if (offset == last_end_) {
+            sequential_reads_++;
+        } else {
+            sequential_reads_ = 0;
+        }
+        last_end_ = offset+n;
+        if (opts.readahead_max_size == 0) {
+            readahead_ = 0;
+        } else if (hint_ == SEQUENTIAL) {
+            readahead_ = opts.readahead_max_size;
+        } else if (sequential_reads_ >= (hint_ == RANDOM ? kRandomHintSequentialReads : 1)) {
+            readahead_ = readahead_ ? min(readahead_*2, opts.readahead_max_size)
+                                    : min(opts.readahead_initial_size, opts.readahead_max_size);
+        } else {
+            readahead_ = 0;
+        }
+
+        if (ReadWindow(offset, n, result, scratch)
+            || ReadPrefetched(offset, n, result, scratch, lock)) {
+            PrefetchNext();
+            return Status::OK();
+        }
+
+        if (!sequential_reads_ && !prefetches_.empty()) {
+            // we've moved elsewhere, so the prefetches in flight will likely
+            // go unread
+            DropPrefetches(prefetches_);
+        }
+
+        if (!readahead_) {
+            lock.unlock();
+            return env_->ReadRange(object_, object_size_, base_+offset, n, result, scratch);
+        }
+
+        // sequential read beyond what we have: fetch the read-ahead window
+        // synchronously
+        Window w;
+        w.offset = offset;
+        w.size = min(uint64_t(max(n, readahead_)), sz_-offset);
+        w.data.reset(new char[w.size]);
+        lock.unlock();
+        Slice data;
+        Status s = env_->ReadRange(object_, object_size_, base_+w.offset, w.size, &data, w.data.get());
+        if (!s.ok()) return s;
+        if (data.size() != w.size) return Status::IOError("Unexpected HTTP response body length");
+        lock.lock();
+        window_ = move(w);
+        bool ok = ReadWindow(offset, n, result, scratch);
+        assert(ok);
+        PrefetchNext();
+        return ok ? Status::OK() : Status::IOError("BaseHTTPRandomAccessFile::Read");
+    }
+
+    // Begin fetching the range in the background, to be held in memory for
+    // subsequent reads
+    Status Prefetch(uint64_t offset, size_t n) override {
+        if (offset >= sz_) return Status::OK();
+        n = min(uint64_t(n), sz_-offset);
+        if (n == 0) return Status::OK();
+        lock_guard<mutex> lock(mu_);
+        if (window_.data && offset >= window_.offset && offset+n <= window_.offset+window_.size) {
+            return Status::OK();
+        }
+        return StartPrefetch(offset, n);
+    }
+
+    // SEQUENTIAL: read-ahead at the maximum window size from the first read
+    // RANDOM: read-ahead only after a longer sequential run than usual
+    // NORMAL: adaptive read-ahead as described above
+    // WILLNEED: prefetch the file, up to the maximum read-ahead window size
+    // DONTNEED: release the window held in memory, and drop any prefetches
+    void Hint(AccessPattern pattern) override {
+        const HTTPEnvOptions& opts = env_->opts_;
+        lock_guard<mutex> lock(mu_);
+        switch (pattern) {
+        case NORMAL:
+        case RANDOM:
+        case SEQUENTIAL:
+            hint_ = pattern;
+            sequential_reads_ = 0;
+            readahead_ = 0;
+            break;
+        case WILLNEED:
+            if (sz_) {
+                StartPrefetch(0, min(sz_, uint64_t(max(opts.readahead_max_size, opts.readahead_initial_size))));
+            }
+            break;
+        case DONTNEED:
+            window_ = Window();
+            readahead_ = 0;
+            DropPrefetches(prefetches_);
+            break;
+        }
     }
 };
 
+// Sequential file reading the object in chunks of
+// HTTPEnvOptions::sequential_chunk_size, double-buffered: while reads are
+// served from the current chunk, the next one is fetched in the background.
 class BaseHTTPSequentialFile : public SequentialFile {
-    BaseHTTPRandomAccessFile f_;
+    // the file is [base_, base_+sz_) of object_, of object_size_ bytes;
+    // offsets below are relative to base_, except that of next_
+    BaseHTTPEnv *env_;
+    string object_;
+    uint64_t object_size_;
+    uint64_t base_;
+    uint64_t sz_;
     uint64_t pos_;
 
+    // the current chunk
+    uint64_t chunk_offset_;
+    size_t chunk_size_;
+    unique_ptr<char[]> chunk_;
+
+    // the next chunk, in flight if next_pending_; its buffer is recycled
+    // from the previous chunk
+    HTTPAsyncGet next_;
+    bool next_pending_;
+
+    void StartNext() {
+        uint64_t next = chunk_offset_ + chunk_size_;
+        if (next_pending_ || !chunk_ || next >= sz_) return;
+        next_pending_ = env_->StartGet(object_, object_size_, base_+next,
+                                       min(uint64_t(env_->opts_.sequential_chunk_size), sz_-next), next_).ok();
+    }
+
+    // make the chunk containing pos_ current
+    Status Advance() {
+        assert(pos_ < sz_);
+        if (next_pending_) {
+            next_pending_ = false;
+            Slice data;
+            Status s = env_->FinishGet(next_, &data);
+            if (s.ok() && data.size() == next_.n && base_+pos_ >= next_.offset && base_+pos_ < next_.offset+next_.n) {
+                swap(chunk_, next_.buf);
+                chunk_offset_ = next_.offset-base_;
+                chunk_size_ = next_.n;
+                StartNext();
+                return Status::OK();
+            }
+            // otherwise (e.g. after Skip) fall through to a synchronous read
+        }
+
+        size_t n = min(uint64_t(env_->opts_.sequential_chunk_size), sz_-pos_);
+        unique_ptr<char[]> buf(new char[n]);
+        Slice data;
+        Status s = env_->ReadRange(object_, object_size_, base_+pos_, n, &data, buf.get());
+        if (!s.ok()) return s;
+        if (data.size() != n) return Status::IOError("Unexpected HTTP response body length");
+        if (data.data() != buf.get()) {
+            memcpy(buf.get(), data.data(), n);
+        }
+        chunk_ = move(buf);
+        chunk_offset_ = pos_;
+        chunk_size_ = n;
+        StartNext();
+        return Status::OK();
+    }
+
 public:
-    BaseHTTPSequentialFile(BaseHTTPEnv* env, const string& fname, uint64_t sz) 
-        : f_(env, fname, sz)
+    BaseHTTPSequentialFile(BaseHTTPEnv* env, const string& object, uint64_t object_size, uint64_t base, uint64_t sz) 
+        : env_(env)
+        , object_(object)
+        , object_size_(object_size)
+        , base_(base)
+        , sz_(sz)
         , pos_(0)
+        , chunk_offset_(0)
+        , chunk_size_(0)
+        , next_pending_(false)
         {}
 
-    Status Read(size_t n, Slice *result, char* scratch) {
-        Status s = f_.Read(pos_, n, result, scratch);
-        if (s.ok()) pos_ += n;
-        return s;
+    ~BaseHTTPSequentialFile() {
+        if (next_pending_) {
+            Slice ignore;
+            env_->FinishGet(next_, &ignore);
+        }
+    }
+
+    Status Read(size_t n, Slice *result, char* scratch) override {
+        assert(result);
+        assert(scratch);
+        n = pos_ < sz_ ? min(uint64_t(n), sz_-pos_) : 0;
+        if (n == 0) {
+            *result = Slice();
+            return Status::OK();
+        }
+
+        if (env_->opts_.sequential_chunk_size == 0) {
+            Status s = env_->ReadRange(object_, object_size_, base_+pos_, n, result, scratch);
+            if (s.ok()) pos_ += result->size();
+            return s;
+        }
+
+        size_t copied = 0;
+        while (copied < n) {
+            if (!chunk_ || pos_ < chunk_offset_ || pos_ >= chunk_offset_+chunk_size_) {
+                Status s = Advance();
+                if (!s.ok()) return s;
+            }
+            size_t k = min(uint64_t(n-copied), chunk_offset_+chunk_size_-pos_);
+            memcpy(scratch+copied, chunk_.get()+(pos_-chunk_offset_), k);
+            copied += k;
+            pos_ += k;
+        }
+        *result = Slice(scratch, n);
+        return Status::OK();
     }
 
-    Status Skip(uint64_t n) {
-        pos_ += n;
+    Status Skip(uint64_t n) override {
+        pos_ = min(pos_+n, sz_);
         return Status::OK();
     }
 };
 
+void HTTPFetchModel::Observe(size_t bytes, double seconds) {
+    double s = double(bytes);
+    lock_guard<mutex> lock(mu_);
+    // the first observations are averaged evenly, until there are enough of
+    // them for the exponential weighting to take over
+    double w = max(alpha_, 1.0/double(++samples_));
+    mean_s_ += w*(s-mean_s_);
+    mean_t_ += w*(seconds-mean_t_);
+    mean_ss_ += w*(s*s-mean_ss_);
+    mean_st_ += w*(s*seconds-mean_st_);
+}
+
+bool HTTPFetchModel::Estimate(double& latency, double& bandwidth) const {
+    lock_guard<mutex> lock(mu_);
+    if (samples_ < 8) return false;
+    double var_s = mean_ss_ - mean_s_*mean_s_;
+    double cov_st = mean_st_ - mean_s_*mean_t_;
+    // the sizes must vary enough to distinguish latency from throughput
+    if (var_s <= 1e-6*mean_ss_ || cov_st <= 0) return false;
+    double slope = cov_st/var_s;
+    latency = mean_t_ - slope*mean_s_;
+    if (latency <= 0) return false;
+    bandwidth = 1.0/slope;
+    return true;
+}
+
+size_t HTTPFetchModel::FetchUnit(size_t page_size, size_t max_unit) const {
+    double latency, bandwidth;
+    size_t unit = page_size;
+    if (page_size && Estimate(latency, bandwidth)) {
+        double bdp = latency*bandwidth;
+        while (unit < bdp && unit*2 <= max_unit) unit *= 2;
+    }
+    return unit;
+}
+
+// the directory portion of a URL (sans query), including the trailing slash
+static string URLDirectory(const string& url) {
+    size_t slash = url.rfind('/', url.find('?'));
+    return url.substr(0, slash == string::npos ? 0 : slash+1);
+}
+
+HTTPMirrorSet::HTTPMirrorSet(const string& base_url, const vector<string>& mirror_urls,
+                             double alpha, double error_half_life)
+    : alpha_(alpha)
+    , error_half_life_(error_half_life)
+    , mirrors_(mirror_urls.size()+1)
+{
+    for (size_t i = 0; i < mirrors_.size(); i++) {
+        string url = i ? mirror_urls[i-1] : base_url;
+        if (url.size() && url[url.size()-1] == '/') {
+            url.erase(url.size()-1);
+        }
+        mirrors_[i].base_url = url;
+        mirrors_[i].base_dir = URLDirectory(url);
+    }
+}
+
+void HTTPMirrorSet::Observe(size_t i, bool ok, double seconds) {
+    assert(i < mirrors_.size());
+    lock_guard<mutex> lock(mu_);
+    Mirror& m = mirrors_[i];
+    // as in HTTPFetchModel, the first observations are averaged evenly
+    double w = max(alpha_, 1.0/double(++m.samples));
+    if (ok) {
+        m.latency += w*(seconds-m.latency);
+        m.error_rate -= w*m.error_rate;
+    } else {
+        // a failure's duration says little about the mirror's latency
+        m.error_rate += w*(1.0-m.error_rate);
+        m.last_error = chrono::steady_clock::now();
+    }
+}
+
+double HTTPMirrorSet::Cost(const Mirror& m, chrono::steady_clock::time_point now) const {
+    double error_rate = 0;
+    if (m.error_rate > 0) {
+        double since = chrono::duration<double>(now - m.last_error).count();
+        error_rate = min(0.99, m.error_rate * exp2(-since/error_half_life_));
+    }
+    // expected tries to succeed, each taking the average latency, plus a
+    // penalty of up to a second for the time a failure may waste
+    return m.latency/(1.0-error_rate) + error_rate;
+}
+
+double HTTPMirrorSet::Cost(size_t i) const {
+    assert(i < mirrors_.size());
+    lock_guard<mutex> lock(mu_);
+    return Cost(mirrors_[i], chrono::steady_clock::now());
+}
+
+size_t HTTPMirrorSet::Best(const vector<bool>& tried) const {
+    assert(tried.size() == mirrors_.size());
+    auto now = chrono::steady_clock::now();
+    lock_guard<mutex> lock(mu_);
+    size_t best = mirrors_.size();
+    double best_cost = 0;
+    for (size_t i = 0; i < mirrors_.size(); i++) {
+        if (tried[i]) continue;
+        double cost = Cost(mirrors_[i], now);
+        if (best == mirrors_.size() || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    assert(best < mirrors_.size());
+    return best;
+}
+
+string HTTPMirrorSet::Rewrite(const string& url, size_t i) const {
+    assert(i < mirrors_.size());
+    if (i == 0) return url;
+    const Mirror& base = mirrors_[0];
+    const Mirror& m = mirrors_[i];
+    size_t n = base.base_url.size();
+    if (url.compare(0, n, base.base_url) == 0 && (url.size() == n || url[n] == '/')) {
+        return m.base_url + url.substr(n);
+    }
+    n = base.base_dir.size();
+    if (n && url.compare(0, n, base.base_dir) == 0) {
+        return m.base_dir + url.substr(n);
+    }
+    return url;
+}
+
 BaseHTTPEnv::BaseHTTPEnv(const std::string& base_url, const HTTPEnvOptions& opts)
     : base_url_(base_url)
     , connpool_(opts.connpool)
+    , async_client_(opts.async_client)
     , opts_(opts)
     , http_logger_("HTTP", opts_.http_stderr_log_level)
+    , multi_range_unsupported_(false)
+    , mirrors_(base_url, opts.mirror_urls)
+    , idle_workers_(0)
+    , workers_stop_(false)
 {
     inner_env_ = Env::Default();
     size_t sz = base_url_.size();
@@ -77,9 +540,71 @@ BaseHTTPEnv::BaseHTTPEnv(const std::string& base_url, const HTTPEnvOptions& opts
 }
 
 BaseHTTPEnv::~BaseHTTPEnv() {
+    {
+        lock_guard<mutex> lock(workers_mu_);
+        workers_stop_ = true;
+    }
+    workers_cv_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
     if (connpool_ && opts_.connpool == nullptr) {
         delete connpool_;
     }
+    if (async_client_ && opts_.async_client == nullptr) {
+        delete async_client_;
+    }
+}
+
+HTTP::AsyncClient* BaseHTTPEnv::AsyncClient() {
+    std::call_once(async_client_once_, [this]() {
+        if (async_client_ == nullptr) {
+            async_client_ = new HTTP::AsyncClient(64);
+        }
+    });
+    return async_client_;
+}
+
+void BaseHTTPEnv::Schedule(function<void()> job) {
+    lock_guard<mutex> lock(workers_mu_);
+    work_.push_back(move(job));
+    if (idle_workers_ == 0 && workers_.size() < kMaxWorkers) {
+        workers_.emplace_back([this]() { Work(); });
+    } else {
+        workers_cv_.notify_one();
+    }
+}
+
+void BaseHTTPEnv::Work() {
+    unique_lock<mutex> lock(workers_mu_);
+    while (true) {
+        if (!work_.empty()) {
+            function<void()> job = move(work_.front());
+            work_.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        } else if (workers_stop_) {
+            return;
+        } else {
+            idle_workers_++;
+            workers_cv_.wait(lock);
+            idle_workers_--;
+        }
+    }
+}
+
+bool BaseHTTPEnv::NextMirror(HTTPMirrorAttempts& attempts, unsigned int attempt) {
+    bool delay = false;
+    if (attempt == 0) {
+        attempts.tried.assign(mirrors_.size(), false);
+    } else if (!attempts.untried()) {
+        attempts.tried.assign(mirrors_.size(), false);
+        delay = true;
+    }
+    attempts.mirror = mirrors_.Best(attempts.tried);
+    attempts.tried[attempts.mirror] = true;
+    return delay;
 }
 
 Status BaseHTTPEnv::PrepareHead(const std::string& fname,
@@ -145,21 +670,28 @@ public:
     }
 };
 
+// A mirror may lack a file (or deny access to it) which another mirror has,
+// so these errors should fail a request only once every mirror has been tried
+static bool MirrorMayHave(long response_code, const HTTPMirrorAttempts& mirror) {
+    return (response_code == 403 || response_code == 404) && mirror.untried();
+}
+
 Status BaseHTTPEnv::RetryHead(const string& fname, HTTP::headers& response_headers) {
     Status s;
     string url;
     useconds_t delay = opts_.retry_initial_delay;
+    HTTPMirrorAttempts mirror;
 
-    for (unsigned int i = 0; i <= opts_.retry_times; i++) {
-        if (i) {
+    for (unsigned int i = 0; i < MaxAttempts(); i++) {
+        if (NextMirror(mirror, i)) {
             usleep(delay);
             delay *= opts_.retry_backoff_factor;
         }
 
-        string url;
         HTTP::headers request_headers;
         s = PrepareHead(fname, url, request_headers);
         if (!s.ok()) return s;
+        url = mirrors_.Rewrite(url, mirror.mirror);
         Info(&http_logger_, "HEAD %s", CensorURL(url).c_str());
         LogHeaders(request_headers);
         RequestTimer t;
@@ -171,21 +703,60 @@ Status BaseHTTPEnv::RetryHead(const string& fname, HTTP::headers& response_heade
         } else if (response_code >= 500 && response_code <= 599) {
             s = HTTPcodeToStatus(response_code);
         } else if (response_code < 200 || response_code >= 300) {
-            Error(&http_logger_, "HEAD %s => %d (%dms)", CensorURL(url).c_str(), response_code, t.millis());
-            return HTTPcodeToStatus(response_code);
+            s = HTTPcodeToStatus(response_code);
+            if (!MirrorMayHave(response_code, mirror)) {
+                mirrors_.Observe(mirror.mirror, false, t.millis()/1000.0);
+                Error(&http_logger_, "HEAD %s => %d (%dms)", CensorURL(url).c_str(), response_code, t.millis());
+                return s;
+            }
         } else {
             Info(&http_logger_, "HEAD %s => %d (%dms)", CensorURL(url).c_str(), response_code, t.millis());
             LogHeaders(response_headers);
+            mirrors_.Observe(mirror.mirror, true, t.millis()/1000.0);
             return Status::OK();
         }
 
-        Warn(&http_logger_, "HEAD %s failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), t.millis(), i+1, opts_.retry_times+1, s.ToString().c_str());
+        mirrors_.Observe(mirror.mirror, false, t.millis()/1000.0);
+        Warn(&http_logger_, "HEAD %s failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), t.millis(), i+1, MaxAttempts(), s.ToString().c_str());
     }
 
     Error(&http_logger_, "HEAD %s failed...%s", CensorURL(url).c_str(), s.ToString().c_str());
     return s;
 }
 
+Status BaseHTTPEnv::CheckGetResponse(const string& url, const HTTPMirrorAttempts& mirror, uint64_t offset, size_t n, CURLcode c,
+                                     long response_code, const HTTP::headers& response_headers,
+                                     size_t response_size, unsigned int millis, bool& retryable) {
+    retryable = true;
+    if (c != CURLE_OK) {
+        mirrors_.Observe(mirror.mirror, false, millis/1000.0);
+        return CURLcodeToStatus(c);
+    } else if (response_code >= 500 && response_code <= 599) {
+        mirrors_.Observe(mirror.mirror, false, millis/1000.0);
+        return HTTPcodeToStatus(response_code);
+    } else if (response_code < 200 || response_code >= 300) {
+        mirrors_.Observe(mirror.mirror, false, millis/1000.0);
+        retryable = MirrorMayHave(response_code, mirror);
+        if (!retryable) {
+            Error(&http_logger_, "GET %s [%d-%d] => %d (%dms)",  CensorURL(url).c_str(), offset, offset+n, response_code, millis);
+        }
+        return HTTPcodeToStatus(response_code);
+    }
+
+    auto it = response_headers.find("content-length");
+    if (it == response_headers.end()
+          || strtoull(it->second.c_str(), nullptr, 10) == response_size) {
+        Info(&http_logger_, "GET %s [%d-%d] => %d (%dms, %zu bytes)",  CensorURL(url).c_str(), offset, offset+n, response_code, millis, response_size);
+        LogHeaders(response_headers);
+        fetch_model_.Observe(response_size, millis/1000.0);
+        mirrors_.Observe(mirror.mirror, true, millis/1000.0);
+        return Status::OK();
+    }
+    mirrors_.Observe(mirror.mirror, false, millis/1000.0);
+    Debug(&http_logger_, "GET %s [%d-%d] => %d (%dms) with unexpected HTTP response body length %zu, response headers content-length %s", CensorURL(url).c_str(), offset, offset+n, response_code, millis, response_size, it != response_headers.end() ? it->second.c_str() : "(none)");
+    return Status::IOError("Unexpected HTTP response body length");
+}
+
 Status BaseHTTPEnv::RetryGet(const string& fname, uint64_t offset, size_t n,
                              HTTP::headers& response_headers, Slice* response_body, char* scratch) {
     assert(response_body);
@@ -193,9 +764,10 @@ Status BaseHTTPEnv::RetryGet(const string& fname, uint64_t offset, size_t n,
     Status s;
     string url;
     useconds_t delay = opts_.retry_initial_delay;
+    HTTPMirrorAttempts mirror;
 
-    for (unsigned int i = 0; i <= opts_.retry_times; i++) {
-        if (i) {
+    for (unsigned int i = 0; i < MaxAttempts(); i++) {
+        if (NextMirror(mirror, i)) {
             usleep(delay);
             delay *= opts_.retry_backoff_factor;
         }
@@ -203,44 +775,602 @@ Status BaseHTTPEnv::RetryGet(const string& fname, uint64_t offset, size_t n,
         HTTP::headers request_headers;
         s = PrepareGet(fname, offset, n, url, request_headers);
         if (!s.ok()) return s;
+        url = mirrors_.Rewrite(url, mirror.mirror);
         Info(&http_logger_, "GET %s [%d-%d]", CensorURL(url).c_str(), offset, offset+n);
         LogHeaders(request_headers);
         RequestTimer t;
 
         long response_code = -1;
-        stringstream response_body_stream;
+        size_t response_size = 0;
         response_headers.clear();
         CURLcode c = HTTP::GET(url, request_headers,
-                               response_code, response_headers, response_body_stream,
+                               response_code, response_headers, scratch, n, response_size,
                                connpool_);
-        if (c != CURLE_OK) {
-            s = CURLcodeToStatus(c);
-        } else if (response_code >= 500 && response_code <= 599) {
-            s = HTTPcodeToStatus(response_code);
-        } else if (response_code < 200 || response_code >= 300) {
-            Error(&http_logger_, "GET %s [%d-%d] => %d (%dms)",  CensorURL(url).c_str(), offset, offset+n, response_code, t.millis());
-            return HTTPcodeToStatus(response_code);
+        bool retryable = false;
+        s = CheckGetResponse(url, mirror, offset, n, c, response_code, response_headers, response_size, t.millis(), retryable);
+        if (s.ok()) {
+            *response_body = Slice(scratch, response_size);
+            return s;
+        }
+        if (!retryable) return s;
+
+        Warn(&http_logger_, "GET %s [%d-%d] failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), offset, offset+n, t.millis(), i+1, MaxAttempts(), s.ToString().c_str());
+    }
+
+    Error(&http_logger_, "GET %s [%d-%d] failed...%s", CensorURL(url).c_str(), offset, offset+n, s.ToString().c_str());
+    return s;
+}
+
+Status BaseHTTPEnv::RetryGetSuffix(const string& fname, size_t n, Slice* response_body,
+                                   char* scratch, uint64_t& file_size) {
+    assert(response_body);
+    assert(scratch);
+    Status s;
+    string url;
+    useconds_t delay = opts_.retry_initial_delay;
+    HTTPMirrorAttempts mirror;
+
+    for (unsigned int i = 0; i < MaxAttempts(); i++) {
+        if (NextMirror(mirror, i)) {
+            usleep(delay);
+            delay *= opts_.retry_backoff_factor;
+        }
+
+        HTTP::headers request_headers;
+        s = PrepareGet(fname, 0, n, url, request_headers);
+        if (!s.ok()) return s;
+        url = mirrors_.Rewrite(url, mirror.mirror);
+        auto range = request_headers.find("range");
+        if (range == request_headers.end()) break;
+        range->second = "bytes=-" + to_string(n);
+        Info(&http_logger_, "GET %s [-%zu]", CensorURL(url).c_str(), n);
+        LogHeaders(request_headers);
+        RequestTimer t;
+
+        long response_code = -1;
+        size_t response_size = 0;
+        HTTP::headers response_headers;
+        CURLcode c = HTTP::GET(url, request_headers,
+                               response_code, response_headers, scratch, n, response_size,
+                               connpool_);
+        if (c == CURLE_WRITE_ERROR) {
+            // the server must have sent the whole file (whatever became of
+            // any earlier attempts)
+            s = Status::OK();
+            break;
+        }
+        bool retryable = false;
+        s = CheckGetResponse(url, mirror, 0, n, c, response_code, response_headers, response_size, t.millis(), retryable);
+        if (s.ok()) {
+            if (response_code == 200) {
+                // the whole file, which is smaller than n
+                file_size = response_size;
+                *response_body = Slice(scratch, response_size);
+                return s;
+            }
+            auto content_range = response_headers.find("content-range");
+            uint64_t first = 0, last = 0, total = 0;
+            if (content_range != response_headers.end()
+                && HTTP::ParseContentRange(content_range->second, first, last, total)
+                && total != UINT64_MAX && last+1 == total && last-first+1 == response_size) {
+                file_size = total;
+                *response_body = Slice(scratch, response_size);
+                return s;
+            }
+            break;
+        }
+        if (!retryable) return s;
+
+        Warn(&http_logger_, "GET %s [-%zu] failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), n, t.millis(), i+1, MaxAttempts(), s.ToString().c_str());
+    }
+    if (!s.ok()) {
+        Error(&http_logger_, "GET %s [-%zu] failed...%s", CensorURL(url).c_str(), n, s.ToString().c_str());
+        return s;
+    }
+
+    // suffix range unsupported: HEAD the file to determine its size, then GET
+    // the tail
+    Info(&http_logger_, "GET %s [-%zu] unsupported by server; falling back to HEAD", CensorURL(url).c_str(), n);
+    HTTP::headers headers;
+    s = RetryHead(fname, headers);
+    if (!s.ok()) return s;
+    auto it = headers.find("content-length");
+    if (it == headers.end()) return Status::IOError("HTTP HEAD response didn't include Content-Length header");
+    file_size = strtoull(it->second.c_str(), nullptr, 10);
+    if (file_size == 0) {
+        *response_body = Slice();
+        return Status::OK();
+    }
+    return RetryGet(fname, (file_size>=n ? file_size-n : 0), min(uint64_t(n),file_size), headers, response_body, scratch);
+}
+
+Status BaseHTTPEnv::GetValidator(const string& fname, string& validator) {
+    {
+        lock_guard<mutex> lock(validators_mu_);
+        auto it = validators_.find(fname);
+        if (it != validators_.end()) {
+            validator = it->second;
+            return Status::OK();
+        }
+    }
+
+    HTTP::headers response_headers;
+    Status s = RetryHead(fname, response_headers);
+    if (!s.ok()) return s;
+    auto etag = response_headers.find("etag");
+    auto content_length = response_headers.find("content-length");
+    if (etag == response_headers.end() || content_length == response_headers.end()) {
+        return Status::NotSupported("HTTP HEAD response lacks ETag or Content-Length header");
+    }
+    validator = etag->second + "/" + content_length->second;
+
+    lock_guard<mutex> lock(validators_mu_);
+    validators_[fname] = validator;
+    return Status::OK();
+}
+
+Status BaseHTTPEnv::ReadRange(const string& fname, uint64_t file_size, uint64_t offset, size_t n,
+                              Slice* result, char* scratch) {
+    assert(result);
+    assert(scratch);
+    assert(offset+n <= file_size);
+    HTTP::headers response_headers;
+    HTTPRangeCache *cache = opts_.range_cache;
+    HTTPDiskCache *disk_cache = opts_.disk_cache;
+    if ((cache == nullptr && disk_cache == nullptr) || n == 0) {
+        return SharedGet(fname, offset, n, result, scratch);
+    }
+    // the disk cache is consulted only for objects whose validator we know
+    string validator;
+    if (disk_cache && !GetValidator(fname, validator).ok()) {
+        disk_cache = nullptr;
+    }
+    string key_url, key_name;
+    CacheKey(fname, key_url, key_name);
+
+    // look up each page overlapping the requested range, in memory and then
+    // on disk
+    const uint64_t page_size = cache ? cache->page_size() : disk_cache->page_size();
+    assert(!cache || !opts_.disk_cache || opts_.disk_cache->page_size() == page_size);
+    const uint64_t first_page = offset/page_size, last_page = (offset+n-1)/page_size;
+    vector<shared_ptr<const string>> pages(last_page-first_page+1);
+    uint64_t first_miss = UINT64_MAX, last_miss = 0;
+    for (uint64_t p = first_page; p <= last_page; p++) {
+        auto& page = pages[p-first_page];
+        if (cache && cache->Lookup(key_url, key_name, p, page)) continue;
+        string disk_page;
+        if (disk_cache && disk_cache->Lookup(key_url, key_name, p, validator, disk_page)) {
+            page = make_shared<const string>(move(disk_page));
+            if (cache) cache->Insert(key_url, key_name, p, page);
+            continue;
+        }
+        first_miss = min(first_miss, p);
+        last_miss = p;
+    }
+
+    if (first_miss != UINT64_MAX) {
+        // fetch the page-aligned range spanning the missing pages, widened to
+        // the aligned fetch unit (the surplus pages go into the memory cache)
+        uint64_t fetch_first = first_miss, fetch_last = last_miss;
+        if (cache && opts_.fetch_unit_max > page_size) {
+            uint64_t unit_pages = fetch_model_.FetchUnit(page_size, opts_.fetch_unit_max)/page_size;
+            if (unit_pages > 1) {
+                fetch_first = first_miss - first_miss%unit_pages;
+                fetch_last = min(last_miss - last_miss%unit_pages + unit_pages, (file_size+page_size-1)/page_size) - 1;
+            }
+        }
+        uint64_t fetch_offset = fetch_first*page_size;
+        size_t fetch_n = min((fetch_last+1)*page_size, file_size) - fetch_offset;
+        unique_ptr<char[]> buf(new char[fetch_n]);
+        Slice data;
+        string etag;
+        Status s = SharedGet(fname, fetch_offset, fetch_n, &data, buf.get(), &etag);
+        if (!s.ok()) return s;
+        if (data.size() != fetch_n) return Status::IOError("Unexpected HTTP response body length");
+
+        // don't persist the pages if the object has changed since we learned
+        // its validator
+        if (disk_cache && etag.size() && validator.compare(0, etag.size()+1, etag + "/") != 0) {
+            disk_cache = nullptr;
+        }
+
+        for (uint64_t p = fetch_first; p <= fetch_last; p++) {
+            uint64_t p_offset = p*page_size - fetch_offset;
+            size_t p_size = min(page_size, fetch_n-p_offset);
+            auto page = make_shared<const string>(data.data()+p_offset, p_size);
+            if (cache) cache->Insert(key_url, key_name, p, page);
+            if (p < first_miss || p > last_miss) continue;
+            if (disk_cache) disk_cache->Insert(key_url, key_name, p, validator, page->data(), p_size);
+            pages[p-first_page] = move(page);
+        }
+    }
+
+    // assemble the requested range from the pages
+    size_t copied = 0;
+    for (uint64_t p = first_page; p <= last_page; p++) {
+        const string& page = *pages[p-first_page];
+        uint64_t page_offset = p*page_size;
+        uint64_t lo = max(offset, page_offset), hi = min(offset+n, page_offset+page.size());
+        if (hi <= lo) break;
+        memcpy(scratch+copied, page.data()+(lo-page_offset), hi-lo);
+        copied += hi-lo;
+    }
+    if (copied != n) return Status::IOError("BaseHTTPEnv::ReadRange: short read");
+    *result = Slice(scratch, n);
+    return Status::OK();
+}
+
+Status BaseHTTPEnv::SharedGet(const string& fname, uint64_t offset, size_t n,
+                              Slice* result, char* scratch, string* etag) {
+    assert(result);
+    assert(scratch);
+    if (etag) etag->clear();
+    unique_lock<mutex> lock(flights_mu_);
+
+    // find the flight with the greatest overlap
+    shared_ptr<Flight> other;
+    uint64_t overlap_lo = 0, overlap_hi = 0;
+    auto range = flights_.equal_range(fname);
+    for (auto it = range.first; it != range.second; it++) {
+        const Flight& f = *it->second;
+        uint64_t lo = max(offset, f.offset), hi = min(offset+n, f.offset+f.n);
+        if (hi > lo && hi-lo > overlap_hi-overlap_lo) {
+            other = it->second;
+            overlap_lo = lo;
+            overlap_hi = hi;
+        }
+    }
+    // it's only useful if it covers one end of our range (or all of it)
+    if (other && overlap_lo != offset && overlap_hi != offset+n) {
+        other.reset();
+    }
+    // register as a waiter right away, so that its buffer remains valid
+    // while we fetch the rest
+    if (other) {
+        other->waiters++;
+    }
+
+    // fetch whatever the other flight doesn't cover ourselves, as a flight
+    // others can join in turn
+    Status s;
+    if (!other || overlap_hi-overlap_lo < n) {
+        uint64_t lo = offset, hi = offset+n;
+        if (other) {
+            if (overlap_lo == offset) lo = overlap_hi;
+            else hi = overlap_lo;
+        }
+        auto f = make_shared<Flight>();
+        f->offset = lo;
+        f->n = hi-lo;
+        f->buf = scratch + (lo-offset);
+        auto it = flights_.emplace(fname, f);
+        lock.unlock();
+
+        HTTP::headers response_headers;
+        Slice data;
+        s = RetryGet(fname, f->offset, f->n, response_headers, &data, f->buf);
+        if (s.ok() && data.size() != f->n) {
+            s = Status::IOError("Unexpected HTTP response body length");
+        }
+        auto etag_it = response_headers.find("etag");
+        if (etag_it != response_headers.end()) {
+            f->etag = etag_it->second;
+            if (etag) *etag = f->etag;
+        }
+
+        lock.lock();
+        flights_.erase(it);
+        f->status = s;
+        f->done = true;
+        f->cv.notify_all();
+        f->cv.wait(lock, [&f]() { return f->blocked == 0; });
+        if (f->waiters && s.ok()) {
+            f->own_buf.reset(new char[f->n]);
+            memcpy(f->own_buf.get(), f->buf, f->n);
+            f->buf = f->own_buf.get();
+        }
+    }
+
+    // copy from the other flight
+    if (other) {
+        other->blocked++;
+        other->cv.wait(lock, [&other]() { return other->done; });
+        if (s.ok()) s = other->status;
+        if (etag && etag->empty()) *etag = other->etag;
+        if (s.ok()) {
+            const char *src = other->buf + (overlap_lo-other->offset);
+            lock.unlock();
+            memcpy(scratch + (overlap_lo-offset), src, overlap_hi-overlap_lo);
+            lock.lock();
+        }
+        other->waiters--;
+        other->blocked--;
+        other->cv.notify_all();
+    }
+
+    if (!s.ok()) return s;
+    *result = Slice(scratch, n);
+    return Status::OK();
+}
+
+Status BaseHTTPEnv::RetryGetMany(const string& fname, vector<HTTPReadRequest>& reqs) {
+    // one attempt at one of the requests, in flight on the async client
+    struct Attempt {
+        HTTPReadRequest *req;
+        string url;
+        long response_code = -1;
+        HTTP::headers response_headers;
+        size_t response_size = 0;
+        future<CURLcode> result;
+    };
+
+    HTTP::AsyncClient *client = AsyncClient();
+    vector<HTTPReadRequest*> pending;
+    for (auto& req : reqs) {
+        assert(req.scratch || !req.n);
+        req.result = Slice();
+        req.status = Status::OK();
+        if (req.n) pending.push_back(&req);
+    }
+
+    useconds_t delay = opts_.retry_initial_delay;
+    HTTPMirrorAttempts mirror;
+    for (unsigned int i = 0; i < MaxAttempts() && pending.size(); i++) {
+        if (NextMirror(mirror, i)) {
+            usleep(delay);
+            delay *= opts_.retry_backoff_factor;
+        }
+
+        // submit all pending requests at once, to the same mirror
+        vector<unique_ptr<Attempt>> attempts;
+        RequestTimer t;
+        for (auto req : pending) {
+            unique_ptr<Attempt> a(new Attempt);
+            a->req = req;
+            HTTP::headers request_headers;
+            req->status = PrepareGet(fname, req->offset, req->n, a->url, request_headers);
+            if (!req->status.ok()) continue;
+            a->url = mirrors_.Rewrite(a->url, mirror.mirror);
+            Info(&http_logger_, "GET %s [%d-%d]", CensorURL(a->url).c_str(), req->offset, req->offset+req->n);
+            LogHeaders(request_headers);
+            a->result = client->GET(a->url, request_headers, a->response_code, a->response_headers,
+                                    req->scratch, req->n, a->response_size);
+            attempts.push_back(move(a));
+        }
+        pending.clear();
+
+        // collect the responses, noting those to be retried
+        for (auto& a : attempts) {
+            HTTPReadRequest *req = a->req;
+            CURLcode c = a->result.get();
+            bool retryable = false;
+            req->status = CheckGetResponse(a->url, mirror, req->offset, req->n, c, a->response_code, a->response_headers,
+                                           a->response_size, t.millis(), retryable);
+            if (req->status.ok()) {
+                req->result = Slice(req->scratch, a->response_size);
+            } else if (retryable) {
+                Warn(&http_logger_, "GET %s [%d-%d] failed (%dms, try %d of %d)...%s", CensorURL(a->url).c_str(), req->offset, req->offset+req->n, t.millis(), i+1, MaxAttempts(), req->status.ToString().c_str());
+                pending.push_back(req);
+            }
+        }
+    }
+
+    for (auto req : pending) {
+        Error(&http_logger_, "GET %s [%d-%d] failed...%s", fname.c_str(), req->offset, req->offset+req->n, req->status.ToString().c_str());
+    }
+    for (auto& req : reqs) {
+        if (!req.status.ok()) return req.status;
+    }
+    return Status::OK();
+}
+
+Status BaseHTTPEnv::RetryGetRanges(const string& fname, vector<HTTPReadRequest>& reqs) {
+    if (reqs.size() < 2 || multi_range_unsupported_) {
+        return RetryGetMany(fname, reqs);
+    }
+
+    // formulate the request, combining the ranges specs PrepareGet produces
+    // for each request; remember the resulting offsets within the resource
+    string url, spec;
+    HTTP::headers request_headers;
+    vector<uint64_t> offsets;
+    size_t total = 0;
+    for (auto& req : reqs) {
+        assert(req.n && req.scratch);
+        req.result = Slice();
+        req.status = Status::OK();
+        HTTP::headers req_headers;
+        Status s = PrepareGet(fname, req.offset, req.n, url, req_headers);
+        if (!s.ok()) return s;
+        auto range = req_headers.find("range");
+        uint64_t first = 0, last = 0;
+        if (range == req_headers.end() || range->second.compare(0, 6, "bytes=") != 0
+            || sscanf(range->second.c_str()+6, "%" SCNu64 "-%" SCNu64, &first, &last) != 2
+            || last-first+1 != req.n) {
+            return Status::NotSupported("BaseHTTPEnv::RetryGetRanges: unexpected range header from PrepareGet");
+        }
+        if (spec.size()) spec += ",";
+        spec += range->second.substr(6);
+        offsets.push_back(first);
+        total += req.n;
+        req_headers.erase(range);
+        request_headers = req_headers;
+    }
+    request_headers["range"] = "bytes=" + spec;
+
+    // room for the part headers of a multipart/byteranges response
+    size_t capacity = total + 512*reqs.size() + 1024;
+    unique_ptr<char[]> buf(new char[capacity]);
+
+    Status s;
+    useconds_t delay = opts_.retry_initial_delay;
+    HTTPMirrorAttempts mirror;
+    const string base_url = url;
+    for (unsigned int i = 0; i < MaxAttempts(); i++) {
+        if (NextMirror(mirror, i)) {
+            usleep(delay);
+            delay *= opts_.retry_backoff_factor;
+        }
+
+        url = mirrors_.Rewrite(base_url, mirror.mirror);
+        Info(&http_logger_, "GET %s [%zu ranges, %zu bytes]", CensorURL(url).c_str(), reqs.size(), total);
+        LogHeaders(request_headers);
+        RequestTimer t;
+
+        long response_code = -1;
+        size_t response_size = 0;
+        HTTP::headers response_headers;
+        CURLcode c = HTTP::GET(url, request_headers,
+                               response_code, response_headers, buf.get(), capacity, response_size,
+                               connpool_);
+        if (c == CURLE_WRITE_ERROR) {
+            // the response body overflowed the buffer, so the server must
+            // have sent the whole resource (no content-range) or coalesced
+            // the ranges; fall back
+            bool whole = response_headers.find("content-range") == response_headers.end();
+            Warn(&http_logger_, "GET %s [%zu ranges] => oversized response (%dms); falling back to separate requests", CensorURL(url).c_str(), reqs.size(), t.millis());
+            if (whole) multi_range_unsupported_ = true;
+            return RetryGetMany(fname, reqs);
+        }
+        bool retryable = false;
+        s = CheckGetResponse(url, mirror, offsets[0], total, c, response_code, response_headers,
+                             response_size, t.millis(), retryable);
+        if (!s.ok()) {
+            if (!retryable) return s;
+            Warn(&http_logger_, "GET %s [%zu ranges] failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), reqs.size(), t.millis(), i+1, MaxAttempts(), s.ToString().c_str());
+            continue;
+        }
+
+        // identify the parts of the resource in the response body
+        vector<HTTP::ByteRange> parts;
+        if (response_code == 200) {
+            parts.push_back({0, response_size, buf.get()});
         } else {
-            response_body_stream.read(scratch, n);
-            if (response_body_stream.good() || response_body_stream.eof()) {
-                size_t c = response_body_stream.gcount();
-                auto it = response_headers.find("content-length");
-                if (it == response_headers.end()
-                      || strtoull(it->second.c_str(), nullptr, 10) == c) {
-                    *response_body = Slice(scratch, c);
-                    Info(&http_logger_, "GET %s [%d-%d] => %d (%dms, %zu bytes)",  CensorURL(url).c_str(), offset, offset+n, response_code, t.millis(), c);
-                    LogHeaders(response_headers);
-                    return Status::OK();
+            auto content_type = response_headers.find("content-type");
+            if (content_type == response_headers.end()
+                || !HTTP::ParseMultipartByteranges(content_type->second, buf.get(), response_size, parts)) {
+                // single range, which the server may have coalesced from ours
+                uint64_t first = 0, last = 0, resource_size = 0;
+                auto content_range = response_headers.find("content-range");
+                parts.clear();
+                if (content_range != response_headers.end()
+                    && HTTP::ParseContentRange(content_range->second, first, last, resource_size)
+                    && last-first+1 == response_size) {
+                    parts.push_back({first, response_size, buf.get()});
                 }
-                Debug(&http_logger_, "GET %s [%d-%d] => %d (%dms) with unexpected HTTP response body length %zu, response headers content-length %s", CensorURL(url).c_str(), offset, offset+n, response_code, t.millis(), c, it != response_headers.end() ? it->second.c_str() : "(none)");
             }
-            s = Status::IOError("Unexpected HTTP response body length");
         }
 
-        Warn(&http_logger_, "GET %s [%d-%d] failed (%dms, try %d of %d)...%s", CensorURL(url).c_str(), offset, offset+n, t.millis(), i+1, opts_.retry_times+1, s.ToString().c_str());
+        // copy each requested range out of the part containing it
+        vector<HTTPReadRequest> missing;
+        vector<size_t> missing_idx;
+        for (size_t j = 0; j < reqs.size(); j++) {
+            auto& req = reqs[j];
+            bool found = false;
+            for (const auto& part : parts) {
+                if (part.offset <= offsets[j] && offsets[j]+req.n <= part.offset+part.size) {
+                    memcpy(req.scratch, part.data+(offsets[j]-part.offset), req.n);
+                    req.result = Slice(req.scratch, req.n);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                missing.push_back(req);
+                missing_idx.push_back(j);
+            }
+        }
+        if (missing.empty()) return Status::OK();
+
+        // the server didn't honor the multi-range request; fall back
+        Warn(&http_logger_, "GET %s [%zu ranges] => %d didn't provide %zu of the ranges; falling back to separate requests",
+             CensorURL(url).c_str(), reqs.size(), response_code, missing.size());
+        if (response_code == 200) multi_range_unsupported_ = true;
+        s = RetryGetMany(fname, missing);
+        for (size_t j = 0; j < missing.size(); j++) {
+            reqs[missing_idx[j]].result = missing[j].result;
+            reqs[missing_idx[j]].status = missing[j].status;
+        }
+        return s;
+    }
+
+    Error(&http_logger_, "GET %s [%zu ranges] failed...%s", CensorURL(url).c_str(), reqs.size(), s.ToString().c_str());
+    for (auto& req : reqs) {
+        req.status = s;
     }
+    return s;
+}
 
-    Error(&http_logger_, "GET %s [%d-%d] failed...%s", CensorURL(url).c_str(), offset, offset+n, s.ToString().c_str());
+Status BaseHTTPEnv::StartGet(const string& fname, uint64_t file_size, uint64_t offset, size_t n,
+                             HTTPAsyncGet& g) {
+    if (!g.buf || g.n < n) {
+        g.buf.reset(new char[n]);
+    }
+    g.offset = offset;
+    g.n = n;
+
+    if (opts_.range_cache || opts_.disk_cache) {
+        // go through the caches, sharing their pages with other reads (and
+        // having any missing ones fetched page-aligned and inserted), by way
+        // of ReadRange on a worker thread
+        g.response_size = 0;
+        auto done = make_shared<promise<Status>>();
+        g.read_range = done->get_future();
+        Schedule([this, fname, file_size, &g, done]() {
+            Slice data;
+            Status s = ReadRange(fname, file_size, g.offset, g.n, &data, g.buf.get());
+            if (s.ok()) {
+                if (data.data() != g.buf.get()) {
+                    memmove(g.buf.get(), data.data(), data.size());
+                }
+                g.response_size = data.size();
+            }
+            done->set_value(s);
+        });
+        return Status::OK();
+    }
+
+    HTTP::headers request_headers;
+    Status s = PrepareGet(fname, offset, n, g.url, request_headers);
+    if (!s.ok()) return s;
+    NextMirror(g.mirror, 0);
+    g.url = mirrors_.Rewrite(g.url, g.mirror.mirror);
+    Info(&http_logger_, "GET %s [%d-%d] (async)", CensorURL(g.url).c_str(), offset, offset+n);
+    LogHeaders(request_headers);
+    g.start_micros = NowMicros();
+    g.result = AsyncClient()->GET(g.url, request_headers, g.response_code, g.response_headers,
+                                  g.buf.get(), n, g.response_size);
+    return Status::OK();
+}
+
+Status BaseHTTPEnv::FinishGet(HTTPAsyncGet& g, Slice* response_body) {
+    assert(response_body);
+    if (g.read_range.valid()) {
+        Status s = g.read_range.get();
+        if (s.ok()) {
+            *response_body = Slice(g.buf.get(), g.response_size);
+        }
+        return s;
+    }
+    assert(g.result.valid());
+    CURLcode c = g.result.get();
+    bool retryable = false;
+    Status s = CheckGetResponse(g.url, g.mirror, g.offset, g.n, c, g.response_code, g.response_headers, g.response_size,
+                                (unsigned int)((NowMicros() - g.start_micros)/1000), retryable);
+    if (s.ok()) {
+        *response_body = Slice(g.buf.get(), g.response_size);
+    } else {
+        Warn(&http_logger_, "GET %s [%d-%d] (async) failed...%s", CensorURL(g.url).c_str(), g.offset, g.offset+g.n, s.ToString().c_str());
+    }
+    return s;
+}
+
+Status BaseHTTPEnv::ResolveFile(const string& fname, string& object, uint64_t& object_size,
+                                uint64_t& base_offset, uint64_t& size) {
+    object = fname;
+    base_offset = 0;
+    Status s = GetFileSize(fname, &size);
+    object_size = size;
     return s;
 }
 
@@ -275,19 +1405,21 @@ Status BaseHTTPEnv::GetFileSize(const std::string& fname, uint64_t *file_size) {
 
 Status BaseHTTPEnv::NewSequentialFile(const std::string& fname, unique_ptr<SequentialFile>* result,
                                       const EnvOptions& options) {
-    uint64_t sz;
-    Status s = GetFileSize(fname, &sz); // TODO cache this info
+    string object;
+    uint64_t object_size, base, sz;
+    Status s = ResolveFile(fname, object, object_size, base, sz);
     if (!s.ok()) return s;
-    result->reset(new BaseHTTPSequentialFile(this, fname, sz));
+    result->reset(new BaseHTTPSequentialFile(this, object, object_size, base, sz));
     return Status::OK();
 }
 
 Status BaseHTTPEnv::NewRandomAccessFile(const std::string& fname, unique_ptr<RandomAccessFile>* result,
                                         const EnvOptions& options) {
-    uint64_t sz;
-    Status s = GetFileSize(fname, &sz); // TODO cache this info
+    string object;
+    uint64_t object_size, base, sz;
+    Status s = ResolveFile(fname, object, object_size, base, sz);
     if (!s.ok()) return s;
-    result->reset(new BaseHTTPRandomAccessFile(this, fname, sz));
+    result->reset(new BaseHTTPRandomAccessFile(this, object, object_size, base, sz));
     return Status::OK();
 }
 
@@ -0,0 +1,284 @@
+#include "RocksWorm/BulkLoader.h"
+#include <algorithm>
+#include <fstream>
+#include <queue>
+#include <string.h>
+#include <unistd.h>
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/sst_file_writer.h"
+using namespace std;
+using namespace rocksdb;
+
+BlockBasedTableOptions HTTPTableOptions(bool partitioned) {
+    BlockBasedTableOptions bbto;
+    bbto.block_size = 256 * 1024;
+    bbto.filter_policy.reset(NewBloomFilterPolicy(10, false));
+    if (partitioned) {
+        bbto.index_type = BlockBasedTableOptions::kTwoLevelIndexSearch;
+        bbto.partition_filters = true;
+        bbto.metadata_block_size = bbto.block_size;
+    }
+    return bbto;
+}
+
+// Key/value pairs, each stored as the key and value lengths (32-bit, native
+// byte order) followed by the key and value; the same records make up the
+// run files
+struct BulkLoader::Batch {
+    string data;
+    vector<size_t> offsets;     // of each record, in order
+
+    void Add(const Slice& key, const Slice& value) {
+        offsets.push_back(data.size());
+        uint32_t n[2] = {uint32_t(key.size()), uint32_t(value.size())};
+        data.append((const char*) n, sizeof(n));
+        data.append(key.data(), key.size());
+        data.append(value.data(), value.size());
+    }
+    Slice KeyAt(size_t offset) const {
+        uint32_t n;
+        memcpy(&n, &data[offset], sizeof(n));
+        return Slice(&data[offset+8], n);
+    }
+    Slice key(size_t i) const { return KeyAt(offsets[i]); }
+    Slice value(size_t i) const {
+        uint32_t n[2];
+        memcpy(n, &data[offsets[i]], sizeof(n));
+        return Slice(&data[offsets[i]+8+n[0]], n[1]);
+    }
+    size_t RecordSize(size_t i) const {
+        uint32_t n[2];
+        memcpy(n, &data[offsets[i]], sizeof(n));
+        return 8+n[0]+n[1];
+    }
+
+    // Sort the records by key, keeping only the last one added for each key
+    void Sort() {
+        stable_sort(offsets.begin(), offsets.end(), [this](size_t a, size_t b) {
+            return KeyAt(a).compare(KeyAt(b)) < 0;
+        });
+        size_t n = 0;
+        for (size_t i = 0; i < offsets.size(); i++) {
+            if (i+1 < offsets.size() && KeyAt(offsets[i]) == KeyAt(offsets[i+1])) continue;
+            offsets[n++] = offsets[i];
+        }
+        offsets.resize(n);
+    }
+};
+
+// Reads the records of a run file in turn
+class RunReader {
+    ifstream f_;
+    unique_ptr<char[]> buf_;
+
+public:
+    string key, value;
+    bool valid = false;
+
+    Status Open(const string& path) {
+        const size_t bufsize = 1048576;
+        buf_.reset(new char[bufsize]);
+        f_.rdbuf()->pubsetbuf(buf_.get(), bufsize);
+        f_.open(path, ios::binary);
+        if (!f_.is_open()) return Status::IOError("BulkLoader: couldn't open run", path);
+        return Next();
+    }
+
+    Status Next() {
+        uint32_t n[2];
+        valid = false;
+        if (!f_.read((char*) n, sizeof(n))) {
+            return f_.gcount() == 0 && f_.eof() ? Status::OK() : Status::Corruption("BulkLoader: truncated run");
+        }
+        key.resize(n[0]);
+        value.resize(n[1]);
+        if (!f_.read(&key[0], n[0]) || !f_.read(&value[0], n[1])) {
+            return Status::Corruption("BulkLoader: truncated run");
+        }
+        valid = true;
+        return Status::OK();
+    }
+};
+
+BulkLoader::BulkLoader(const string& dbpath, const BulkLoaderOptions& opts)
+    : dbpath_(dbpath)
+    , scratch_dir_(opts.scratch_dir.empty() ? dbpath + ".bulkload" : opts.scratch_dir)
+    , scratch_created_(false)
+    , opts_(opts)
+    , batch_(new Batch())
+    , any_(false)
+    , entries_(0)
+{
+    opts_.threads = max(opts_.threads, 1U);
+}
+
+BulkLoader::~BulkLoader() {
+    WaitForBatches(0);
+    RemoveScratch();
+}
+
+Status BulkLoader::Add(const Slice& key, const Slice& value) {
+    if (!status_.ok()) return status_;
+    if (key.size() > 0xffffffffULL || value.size() > 0xffffffffULL) {
+        return Status::InvalidArgument("BulkLoader: key or value too large");
+    }
+    if (opts_.sorted) return AddSorted(key, value);
+    batch_->Add(key, value);
+    return batch_->data.size() >= opts_.sort_buffer_size ? Submit(true) : Status::OK();
+}
+
+Status BulkLoader::AddSorted(const Slice& key, const Slice& value) {
+    if (any_ && key.compare(last_key_) <= 0) {
+        status_ = Status::InvalidArgument("BulkLoader: keys not in strictly increasing order", key.ToString(true));
+        return status_;
+    }
+    last_key_.assign(key.data(), key.size());
+    any_ = true;
+    batch_->Add(key, value);
+    entries_++;
+    return batch_->data.size() >= opts_.target_file_size ? Submit(false) : Status::OK();
+}
+
+Status BulkLoader::WaitForBatches(size_t max_in_flight) {
+    while (in_flight_.size() > max_in_flight) {
+        Status s = in_flight_.front().get();
+        in_flight_.pop_front();
+        if (!s.ok() && status_.ok()) status_ = s;
+    }
+    return status_;
+}
+
+Status BulkLoader::Submit(bool run) {
+    Status s = WaitForBatches(opts_.threads-1);
+    if (!s.ok() || batch_->offsets.empty()) return s;
+    if (!scratch_created_) {
+        s = Env::Default()->CreateDirIfMissing(scratch_dir_);
+        if (!s.ok()) return status_ = s;
+        scratch_created_ = true;
+    }
+    if (run) {
+        runs_.push_back(scratch_dir_ + "/run-" + to_string(runs_.size()));
+        in_flight_.push_back(async(launch::async, &BulkLoader::WriteRun, this, move(batch_), runs_.back()));
+    } else {
+        ssts_.push_back(scratch_dir_ + "/" + to_string(ssts_.size()) + ".sst");
+        in_flight_.push_back(async(launch::async, &BulkLoader::WriteSST, this, move(batch_), ssts_.back()));
+    }
+    batch_.reset(new Batch());
+    return Status::OK();
+}
+
+Status BulkLoader::WriteSST(unique_ptr<Batch> batch, const string& path) {
+    Options options;
+    options.compression = opts_.compression;
+    options.table_factory.reset(NewBlockBasedTableFactory(opts_.table_options));
+    SstFileWriter writer(EnvOptions(), options);
+    Status s = writer.Open(path);
+    for (size_t i = 0; s.ok() && i < batch->offsets.size(); i++) {
+        s = writer.Put(batch->key(i), batch->value(i));
+    }
+    if (s.ok()) {
+        s = writer.Finish();
+    }
+    return s;
+}
+
+Status BulkLoader::WriteRun(unique_ptr<Batch> batch, const string& path) {
+    batch->Sort();
+    ofstream run(path, ios::binary);
+    for (size_t i = 0; i < batch->offsets.size() && run.good(); i++) {
+        run.write(&batch->data[batch->offsets[i]], batch->RecordSize(i));
+    }
+    run.close();
+    return run.good() ? Status::OK() : Status::IOError("BulkLoader: couldn't write run", path);
+}
+
+Status BulkLoader::MergeRuns() {
+    // if the input fit in one batch, sort it in memory
+    if (runs_.empty()) {
+        unique_ptr<Batch> all(move(batch_));
+        batch_.reset(new Batch());
+        all->Sort();
+        Status s;
+        for (size_t i = 0; s.ok() && i < all->offsets.size(); i++) {
+            s = AddSorted(all->key(i), all->value(i));
+        }
+        return s;
+    }
+    Status s = Submit(true);
+    if (s.ok()) s = WaitForBatches(0);
+    if (!s.ok()) return s;
+
+    // merge the runs, taking the last-added value of each key: among equal
+    // keys, the heap yields that from the latest run first
+    vector<RunReader> readers(runs_.size());
+    auto later = [&readers](size_t a, size_t b) {
+        int c = Slice(readers[a].key).compare(Slice(readers[b].key));
+        return c > 0 || (c == 0 && a < b);
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < readers.size(); i++) {
+        s = readers[i].Open(runs_[i]);
+        if (!s.ok()) return status_ = s;
+        if (readers[i].valid) heap.push(i);
+    }
+    while (s.ok() && !heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        s = AddSorted(readers[i].key, readers[i].value);
+        // skip the superseded values of the same key
+        Status s2 = readers[i].Next();
+        if (readers[i].valid) heap.push(i);
+        while (s2.ok() && !heap.empty() && readers[heap.top()].key == last_key_) {
+            size_t j = heap.top();
+            heap.pop();
+            s2 = readers[j].Next();
+            if (readers[j].valid) heap.push(j);
+        }
+        if (s.ok() && !s2.ok()) s = status_ = s2;
+    }
+    return s;
+}
+
+Status BulkLoader::Ingest() {
+    // the SSTs don't overlap, so they all go into the bottommost level
+    Options options;
+    options.compression = opts_.compression;
+    options.table_factory.reset(NewBlockBasedTableFactory(opts_.table_options));
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    options.disable_auto_compactions = true;
+    DB *db = nullptr;
+    Status s = DB::Open(options, dbpath_, &db);
+    if (s.ok() && ssts_.size()) {
+        IngestExternalFileOptions ingestopts;
+        ingestopts.move_files = true;
+        s = db->IngestExternalFile(ssts_, ingestopts);
+    }
+    delete db;
+    return s;
+}
+
+Status BulkLoader::Finish() {
+    Status s = status_;
+    if (s.ok() && !opts_.sorted) s = MergeRuns();
+    if (s.ok()) s = Submit(false);
+    Status s2 = WaitForBatches(0);
+    if (s.ok()) s = s2;
+    if (s.ok()) s = Ingest();
+    RemoveScratch();
+    return s;
+}
+
+void BulkLoader::RemoveScratch() {
+    if (!scratch_created_) return;
+    for (auto& it : runs_) {
+        unlink(it.c_str());
+    }
+    for (auto& it : ssts_) {
+        unlink(it.c_str());
+    }
+    rmdir(scratch_dir_.c_str());
+    scratch_created_ = false;
+}
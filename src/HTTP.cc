@@ -5,7 +5,13 @@
 #include <functional> 
 #include <cctype>
 #include <locale>
+#include <set>
+#include <stdexcept>
 #include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 // trim from start
 static inline std::string &ltrim(std::string &s) {
@@ -64,6 +70,23 @@ size_t writefunction(char *ptr, size_t size, size_t nmemb, void *userdata) {
     return size;
 }
 
+// receive the response body directly into a fixed-capacity buffer; returning
+// short aborts the transfer with CURLE_WRITE_ERROR should it overflow
+struct BufferSink {
+    char *buf;
+    size_t capacity;
+    size_t size;
+};
+
+size_t bufferwritefunction(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    size *= nmemb;
+    BufferSink *sink = reinterpret_cast<BufferSink*>(userdata);
+    if (size > sink->capacity - sink->size) return 0;
+    memcpy(sink->buf + sink->size, ptr, size);
+    sink->size += size;
+    return size;
+}
+
 size_t headerfunction(char *ptr, size_t size, size_t nmemb, void *userdata) {
     size *= nmemb;
     headers& h = *reinterpret_cast<headers*>(userdata);
@@ -91,48 +114,78 @@ size_t headerfunction(char *ptr, size_t size, size_t nmemb, void *userdata) {
     return size;
 }
 
-enum class HTTPmethod { GET, HEAD };
+enum class HTTPmethod { GET, HEAD, PUT, POST, DELETE };
 // helper macros
 #define CURLcall(call) if ((c = call) != CURLE_OK) return c
 #define CURLsetopt(x,y,z) CURLcall(curl_easy_setopt(x,y,z))
 
-CURLcode request(HTTPmethod method, const std::string url, const headers& request_headers,
-                 long& response_code, headers& response_headers, std::ostream& response_body,
-                 CURLpool *pool) {
+// formulate a request on the given handle, leaving it ready to perform. The
+// request body, if any, is sent from the caller's buffer. Since handles are
+// reused, every method resets the options the others set.
+CURLcode setup(CURL *conn, HTTPmethod method, const std::string& url, const RequestHeadersHelper& headers4curl,
+               headers& response_headers, curl_write_callback write_function, void *write_data,
+               const char *request_body = nullptr, size_t request_body_size = 0) {
     CURLcode c;
-    CURLcall(ensure_init());
-
-    std::unique_ptr<CURLconn> conn;
-
-    if (pool) {
-        conn = pool->checkout();
-    } else {
-        conn.reset(new CURLconn());
-    }
-
-    CURLsetopt(*conn, CURLOPT_URL, url.c_str());
+    CURLsetopt(conn, CURLOPT_URL, url.c_str());
 
+    CURLsetopt(conn, CURLOPT_CUSTOMREQUEST, (char*) nullptr);
+    CURLsetopt(conn, CURLOPT_NOBODY, 0);
     switch (method) {
     case HTTPmethod::GET:
-        CURLsetopt(*conn, CURLOPT_HTTPGET, 1);
+        CURLsetopt(conn, CURLOPT_HTTPGET, 1);
         break;
     case HTTPmethod::HEAD:
-        CURLsetopt(*conn, CURLOPT_NOBODY, 1);
+        CURLsetopt(conn, CURLOPT_HTTPGET, 1);
+        CURLsetopt(conn, CURLOPT_NOBODY, 1);
+        break;
+    case HTTPmethod::PUT:
+    case HTTPmethod::POST:
+        CURLsetopt(conn, CURLOPT_POST, 1);
+        CURLsetopt(conn, CURLOPT_POSTFIELDSIZE_LARGE, curl_off_t(request_body_size));
+        CURLsetopt(conn, CURLOPT_POSTFIELDS, request_body_size ? request_body : "");
+        if (method == HTTPmethod::PUT) {
+            CURLsetopt(conn, CURLOPT_CUSTOMREQUEST, "PUT");
+        }
+        break;
+    case HTTPmethod::DELETE:
+        CURLsetopt(conn, CURLOPT_HTTPGET, 1);
+        CURLsetopt(conn, CURLOPT_CUSTOMREQUEST, "DELETE");
         break;
     }
 
-    RequestHeadersHelper headers4curl(request_headers);
-    CURLsetopt(*conn, CURLOPT_HTTPHEADER, ((curl_slist*) headers4curl));
+    CURLsetopt(conn, CURLOPT_HTTPHEADER, ((curl_slist*) headers4curl));
 
-    CURLsetopt(*conn, CURLOPT_WRITEDATA, &response_body);
-    CURLsetopt(*conn, CURLOPT_WRITEFUNCTION, writefunction);
+    CURLsetopt(conn, CURLOPT_WRITEDATA, write_data);
+    CURLsetopt(conn, CURLOPT_WRITEFUNCTION, write_function);
 
     response_headers.clear();
-    CURLsetopt(*conn, CURLOPT_WRITEHEADER, &response_headers);
-    CURLsetopt(*conn, CURLOPT_HEADERFUNCTION, headerfunction);
+    CURLsetopt(conn, CURLOPT_WRITEHEADER, &response_headers);
+    CURLsetopt(conn, CURLOPT_HEADERFUNCTION, headerfunction);
+
+    CURLsetopt(conn, CURLOPT_FOLLOWLOCATION, 1);
+    CURLsetopt(conn, CURLOPT_MAXREDIRS, 16);
+
+    return CURLE_OK;
+}
+
+CURLcode request(HTTPmethod method, const std::string url, const headers& request_headers,
+                 long& response_code, headers& response_headers,
+                 curl_write_callback write_function, void *write_data,
+                 CURLpool *pool, const char *request_body = nullptr, size_t request_body_size = 0) {
+    CURLcode c;
+    CURLcall(ensure_init());
+
+    std::unique_ptr<CURLconn> conn;
+
+    if (pool) {
+        conn = pool->checkout();
+    } else {
+        conn.reset(new CURLconn());
+    }
 
-    CURLsetopt(*conn, CURLOPT_FOLLOWLOCATION, 1);
-    CURLsetopt(*conn, CURLOPT_MAXREDIRS, 16);
+    RequestHeadersHelper headers4curl(request_headers);
+    CURLcall(setup(*conn, method, url, headers4curl, response_headers, write_function, write_data,
+                   request_body, request_body_size));
 
     CURLcall(curl_easy_perform(*conn));
 
@@ -148,16 +201,292 @@ CURLcode request(HTTPmethod method, const std::string url, const headers& reques
 CURLcode GET(const std::string url, const headers& request_headers,
              long& response_code, headers& response_headers, std::ostream& response_body,
              CURLpool *pool) {
-    return request(HTTPmethod::GET, url, request_headers, response_code, response_headers, response_body, pool);
+    return request(HTTPmethod::GET, url, request_headers, response_code, response_headers,
+                   writefunction, &response_body, pool);
+}
+
+CURLcode GET(const std::string url, const headers& request_headers,
+             long& response_code, headers& response_headers,
+             char *response_body, size_t response_body_capacity, size_t& response_body_size,
+             CURLpool *pool) {
+    BufferSink sink = { response_body, response_body_capacity, 0 };
+    CURLcode ans = request(HTTPmethod::GET, url, request_headers, response_code, response_headers,
+                           bufferwritefunction, &sink, pool);
+    response_body_size = sink.size;
+    return ans;
 }
 
 CURLcode HEAD(const std::string url, const headers& request_headers,
               long& response_code, headers& response_headers,
               CURLpool *pool) {
     std::ostringstream dummy;
-    CURLcode ans = request(HTTPmethod::HEAD, url, request_headers, response_code, response_headers, dummy, pool);
+    CURLcode ans = request(HTTPmethod::HEAD, url, request_headers, response_code, response_headers,
+                           writefunction, &dummy, pool);
     assert (dummy.str().size() == 0);
     return ans;
 }
 
+CURLcode PUT(const std::string url, const headers& request_headers,
+             const char *request_body, size_t request_body_size,
+             long& response_code, headers& response_headers, std::ostream& response_body,
+             CURLpool *pool) {
+    return request(HTTPmethod::PUT, url, request_headers, response_code, response_headers,
+                   writefunction, &response_body, pool, request_body, request_body_size);
+}
+
+CURLcode POST(const std::string url, const headers& request_headers,
+              const char *request_body, size_t request_body_size,
+              long& response_code, headers& response_headers, std::ostream& response_body,
+              CURLpool *pool) {
+    return request(HTTPmethod::POST, url, request_headers, response_code, response_headers,
+                   writefunction, &response_body, pool, request_body, request_body_size);
+}
+
+CURLcode DELETE(const std::string url, const headers& request_headers,
+                long& response_code, headers& response_headers,
+                CURLpool *pool) {
+    std::ostringstream ignore;
+    return request(HTTPmethod::DELETE, url, request_headers, response_code, response_headers,
+                   writefunction, &ignore, pool);
+}
+
+bool ParseContentRange(const std::string& value, uint64_t& first, uint64_t& last, uint64_t& total) {
+    const char *p = value.c_str();
+    if (strncasecmp(p, "bytes", 5) != 0) return false;
+    p += 5;
+    while (*p == ' ') p++;
+    char *end = nullptr;
+    first = strtoull(p, &end, 10);
+    if (end == p || *end != '-') return false;
+    p = end+1;
+    last = strtoull(p, &end, 10);
+    if (end == p || *end != '/' || last < first) return false;
+    p = end+1;
+    if (*p == '*') {
+        total = UINT64_MAX;
+        return true;
+    }
+    total = strtoull(p, &end, 10);
+    return end != p && last < total;
+}
+
+bool ParseMultipartByteranges(const std::string& content_type, const char *body, size_t size,
+                              std::vector<ByteRange>& parts) {
+    parts.clear();
+    std::string ct(content_type);
+    std::transform(ct.begin(), ct.end(), ct.begin(), ::tolower);
+    if (ct.find("multipart/byteranges") != 0) return false;
+    size_t pos = ct.find("boundary=");
+    if (pos == std::string::npos) return false;
+    // take the boundary from the original value, as it's case-sensitive
+    std::string boundary = content_type.substr(pos+9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    boundary = trim(boundary);
+    if (boundary.size() >= 2 && boundary[0] == '"' && boundary[boundary.size()-1] == '"') {
+        boundary = boundary.substr(1, boundary.size()-2);
+    }
+    if (boundary.empty()) return false;
+    const std::string delimiter = "--" + boundary;
+
+    const char *p = body, *end = body+size;
+    for (;;) {
+        // find the next delimiter line
+        const char *d = std::search(p, end, delimiter.begin(), delimiter.end());
+        if (d == end) return false;
+        p = d + delimiter.size();
+        if (end-p >= 2 && p[0] == '-' && p[1] == '-') {
+            return parts.size() > 0;
+        }
+
+        // read the part headers, looking for Content-Range
+        bool have_range = false;
+        uint64_t first = 0, last = 0, total = 0;
+        const char *eol;
+        while ((eol = std::search(p, end, "\r\n", "\r\n"+2)) != end) {
+            std::string line(p, eol);
+            p = eol+2;
+            if (line.empty() && have_range) break;
+            size_t sep = line.find(':');
+            if (sep == std::string::npos) continue;
+            std::string k = line.substr(0, sep), v = line.substr(sep+1);
+            k = trim(k);
+            v = trim(v);
+            std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+            if (k == "content-range") {
+                if (!ParseContentRange(v, first, last, total)) return false;
+                have_range = true;
+            }
+        }
+        if (eol == end) return false;
+
+        // the part contents
+        uint64_t n = last-first+1;
+        if (uint64_t(end-p) < n) return false;
+        parts.push_back({first, n, p});
+        p += n;
+    }
+}
+
+// State of one transfer in flight on an AsyncClient
+struct AsyncClient::Transfer {
+    std::unique_ptr<CURLconn> conn;
+    RequestHeadersHelper headers4curl;
+    BufferSink sink;
+    long *response_code;
+    size_t *response_body_size;
+    std::promise<CURLcode> result;
+
+    Transfer(const headers& request_headers) : headers4curl(request_headers) {}
+};
+
+AsyncClient::AsyncClient(const unsigned int max_connections)
+    : multi_(nullptr)
+    , stop_(false)
+    , pool_(max_connections) {
+    wakeup_[0] = wakeup_[1] = -1;
+    if (ensure_init() != CURLE_OK || !(multi_ = curl_multi_init())) {
+        throw std::runtime_error("HTTP::AsyncClient initialization failed");
+    }
+    // the destructor won't run if the constructor throws, so release what
+    // has been acquired so far
+    if (pipe2(wakeup_, O_NONBLOCK | O_CLOEXEC) != 0) {
+        curl_multi_cleanup(multi_);
+        throw std::runtime_error("HTTP::AsyncClient initialization failed");
+    }
+    curl_multi_setopt(multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS, long(max_connections));
+    try {
+        thread_ = std::thread([this]() { Run(); });
+    } catch (...) {
+        curl_multi_cleanup(multi_);
+        close(wakeup_[0]);
+        close(wakeup_[1]);
+        throw;
+    }
+}
+
+AsyncClient::~AsyncClient() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    Wakeup();
+    thread_.join();
+    curl_multi_cleanup(multi_);
+    close(wakeup_[0]);
+    close(wakeup_[1]);
+}
+
+void AsyncClient::Wakeup() {
+    char b = 0;
+    if (write(wakeup_[1], &b, 1) < 0) {
+        // pipe already full, so the event loop will wake up anyway
+    }
+}
+
+std::future<CURLcode> AsyncClient::Submit(HTTPmethod method, const std::string& url, const headers& request_headers,
+                                          long& response_code, headers& response_headers,
+                                          char *response_body, size_t response_body_capacity, size_t *response_body_size) {
+    std::unique_ptr<Transfer> t(new Transfer(request_headers));
+    std::future<CURLcode> ans = t->result.get_future();
+    t->conn = pool_.checkout();
+    t->sink = { response_body, response_body_capacity, 0 };
+    t->response_code = &response_code;
+    t->response_body_size = response_body_size;
+    if (response_body_size) *response_body_size = 0;
+
+    CURLcode c = setup(*(t->conn), method, url, t->headers4curl, response_headers,
+                       bufferwritefunction, &(t->sink));
+    if (c == CURLE_OK) {
+        c = curl_easy_setopt(*(t->conn), CURLOPT_PRIVATE, t.get());
+    }
+    if (c != CURLE_OK) {
+        t->result.set_value(c);
+        return ans;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        submitted_.push_back(t.release());
+    }
+    Wakeup();
+    return ans;
+}
+
+std::future<CURLcode> AsyncClient::GET(const std::string& url, const headers& request_headers,
+                                       long& response_code, headers& response_headers,
+                                       char *response_body, size_t response_body_capacity, size_t& response_body_size) {
+    return Submit(HTTPmethod::GET, url, request_headers, response_code, response_headers,
+                  response_body, response_body_capacity, &response_body_size);
+}
+
+std::future<CURLcode> AsyncClient::HEAD(const std::string& url, const headers& request_headers,
+                                        long& response_code, headers& response_headers) {
+    return Submit(HTTPmethod::HEAD, url, request_headers, response_code, response_headers,
+                  nullptr, 0, nullptr);
+}
+
+void AsyncClient::Run() {
+    std::set<Transfer*> active;
+    bool stop = false;
+
+    while (!stop) {
+        // take on newly submitted transfers
+        std::vector<Transfer*> submitted;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            submitted.swap(submitted_);
+            stop = stop_;
+        }
+        for (Transfer *t : submitted) {
+            if (curl_multi_add_handle(multi_, *(t->conn)) != CURLM_OK) {
+                t->result.set_value(CURLE_FAILED_INIT);
+                delete t;
+            } else {
+                active.insert(t);
+            }
+        }
+
+        // make progress on all active transfers
+        int running = 0;
+        curl_multi_perform(multi_, &running);
+
+        // complete finished transfers
+        CURLMsg *msg;
+        int queued = 0;
+        while ((msg = curl_multi_info_read(multi_, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Transfer *t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &t);
+            CURLcode c = msg->data.result;
+            curl_multi_remove_handle(multi_, msg->easy_handle);
+            active.erase(t);
+
+            if (c == CURLE_OK) {
+                c = curl_easy_getinfo(*(t->conn), CURLINFO_RESPONSE_CODE, t->response_code);
+            }
+            if (t->response_body_size) *(t->response_body_size) = t->sink.size;
+            if (c == CURLE_OK) {
+                pool_.checkin(t->conn);
+            }
+            t->result.set_value(c);
+            delete t;
+        }
+
+        // wait for socket activity or a wakeup
+        if (!stop) {
+            curl_waitfd wfd = { wakeup_[0], CURL_WAIT_POLLIN, 0 };
+            curl_multi_wait(multi_, &wfd, 1, 1000, nullptr);
+            char buf[64];
+            while (read(wakeup_[0], buf, sizeof(buf)) > 0);
+        }
+    }
+
+    // abort any transfers still in flight
+    for (Transfer *t : active) {
+        curl_multi_remove_handle(multi_, *(t->conn));
+        t->result.set_value(CURLE_ABORTED_BY_CALLBACK);
+        delete t;
+    }
+}
+
 }
@@ -0,0 +1,288 @@
+#include "RocksWorm/HTTPDiskCache.h"
+#include "crc32c.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+using namespace std;
+using namespace rocksdb;
+
+// Page file layout: the header below, followed by the key, the validator and
+// the page contents. crc covers everything following it.
+struct PageHeader {
+    char magic[4];
+    uint32_t crc;
+    uint32_t key_size;
+    uint32_t validator_size;
+    uint32_t data_size;
+};
+static const char PAGE_MAGIC[4] = { 'R', 'W', 'D', 'C' };
+static const char *PAGE_SUFFIX = ".page";
+// temporary files of live processes are left alone unless this old (in case
+// the pid has been reused)
+static const time_t TMP_MAX_AGE = 3600;
+
+// Whether the temporary file, named by Insert with its writer's pid, has been
+// abandoned: the writer has exited, or the file is implausibly old
+static bool Abandoned(const string& tmp_name, time_t mtime) {
+    long pid = strtol(tmp_name.c_str() + tmp_name.find(".tmp.") + 5, nullptr, 10);
+    if (pid <= 0 || (kill(pid_t(pid), 0) != 0 && errno == ESRCH)) return true;
+    return time(nullptr) - mtime > TMP_MAX_AGE;
+}
+
+HTTPDiskCache::HTTPDiskCache(const string& dir, uint64_t capacity, size_t page_size)
+    : dir_(dir)
+    , capacity_(capacity)
+    , page_size_(page_size)
+    , usage_(0)
+    , tmp_counter_(0)
+    , hits_(0)
+    , misses_(0)
+    , stale_(0)
+    , inserts_(0)
+    , evictions_(0)
+{
+    while (dir_.size() > 1 && dir_[dir_.size()-1] == '/') {
+        dir_.erase(dir_.size()-1);
+    }
+}
+
+Status HTTPDiskCache::Open() {
+    if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        return Status::IOError("HTTPDiskCache::Open: couldn't create " + dir_, strerror(errno));
+    }
+    DIR *d = opendir(dir_.c_str());
+    if (!d) return Status::IOError("HTTPDiskCache::Open: couldn't open " + dir_, strerror(errno));
+
+    // index existing pages, oldest first; remove temporary files left behind
+    // by crashed processes, but not those other processes are still writing
+    struct found { string name; uint64_t size; time_t mtime; };
+    vector<found> pages;
+    struct dirent *ent;
+    const size_t suffix_len = strlen(PAGE_SUFFIX);
+    while ((ent = readdir(d))) {
+        string name(ent->d_name);
+        string path = dir_ + "/" + name;
+        struct stat st;
+        if (name.find(".tmp.") != string::npos) {
+            if (stat(path.c_str(), &st) == 0 && Abandoned(name, st.st_mtime)) {
+                unlink(path.c_str());
+            }
+        } else if (name.size() > suffix_len && name.substr(name.size()-suffix_len) == PAGE_SUFFIX
+                     && stat(path.c_str(), &st) == 0) {
+            pages.push_back({name, uint64_t(st.st_size), st.st_mtime});
+        }
+    }
+    closedir(d);
+    sort(pages.begin(), pages.end(), [](const found& a, const found& b) { return a.mtime < b.mtime; });
+
+    lock_guard<mutex> lock(mu_);
+    for (const auto& page : pages) {
+        Admit(page.name, page.size);
+    }
+    return Status::OK();
+}
+
+// 64-bit FNV-1a: unlike std::hash, the same in every build, as it must be for
+// the names of page files left for later processes
+static uint64_t FNV1a(const string& s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// two independent hashes make collisions vanishingly unlikely
+static void Digest(const string& s, ostream& out) {
+    out << hex << setfill('0') << setw(16) << FNV1a(s)
+        << setw(8) << crc32c::Value(s.data(), s.size()) << dec;
+}
+
+string HTTPDiskCache::Key(const string& url, const string& fname, uint64_t page) {
+    // the page file records only a digest of the URL, which may carry
+    // credentials (e.g. a presigned URL's query string)
+    ostringstream key;
+    Digest(url, key);
+    key << '\0' << fname << '\0' << page;
+    return key.str();
+}
+
+string HTTPDiskCache::FileName(const string& key) {
+    // collisions are detected anyway, since the page file records the full key
+    ostringstream name;
+    Digest(key, name);
+    name << PAGE_SUFFIX;
+    return name.str();
+}
+
+// caller holds mu_
+void HTTPDiskCache::Admit(const string& name, uint64_t size) {
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+        usage_ -= it->second->second;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    lru_.emplace_front(name, size);
+    index_[name] = lru_.begin();
+    usage_ += size;
+
+    while (usage_ > capacity_ && lru_.size()) {
+        auto& victim = lru_.back();
+        unlink((dir_ + "/" + victim.first).c_str());
+        usage_ -= victim.second;
+        index_.erase(victim.first);
+        lru_.pop_back();
+        evictions_++;
+    }
+}
+
+void HTTPDiskCache::Touch(const string& name) {
+    lock_guard<mutex> lock(mu_);
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+    }
+}
+
+void HTTPDiskCache::Forget(const string& name, ino_t ino) {
+    lock_guard<mutex> lock(mu_);
+    string path = dir_ + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        if (st.st_ino != ino) {
+            // replaced by Insert since it was read
+            return;
+        }
+        unlink(path.c_str());
+    }
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+        usage_ -= it->second->second;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+}
+
+bool HTTPDiskCache::Lookup(const string& url, const string& fname, uint64_t page,
+                           const string& validator, string& ans) {
+    string key = Key(url, fname, page);
+    string name = FileName(key);
+    {
+        lock_guard<mutex> lock(mu_);
+        if (index_.find(name) == index_.end()) {
+            misses_++;
+            return false;
+        }
+    }
+
+    // read and verify the whole page file
+    string contents;
+    ino_t ino = 0;
+    int fd = open((dir_ + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            ino = st.st_ino;
+            if (uint64_t(st.st_size) >= sizeof(PageHeader)) {
+                contents.resize(st.st_size);
+                if (pread(fd, &contents[0], st.st_size, 0) != st.st_size) {
+                    contents.clear();
+                }
+            }
+        }
+        close(fd);
+    }
+    PageHeader hdr;
+    bool valid = false;
+    if (contents.size() >= sizeof(PageHeader)) {
+        memcpy(&hdr, contents.data(), sizeof(PageHeader));
+        const size_t crc_offset = offsetof(PageHeader, key_size);
+        valid = memcmp(hdr.magic, PAGE_MAGIC, 4) == 0
+                && uint64_t(hdr.key_size) + hdr.validator_size + hdr.data_size + sizeof(PageHeader) == contents.size()
+                && hdr.crc == crc32c::Value(contents.data()+crc_offset, contents.size()-crc_offset);
+    }
+    if (!valid || contents.compare(sizeof(PageHeader), hdr.key_size, key) != 0) {
+        // corrupt, or a hash collision
+        if (!valid) Forget(name, ino);
+        misses_++;
+        return false;
+    }
+    if (contents.compare(sizeof(PageHeader)+hdr.key_size, hdr.validator_size, validator) != 0) {
+        Forget(name, ino);
+        stale_++;
+        misses_++;
+        return false;
+    }
+
+    ans.assign(contents, sizeof(PageHeader)+hdr.key_size+hdr.validator_size, hdr.data_size);
+    Touch(name);
+    hits_++;
+    return true;
+}
+
+void HTTPDiskCache::Insert(const string& url, const string& fname, uint64_t page,
+                           const string& validator, const char* data, size_t n) {
+    assert(n <= page_size_);
+    string key = Key(url, fname, page);
+    string name = FileName(key);
+
+    PageHeader hdr;
+    memcpy(hdr.magic, PAGE_MAGIC, 4);
+    hdr.key_size = key.size();
+    hdr.validator_size = validator.size();
+    hdr.data_size = n;
+    const size_t crc_offset = offsetof(PageHeader, key_size);
+    uint32_t crc = crc32c::Value(reinterpret_cast<const char*>(&hdr)+crc_offset, sizeof(PageHeader)-crc_offset);
+    crc = crc32c::Extend(crc, key.data(), key.size());
+    crc = crc32c::Extend(crc, validator.data(), validator.size());
+    hdr.crc = crc32c::Extend(crc, data, n);
+
+    // write to a temporary file, then rename it into place
+    ostringstream tmp;
+    {
+        lock_guard<mutex> lock(mu_);
+        tmp << dir_ << "/" << name << ".tmp." << getpid() << "." << tmp_counter_++;
+    }
+    int fd = open(tmp.str().c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    bool ok = write(fd, &hdr, sizeof(hdr)) == ssize_t(sizeof(hdr))
+              && write(fd, key.data(), key.size()) == ssize_t(key.size())
+              && write(fd, validator.data(), validator.size()) == ssize_t(validator.size())
+              && write(fd, data, n) == ssize_t(n);
+    ok = (close(fd) == 0) && ok;
+
+    // rename under mu_, so that Forget can tell whether the page file has
+    // been replaced since Lookup read it
+    lock_guard<mutex> lock(mu_);
+    if (!ok || rename(tmp.str().c_str(), (dir_ + "/" + name).c_str()) != 0) {
+        unlink(tmp.str().c_str());
+        return;
+    }
+    Admit(name, sizeof(hdr) + key.size() + validator.size() + n);
+    inserts_++;
+}
+
+HTTPDiskCache::Stats HTTPDiskCache::GetStats() {
+    Stats ans;
+    ans.hits = hits_;
+    ans.misses = misses_;
+    ans.stale = stale_;
+    ans.inserts = inserts_;
+    ans.evictions = evictions_;
+    lock_guard<mutex> lock(mu_);
+    ans.usage = usage_;
+    return ans;
+}
@@ -0,0 +1,94 @@
+#include "RocksWorm/HTTPRangeCache.h"
+#include <assert.h>
+using namespace std;
+
+HTTPRangeCache::HTTPRangeCache(size_t capacity, size_t page_size, unsigned int shard_bits)
+    : capacity_(capacity)
+    , page_size_(page_size)
+    , shard_bits_(shard_bits)
+    , shards_(new Shard[size_t(1) << shard_bits])
+    , hits_(0)
+    , misses_(0)
+    , inserts_(0)
+    , evictions_(0)
+{
+    assert(page_size_ > 0);
+}
+
+string HTTPRangeCache::Key(const string& url, const string& fname, uint64_t page) {
+    string key;
+    key.reserve(url.size() + fname.size() + 10);
+    key.append(url);
+    key.push_back('\0');
+    key.append(fname);
+    key.push_back('\0');
+    key.append(reinterpret_cast<const char*>(&page), sizeof(uint64_t));
+    return key;
+}
+
+HTTPRangeCache::Shard& HTTPRangeCache::ShardFor(const string& key) {
+    size_t h = hash<string>()(key);
+    // take the high bits, as the low bits are most influenced by page number
+    return shards_[shard_bits_ ? (h >> (sizeof(size_t)*8 - shard_bits_)) : 0];
+}
+
+bool HTTPRangeCache::Lookup(const string& url, const string& fname, uint64_t page,
+                            shared_ptr<const string>& ans) {
+    string key = Key(url, fname, page);
+    Shard& shard = ShardFor(key);
+    {
+        lock_guard<mutex> lock(shard.mu);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            ans = it->second->second;
+            hits_++;
+            return true;
+        }
+    }
+    misses_++;
+    return false;
+}
+
+void HTTPRangeCache::Insert(const string& url, const string& fname, uint64_t page,
+                            shared_ptr<const string> data) {
+    assert(data);
+    assert(data->size() <= page_size_);
+    string key = Key(url, fname, page);
+    Shard& shard = ShardFor(key);
+    size_t shard_capacity = capacity_ >> shard_bits_;
+    if (data->size() > shard_capacity) return;
+
+    lock_guard<mutex> lock(shard.mu);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.usage -= it->second->second->size();
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+    shard.usage += data->size();
+    shard.lru.emplace_front(key, move(data));
+    shard.index[key] = shard.lru.begin();
+    inserts_++;
+
+    while (shard.usage > shard_capacity) {
+        auto& victim = shard.lru.back();
+        shard.usage -= victim.second->size();
+        shard.index.erase(victim.first);
+        shard.lru.pop_back();
+        evictions_++;
+    }
+}
+
+HTTPRangeCache::Stats HTTPRangeCache::GetStats() {
+    Stats ans;
+    ans.hits = hits_;
+    ans.misses = misses_;
+    ans.inserts = inserts_;
+    ans.evictions = evictions_;
+    for (size_t i = 0; i < (size_t(1) << shard_bits_); i++) {
+        lock_guard<mutex> lock(shards_[i].mu);
+        ans.usage += shards_[i].usage;
+    }
+    return ans;
+}
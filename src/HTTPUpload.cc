@@ -0,0 +1,225 @@
+#include "RocksWorm/HTTPUpload.h"
+#include <sstream>
+#include <assert.h>
+#include <ctype.h>
+using namespace std;
+using namespace rocksdb;
+
+// percent-encode a query parameter value
+static string URLEncode(const string& s) {
+    static const char hex[] = "0123456789ABCDEF";
+    string ans;
+    for (unsigned char c : s) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            ans += char(c);
+        } else {
+            ans += '%';
+            ans += hex[c >> 4];
+            ans += hex[c & 15];
+        }
+    }
+    return ans;
+}
+
+// the text of the first <tag> element in an XML document
+static bool XMLElement(const string& xml, const string& tag, string& ans) {
+    size_t lo = xml.find("<" + tag + ">");
+    if (lo == string::npos) return false;
+    lo += tag.size()+2;
+    size_t hi = xml.find("</" + tag + ">", lo);
+    if (hi == string::npos) return false;
+    ans = xml.substr(lo, hi-lo);
+    return true;
+}
+
+HTTPMultipartUpload::HTTPMultipartUpload(const string& url, const HTTPUploadOptions& opts)
+    : url_(url)
+    , opts_(opts)
+    , connpool_(opts.connpool)
+    , size_(0)
+{
+    if (connpool_ == nullptr) {
+        own_connpool_.reset(new HTTP::CURLpool(opts_.parallel_parts + 1));
+        connpool_ = own_connpool_.get();
+    }
+    opts_.parallel_parts = max(opts_.parallel_parts, 1U);
+}
+
+HTTPMultipartUpload::~HTTPMultipartUpload() {
+    if (upload_id_.size()) {
+        Abort();
+    }
+    WaitForParts(0);
+}
+
+string HTTPMultipartUpload::URL(const string& query) const {
+    return url_ + (url_.find('?') == string::npos ? "?" : "&") + query;
+}
+
+string HTTPMultipartUpload::CensorURL(const string& url) const {
+    return url.substr(0, url.find('?'));
+}
+
+Status HTTPMultipartUpload::Retry(const string& method, const string& url, const char *body, size_t n,
+                                  HTTP::headers& response_headers, string& response_body) {
+    HTTP::headers request_headers = opts_.request_headers;
+    if (method != "DELETE" && request_headers.find("content-type") == request_headers.end()) {
+        request_headers["content-type"] = method == "POST" && n ? "application/xml" : "application/octet-stream";
+    }
+    Status s;
+    useconds_t delay = opts_.retry_initial_delay;
+    for (unsigned int i = 0; i <= opts_.retry_times; i++) {
+        if (i) {
+            usleep(delay);
+            delay *= opts_.retry_backoff_factor;
+        }
+
+        long response_code = -1;
+        ostringstream response;
+        CURLcode c;
+        if (method == "PUT") {
+            c = HTTP::PUT(url, request_headers, body, n, response_code, response_headers, response, connpool_);
+        } else if (method == "POST") {
+            c = HTTP::POST(url, request_headers, body, n, response_code, response_headers, response, connpool_);
+        } else {
+            c = HTTP::DELETE(url, request_headers, response_code, response_headers, connpool_);
+        }
+        if (c != CURLE_OK) {
+            s = Status::IOError(method + " " + CensorURL(url), curl_easy_strerror(c));
+            continue;
+        }
+        ostringstream stm;
+        stm << "HTTP response code " << response_code;
+        if (response_code >= 500 && response_code <= 599) {
+            s = Status::IOError(method + " " + CensorURL(url), stm.str());
+            continue;
+        }
+        if (response_code < 200 || response_code >= 300) {
+            return Status::IOError(method + " " + CensorURL(url), stm.str());
+        }
+        response_body = response.str();
+        return Status::OK();
+    }
+    return s;
+}
+
+Status HTTPMultipartUpload::Begin() {
+    if (upload_id_.size()) return Status::InvalidArgument("HTTPMultipartUpload::Begin: already begun");
+    if (opts_.part_size == 0) return Status::InvalidArgument("HTTPMultipartUpload::Begin: zero part size");
+    HTTP::headers response_headers;
+    string response;
+    Status s = Retry("POST", URL("uploads"), nullptr, 0, response_headers, response);
+    if (!s.ok()) return s;
+    if (!XMLElement(response, "UploadId", upload_id_) || upload_id_.empty()) {
+        upload_id_.clear();
+        return Status::IOError("POST " + CensorURL(url_), "response lacks UploadId");
+    }
+    part_.reset(new char[opts_.part_size]);
+    setp(part_.get(), part_.get() + opts_.part_size);
+    return Status::OK();
+}
+
+Status HTTPMultipartUpload::PutPart(unsigned int part_number, unique_ptr<char[]> data, size_t n) {
+    ostringstream query;
+    query << "partNumber=" << part_number << "&uploadId=" << URLEncode(upload_id_);
+    HTTP::headers response_headers;
+    string response;
+    Status s = Retry("PUT", URL(query.str()), data.get(), n, response_headers, response);
+    if (!s.ok()) return s;
+    auto etag = response_headers.find("etag");
+    if (etag == response_headers.end()) {
+        return Status::IOError("PUT " + CensorURL(url_), "response lacks ETag");
+    }
+    lock_guard<mutex> lock(mu_);
+    etags_[part_number-1] = etag->second;
+    return Status::OK();
+}
+
+bool HTTPMultipartUpload::WaitForParts(size_t max_in_flight) {
+    while (in_flight_.size() > max_in_flight) {
+        Status s = in_flight_.front().get();
+        in_flight_.pop_front();
+        if (!s.ok() && status_.ok()) status_ = s;
+    }
+    return status_.ok();
+}
+
+bool HTTPMultipartUpload::Flush() {
+    if (!part_ || !WaitForParts(opts_.parallel_parts-1)) return false;
+    size_t n = pptr() - pbase();
+    unsigned int part_number;
+    {
+        lock_guard<mutex> lock(mu_);
+        etags_.push_back("");
+        part_number = etags_.size();
+    }
+    in_flight_.push_back(async(launch::async, &HTTPMultipartUpload::PutPart, this,
+                               part_number, move(part_), n));
+    size_ += n;
+    part_.reset(new char[opts_.part_size]);
+    setp(part_.get(), part_.get() + opts_.part_size);
+    return true;
+}
+
+HTTPMultipartUpload::int_type HTTPMultipartUpload::overflow(int_type c) {
+    if (!Flush()) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+Status HTTPMultipartUpload::Finish() {
+    if (upload_id_.empty()) return Status::InvalidArgument("HTTPMultipartUpload::Finish: not begun");
+    // the last part may be short, and there must be at least one
+    bool any_parts;
+    {
+        lock_guard<mutex> lock(mu_);
+        any_parts = etags_.size() > 0;
+    }
+    if (pptr() > pbase() || !any_parts) {
+        Flush();
+    }
+    if (!WaitForParts(0)) {
+        Status s = status_;
+        Abort();
+        return s;
+    }
+
+    ostringstream xml;
+    xml << "<CompleteMultipartUpload>";
+    for (size_t i = 0; i < etags_.size(); i++) {
+        xml << "<Part><PartNumber>" << (i+1) << "</PartNumber><ETag>" << etags_[i] << "</ETag></Part>";
+    }
+    xml << "</CompleteMultipartUpload>";
+    string body = xml.str(), response, error;
+    HTTP::headers response_headers;
+    Status s = Retry("POST", URL("uploadId=" + URLEncode(upload_id_)), body.data(), body.size(),
+                     response_headers, response);
+    // S3 may report an error in the body of a 200 response
+    if (s.ok() && XMLElement(response, "Code", error)) {
+        s = Status::IOError("POST " + CensorURL(url_), "CompleteMultipartUpload failed: " + error);
+    }
+    if (!s.ok()) {
+        Abort();
+        return s;
+    }
+    upload_id_.clear();
+    part_.reset();
+    setp(nullptr, nullptr);
+    return Status::OK();
+}
+
+void HTTPMultipartUpload::Abort() {
+    WaitForParts(0);
+    if (status_.ok()) status_ = Status::Aborted("HTTPMultipartUpload aborted");
+    if (upload_id_.size()) {
+        HTTP::headers response_headers;
+        string response;
+        Retry("DELETE", URL("uploadId=" + URLEncode(upload_id_)), nullptr, 0, response_headers, response);
+        upload_id_.clear();
+    }
+    part_.reset();
+    setp(nullptr, nullptr);
+}
@@ -6,7 +6,60 @@
 // the write-ahead log is empty).
 //
 // The RocksWorm file consists of the concatenated contents of several files,
-// followed by a trailing manifest. The format of the manifest is as follows:
+// followed by a trailing manifest. Two formats are available; the newer ROC1
+// is the default, and its format is described in RocksWormFormat.h. It aligns
+// each file to a configurable boundary (so that range requests for whole
+// pages of a file correspond to pages of the RocksWorm file), checksums each
+// file, and ends with a fixed-size footer locating a sorted manifest. The
+// small files needed to open the database (CURRENT, IDENTITY and MANIFEST-*)
+// are placed last, immediately before the manifest, so that readers get them
+// in the same request. With --pack-metadata, the trailing metadata of each SST
+// (everything following its data blocks: filter, index and metaindex blocks,
+// properties and footer) is also copied into one region preceding those
+// files, so that readers can load what table opens need in one request. With
+// --global-filter, the trailer also includes a Bloom filter over all keys in
+// the database, with which readers can rule out absent keys without any
+// requests. With --global-index, it includes an index of the SSTs' data
+// blocks, so that readers can fetch the blocks holding a key in one request.
+// With --manifest-page, the manifest is divided into pages, placed before the
+// metadata region, which readers fetch on demand instead of loading the whole
+// manifest up front (for databases with very many SSTs). With --stripes, the
+// SSTs are instead divided among several stripe objects written alongside
+// the RocksWorm file, so that reads of the database spread across objects
+// (and their request rate and throughput limits).
+//
+// With --base, the output is a delta file holding only the SSTs that a prior
+// RocksWorm file of the same database (e.g. before some new writes) lacks:
+// each SST found in the prior file with the same name, size and checksum is
+// instead referred to where it lies within the prior file's objects, by URL
+// and offset, so that an update to a large database uploads only what
+// changed. The delta also records the ETag of each of those objects, so that
+// readers detect if the prior file is later replaced. Deltas are read with
+// RocksWormDeltaHTTPEnv; see RocksWormFormat.h.
+//
+// With --optimize, the database is first rewritten, as if fully compacted, into
+// a fresh one whose SSTs are all in one level and have table options suited
+// to reading over HTTP (large blocks, partitioned indexes and filters), and
+// that is converted instead; the source database's own table options, which
+// were chosen for local storage if at all, then don't matter.
+//
+// With --bulk-load, the database is instead built directly from a stream of
+// key/value records (sorted, or else sorted externally with --unsorted) using
+// BulkLoader, which writes the SSTs in parallel with SstFileWriter, with the
+// same table options, and has a fresh database ingest them; this skips the
+// memtable and compaction work of loading a database through Put, which a
+// write-once artifact doesn't need.
+//
+// When writing to a destination path, the SSTs are copied into place in
+// parallel (--threads), each at the offset planned for it, using
+// copy_file_range so that the kernel moves the data (or, on filesystems with
+// reflinks, shares it); each SST is also read once to checksum it. The rest
+// of the RocksWorm file is then written sequentially after them. With
+// --upload, the RocksWorm file (and any stripes) is instead streamed straight
+// to the given URL as an S3-compatible multipart upload, with several parts
+// in flight at once.
+//
+// The format of the ROC0 manifest is as follows:
 //
 // MANIFEST   ::= FILE_LIST uint64 MAGIC       the integer is the total size of 
 //                                             file_list, in bytes
@@ -25,30 +78,223 @@
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
 using namespace std;
 
 #include "rocksdb/db.h"
 #include "rocksdb/env.h"
+#include "rocksdb/table_properties.h"
+#include "rocksdb/table.h"
+#include "rocksdb/sst_file_writer.h"
 using namespace rocksdb;
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <assert.h>
+#include "RocksWormFormat.h"
+#include "SSTBlocks.h"
+#include "RocksWorm/HTTPUpload.h"
+#include "RocksWorm/BulkLoader.h"
+#include "RocksWorm/RocksWormDeltaHTTPEnv.h"
 
 // http://esr.ibiblio.org/?p=5095
 #define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x100)
 
 void usage() {
-    cout << "Usage: MakeRocksWormFileFromDB /rocksdb/database/path [dest.rocksworm]" << endl;
+    cout << "Usage: MakeRocksWormFileFromDB [options] /rocksdb/database/path [dest.rocksworm]" << endl;
+    cout << "       MakeRocksWormFileFromDB --bulk-load FORMAT [options] input [dest.rocksworm]" << endl;
     cout << "Emits RocksWorm file to standard out if destination path isn't specified." << endl;
+    cout << "Options:" << endl;
+    cout << "  --format N   RocksWorm format version, 0 or 1 (default 1)" << endl;
+    cout << "  --align N    align each file to a multiple of N bytes (default 4096; format 1 only)" << endl;
+    cout << "  --pack-metadata" << endl;
+    cout << "               copy the metadata of each SST into one region (format 1 only)" << endl;
+    cout << "  --global-filter N" << endl;
+    cout << "               include a Bloom filter over all keys, with N bits per key (format 1 only)" << endl;
+    cout << "  --global-index N" << endl;
+    cout << "               include an index of the data blocks of all SSTs, with an entry for every" << endl;
+    cout << "               N blocks (format 1 only)" << endl;
+    cout << "  --manifest-page N" << endl;
+    cout << "               divide the manifest into pages of N entries, fetched on demand (format 1 only)" << endl;
+    cout << "  --stripes N  divide the SSTs among N stripe objects, written next to the destination" << endl;
+    cout << "               as 1.dest.rocksworm, 2.dest.rocksworm, etc. (format 1 only)" << endl;
+    cout << "  --base URL   write a delta file, referring to the SSTs already in the prior RocksWorm" << endl;
+    cout << "               file at URL (unchanged since) instead of including them; URL mustn't" << endl;
+    cout << "               have a query string, as the delta records it (format 1 only)" << endl;
+    cout << "  --optimize   first rewrite the database into one level of SSTs with large blocks and" << endl;
+    cout << "               partitioned indexes and filters, suited to reading over HTTP (needs scratch" << endl;
+    cout << "               space next to the destination, or in $TMPDIR)" << endl;
+    cout << "  --bulk-load FORMAT" << endl;
+    cout << "               instead of a database path, take a file of key/value records in FORMAT" << endl;
+    cout << "               ('-' for standard input), and build the database from them directly:" << endl;
+    cout << "                 tsv     lines of a key and value, separated by the first tab" << endl;
+    cout << "                 binary  the key's and value's lengths as 32-bit little-endian integers," << endl;
+    cout << "                         followed by the key and value" << endl;
+    cout << "               The keys must be in strictly increasing order, unless --unsorted is given" << endl;
+    cout << "  --unsorted   sort the --bulk-load records (in scratch space), keeping the last value" << endl;
+    cout << "               given for each key" << endl;
+    cout << "  --sort-buffer N" << endl;
+    cout << "               with --unsorted, sort in runs using N MiB of memory in all, divided among" << endl;
+    cout << "               the threads (default 1024)" << endl;
+    cout << "  --threads N  copy the SSTs with N threads, when writing to a destination path, and" << endl;
+    cout << "               write them with N threads for --optimize and --bulk-load (default: the" << endl;
+    cout << "               number of CPUs)" << endl;
+    cout << "  --upload URL upload the RocksWorm file (and stripes, named relative to it) to URL as an" << endl;
+    cout << "               S3-compatible multipart upload, instead of writing it locally" << endl;
+    cout << "  --upload-parts N" << endl;
+    cout << "               upload N parts at once (default 4)" << endl;
+    cout << "  --part-size N" << endl;
+    cout << "               upload parts of N MiB (default 64; raised if needed to stay within" << endl;
+    cout << "               10,000 parts)" << endl;
 }
 
+// consecutive data blocks of an SST, for the global index
+struct index_group {
+    string largest;     // upper bound on the user keys
+    uint64_t offset;    // of the first block, within the SST
+    vector<uint32_t> block_sizes;
+};
+
 struct file_entry {
     string name;
     uint64_t size;
-    file_entry(const string& name_, uint64_t size_) : name(name_), size(size_) {}
+    bool inline_;       // placed unaligned at the end, next to the manifest
+    uint32_t object;    // the stripe holding the file, or 0 for the RocksWorm file itself
+    bool in_base;       // referred to within the base's object base_object, at offset (--base)
+    uint32_t base_object;
+    bool packed;        // [metadata_offset, size) is copied into the metadata region
+    uint64_t metadata_offset;
+    uint64_t offset;    // within the RocksWorm file, as planned by plan_layout
+    uint64_t metadata_copy;
+    uint32_t crc32c;    // computed by copy_contents or emit
+    string smallest_key;            // for the global index
+    vector<index_group> index_groups;
+    file_entry(const string& name_, uint64_t size_, bool inline__ = false)
+        : name(name_), size(size_), inline_(inline__), object(0), in_base(false), base_object(0),
+          packed(false), metadata_offset(0), offset(0), metadata_copy(0), crc32c(0) {}
+};
+
+// an object holding some of the SSTs, named relative to the RocksWorm file
+// (or, for an object of the base, by its URL)
+struct stripe {
+    string name;
+    uint64_t size;
+    uint32_t crc32c;    // computed by copy_contents or emit_stripe
+    string etag;        // of an object of the base
 };
 
+// Placement of the constituent files within the RocksWorm file (and any
+// stripes), planned before anything is written
+struct layout {
+    unsigned int format = 1;
+    uint64_t alignment = 4096;
+    bool pack_metadata = false;
+    vector<file_entry> files;   // in order of appearance
+    uint64_t metadata_offset = 0, metadata_size = 0; // the metadata region
+    uint64_t inline_offset = 0; // start of the inline files
+    uint64_t contents_size = 0; // end of the last file
+    uint32_t metadata_crc32c = 0, inline_crc32c = 0; // computed by emit
+    unsigned int filter_bits_per_key = 0;
+    string global_filter;
+    unsigned int index_stride = 0;  // data blocks per global index group
+    uint32_t manifest_page = 0;     // entries per manifest page, if paged
+    uint64_t pages_offset = 0, pages_size = 0; // the manifest pages
+    uint32_t pages_crc32c = 0;      // computed by emit
+    string manifest_directory;      // computed by emit
+    vector<stripe> stripes;         // objects 1, 2, ...
+    vector<stripe> bases;           // objects of the base (--base), following the stripes
+    bool contents_copied = false;   // the SSTs were copied into place by copy_contents
+};
+
+// the files in manifest order (sorted by name)
+vector<const file_entry*> sorted_files(const layout& plan) {
+    vector<const file_entry*> sorted;
+    for (auto& it : plan.files) {
+        sorted.push_back(&it);
+    }
+    sort(sorted.begin(), sorted.end(), [](const file_entry* a, const file_entry* b) { return a->name < b->name; });
+    return sorted;
+}
+
+// encode the ROC1 manifest entries of sorted[from, to), and their names
+void encode_entries(const vector<const file_entry*>& sorted, size_t from, size_t to, string& entries, string& names) {
+    using namespace RocksWormFormat;
+    entries.assign((to-from)*kEntrySize, 0);
+    names.clear();
+    for (size_t i = from; i < to; i++) {
+        Entry e;
+        e.offset = sorted[i]->offset;
+        e.size = sorted[i]->size;
+        e.name_offset = names.size();
+        e.name_size = sorted[i]->name.size();
+        e.crc32c = sorted[i]->crc32c;
+        e.object = sorted[i]->object;
+        e.EncodeTo(&entries[(i-from)*kEntrySize]);
+        names += sorted[i]->name;
+    }
+}
+
+// The inline files (those needed to open the database) go last, unaligned,
+// so that they immediately precede the manifest; readers can then fetch them
+// in the same request. The metadata region, if any, goes just before them,
+// and the manifest pages, if any, before that. If striped, the other files
+// go into the stripes instead, each into the one with the least data so far.
+// Files in the base stay where they are.
+void plan_layout(layout& plan) {
+    auto first_inline = stable_partition(plan.files.begin(), plan.files.end(),
+                                         [](const file_entry& it) { return !it.inline_; });
+    uint64_t pos = 0;
+    for (auto& it : plan.stripes) {
+        it.size = 0;
+    }
+    for (auto it = plan.files.begin(); it != first_inline; it++) {
+        if (it->in_base) {
+            it->object = plan.stripes.size() + 1 + it->base_object;
+            continue;
+        }
+        uint64_t *end = &pos;
+        if (plan.stripes.size()) {
+            auto least = min_element(plan.stripes.begin(), plan.stripes.end(),
+                                     [](const stripe& a, const stripe& b) { return a.size < b.size; });
+            it->object = least - plan.stripes.begin() + 1;
+            end = &least->size;
+        }
+        *end = (*end + plan.alignment - 1) / plan.alignment * plan.alignment;
+        it->offset = *end;
+        *end += it->size;
+    }
+    plan.pages_offset = pos;
+    if (plan.manifest_page) {
+        for (auto& it : plan.files) {
+            pos += RocksWormFormat::kEntrySize + it.name.size();
+        }
+    }
+    plan.pages_size = pos - plan.pages_offset;
+    plan.metadata_offset = pos;
+    for (auto it = plan.files.begin(); it != first_inline; it++) {
+        if (it->packed) {
+            it->metadata_copy = pos;
+            pos += it->size - it->metadata_offset;
+        }
+    }
+    plan.metadata_size = pos - plan.metadata_offset;
+    plan.inline_offset = pos;
+    for (auto it = first_inline; it != plan.files.end(); it++) {
+        it->offset = pos;
+        pos += it->size;
+    }
+    plan.contents_size = pos;
+}
+
 int file_size(const string& dn, const string& fn, size_t& ans) {
     struct stat st;
     string fp = dn + "/" + fn;
@@ -66,40 +312,19 @@ bool findMANIFEST(const string& dbpath, string& ans) {
     return !current.fail() && !current.bad() && ans.size() > 0;
 }
 
-int emit(const string& dbpath, const vector<file_entry>& manifest, ostream& dest) {
-    // emit the file contents
-    const size_t bufsize = 1048576;
-    unique_ptr<char[]> buf(new char[bufsize]);
-    for (auto it : manifest) {
-        uint64_t ct = 0;
-        ifstream src;
-        src.open(dbpath + "/" + it.name);
-        if (!src.is_open()) {
-            cerr << "Error: couldn't open " << it.name << " for writing" << endl;
-            return 1;
-        }
-        while (src.good()) {
-            src.read(buf.get(),bufsize);
-            if (src.bad() || (src.fail() && !src.eof())) {
-                cerr << "Error while reading " << it.name << endl;
-                return 1;
-            }
-            dest.write(buf.get(),src.gcount());
-            if (!dest.good()) {
-                cerr << "Error while writing " << it.name << " to destination" << endl;
-                return 1;
-            }
-            ct += src.gcount();
-        }
-        if (ct != it.size) {
-            cerr << "Error: read " << ct << " instead of the expected " << it.size << " bytes from" << it.name << endl;
-            return 1;
-        }
+int write_or_fail(ostream& dest, const char *data, size_t n, uint64_t& pos, const string& what) {
+    dest.write(data, n);
+    if (!dest.good()) {
+        cerr << "Error while writing " << what << " to destination" << endl;
+        return 1;
     }
+    pos += n;
+    return 0;
+}
 
-    // emit the manifest
+int emit_roc0_manifest(const layout& plan, ostream& dest, uint64_t& pos) {
     uint64_t manifest_sz = 0;
-    for (auto it : manifest) {
+    for (auto& it : plan.files) {
         uint64_t sz = it.size;
         dest.write(reinterpret_cast<char*>(&sz),8);
         manifest_sz += 8;
@@ -111,6 +336,525 @@ int emit(const string& dbpath, const vector<file_entry>& manifest, ostream& dest
     }
     dest.write(reinterpret_cast<char*>(&manifest_sz),8);
     dest << "ROC0";
+    pos += manifest_sz + 12;
+    return 0;
+}
+
+int emit_roc1_trailer(const layout& plan, ostream& dest, uint64_t& pos) {
+    using namespace RocksWormFormat;
+    assert(pos == plan.contents_size);
+
+    vector<const file_entry*> sorted = sorted_files(plan);
+
+    Footer footer;
+    footer.alignment = plan.alignment;
+    footer.file_count = plan.files.size();
+    footer.sections[kInlineSection].offset = plan.inline_offset;
+    footer.sections[kInlineSection].size = plan.contents_size - plan.inline_offset;
+    footer.sections[kInlineSection].crc32c = plan.inline_crc32c;
+    if (plan.manifest_page) {
+        // the pages were written by emit_manifest_pages
+        footer.flags |= kFlagPagedManifest;
+        footer.sections[kManifestSection].offset = plan.pages_offset;
+        footer.sections[kManifestSection].size = plan.pages_size;
+        footer.sections[kManifestSection].crc32c = plan.pages_crc32c;
+        const string& directory = plan.manifest_directory;
+        footer.sections[kManifestDirectorySection].offset = pos;
+        footer.sections[kManifestDirectorySection].size = directory.size();
+        footer.sections[kManifestDirectorySection].crc32c = crc32c::Value(directory.data(), directory.size());
+        if (write_or_fail(dest, directory.data(), directory.size(), pos, "manifest directory")) return 1;
+    } else {
+        // manifest entries sorted by name, and the names
+        string manifest, names;
+        encode_entries(sorted, 0, sorted.size(), manifest, names);
+        footer.sections[kManifestSection].offset = pos;
+        footer.sections[kManifestSection].size = manifest.size();
+        footer.sections[kManifestSection].crc32c = crc32c::Value(manifest.data(), manifest.size());
+        if (write_or_fail(dest, manifest.data(), manifest.size(), pos, "manifest")) return 1;
+        footer.sections[kNamesSection].offset = pos;
+        footer.sections[kNamesSection].size = names.size();
+        footer.sections[kNamesSection].crc32c = crc32c::Value(names.data(), names.size());
+        if (write_or_fail(dest, names.data(), names.size(), pos, "manifest")) return 1;
+    }
+
+    // metadata map, in the order of the copies
+    if (plan.metadata_size) {
+        map<const file_entry*, uint64_t> index;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            index[sorted[i]] = i;
+        }
+        string mappings;
+        for (auto& it : plan.files) {
+            if (!it.packed) continue;
+            Mapping m;
+            m.entry = index[&it];
+            m.file_offset = it.metadata_offset;
+            m.copy_offset = it.metadata_copy;
+            char buf[kMappingSize];
+            m.EncodeTo(buf);
+            mappings.append(buf, kMappingSize);
+        }
+        footer.sections[kMetadataSection].offset = plan.metadata_offset;
+        footer.sections[kMetadataSection].size = plan.metadata_size;
+        footer.sections[kMetadataSection].crc32c = plan.metadata_crc32c;
+        footer.sections[kMetadataMapSection].offset = pos;
+        footer.sections[kMetadataMapSection].size = mappings.size();
+        footer.sections[kMetadataMapSection].crc32c = crc32c::Value(mappings.data(), mappings.size());
+        if (write_or_fail(dest, mappings.data(), mappings.size(), pos, "metadata map")) return 1;
+    }
+
+    if (plan.index_stride) {
+        map<const file_entry*, uint64_t> index;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            index[sorted[i]] = i;
+        }
+        string global_index;
+        char buf[8];
+        auto append32 = [&](uint32_t v) { EncodeFixed32(buf, v); global_index.append(buf, 4); };
+        auto append64 = [&](uint64_t v) { EncodeFixed64(buf, v); global_index.append(buf, 8); };
+        for (auto& it : plan.files) {
+            if (it.index_groups.empty()) continue;
+            append64(index[&it]);
+            append32(it.smallest_key.size());
+            global_index += it.smallest_key;
+            append32(it.index_groups.size());
+            for (auto& group : it.index_groups) {
+                append32(group.largest.size());
+                global_index += group.largest;
+                append64(group.offset);
+                append32(group.block_sizes.size());
+                for (uint32_t block_size : group.block_sizes) {
+                    append32(block_size);
+                }
+            }
+        }
+        footer.sections[kGlobalIndexSection].offset = pos;
+        footer.sections[kGlobalIndexSection].size = global_index.size();
+        footer.sections[kGlobalIndexSection].crc32c = crc32c::Value(global_index.data(), global_index.size());
+        if (write_or_fail(dest, global_index.data(), global_index.size(), pos, "global index")) return 1;
+    }
+
+    if (plan.stripes.size() || plan.bases.size()) {
+        string objects;
+        char buf[kObjectSize];
+        auto add_object = [&](const stripe& it) {
+            EncodeFixed64(buf, it.size);
+            EncodeFixed32(buf+8, it.crc32c);
+            EncodeFixed32(buf+12, it.name.size());
+            objects.append(buf, kObjectSize);
+            objects += it.name;
+        };
+        for (auto& it : plan.stripes) {
+            add_object(it);
+        }
+        for (auto& it : plan.bases) {
+            add_object(it);
+            EncodeFixed32(buf, it.etag.size());
+            objects.append(buf, 4);
+            objects += it.etag;
+        }
+        footer.sections[kObjectsSection].offset = pos;
+        footer.sections[kObjectsSection].size = objects.size();
+        footer.sections[kObjectsSection].crc32c = crc32c::Value(objects.data(), objects.size());
+        if (write_or_fail(dest, objects.data(), objects.size(), pos, "objects")) return 1;
+    }
+
+    if (plan.global_filter.size()) {
+        footer.sections[kGlobalFilterSection].offset = pos;
+        footer.sections[kGlobalFilterSection].size = plan.global_filter.size();
+        footer.sections[kGlobalFilterSection].crc32c = crc32c::Value(plan.global_filter.data(), plan.global_filter.size());
+        if (write_or_fail(dest, plan.global_filter.data(), plan.global_filter.size(), pos, "global filter")) return 1;
+    }
+
+    char buf[kFooterSize];
+    footer.EncodeTo(buf);
+    return write_or_fail(dest, buf, kFooterSize, pos, "footer");
+}
+
+// Read the SST's index block and group its data blocks for the global index
+int index_sst(const string& dbpath, file_entry& it, unsigned int stride) {
+    using namespace SSTBlocks;
+    ifstream src;
+    src.open(dbpath + "/" + it.name);
+    if (!src.is_open()) {
+        cerr << "Error: couldn't open " << it.name << " for reading" << endl;
+        return 1;
+    }
+    auto read_block = [&](const BlockHandle& handle, string& contents) -> bool {
+        string raw(handle.size + kBlockTrailerSize, 0);
+        src.seekg(handle.offset);
+        src.read(&raw[0], raw.size());
+        if (src.gcount() != raw.size()) return false;
+        bool unsupported;
+        if (!UncompressBlock(raw.data(), raw.size(), contents, unsupported)) {
+            if (unsupported) {
+                cerr << "Error: --global-index supports only Snappy-compressed or uncompressed index blocks" << endl;
+            }
+            return false;
+        }
+        return true;
+    };
+
+    string footer(min(uint64_t(kFooterSize), it.size), 0), contents;
+    BlockHandle metaindex, index;
+    src.seekg(it.size - footer.size());
+    src.read(&footer[0], footer.size());
+    if (src.gcount() != footer.size() || !DecodeFooter(footer.data(), footer.size(), metaindex, index)
+        || !read_block(metaindex, contents)) {
+        cerr << "Error: couldn't read the footer or metaindex of " << it.name << endl;
+        return 1;
+    }
+
+    // range deletions would invalidate lookups using the global index
+    BlockIter meta(contents);
+    while (meta.Next()) {
+        if (meta.key() == "rocksdb.range_del") {
+            cerr << "Error: --global-index doesn't support range deletions (in " << it.name << ")" << endl;
+            return 1;
+        }
+    }
+
+    if (!read_block(index, contents)) {
+        cerr << "Error: couldn't read the index block of " << it.name << endl;
+        return 1;
+    }
+    BlockIter entries(contents);
+    uint64_t next_offset = 0;
+    bool corrupt = false;
+    while (!corrupt && entries.Next()) {
+        const char *p = entries.value().data();
+        BlockHandle handle;
+        rocksdb::Slice user_key;
+        uint64_t sequence;
+        unsigned char type;
+        if (!handle.DecodeFrom(p, p+entries.value().size()) || handle.size > 0xffffffffULL
+            || !ParseInternalKey(entries.key(), user_key, sequence, type)) {
+            corrupt = true;
+            continue;
+        }
+        if (it.index_groups.empty() || it.index_groups.back().block_sizes.size() >= stride
+            || handle.offset != next_offset) {
+            it.index_groups.push_back(index_group{"", handle.offset, {}});
+        }
+        it.index_groups.back().largest = user_key.ToString();
+        it.index_groups.back().block_sizes.push_back(handle.size);
+        next_offset = handle.offset + handle.size + kBlockTrailerSize;
+    }
+    if (corrupt || entries.corrupt()) {
+        cerr << "Error: couldn't decode the index block of " << it.name << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// copy [from, from+n) of the named file to dest, extending crc (and crc2, if
+// given) with the copied bytes
+int copy_file(const string& dbpath, const string& name, uint64_t from, uint64_t n,
+              char *buf, size_t bufsize, ostream& dest, uint64_t& pos, uint32_t& crc, uint32_t *crc2) {
+    uint64_t ct = 0;
+    ifstream src;
+    src.open(dbpath + "/" + name);
+    if (!src.is_open()) {
+        cerr << "Error: couldn't open " << name << " for reading" << endl;
+        return 1;
+    }
+    src.seekg(from);
+    while (src.good() && ct < n) {
+        src.read(buf, min(uint64_t(bufsize), n-ct));
+        if (src.bad() || (src.fail() && !src.eof())) {
+            cerr << "Error while reading " << name << endl;
+            return 1;
+        }
+        crc = crc32c::Extend(crc, buf, src.gcount());
+        if (crc2) {
+            *crc2 = crc32c::Extend(*crc2, buf, src.gcount());
+        }
+        if (write_or_fail(dest, buf, src.gcount(), pos, name)) return 1;
+        ct += src.gcount();
+    }
+    if (ct != n) {
+        cerr << "Error: read " << ct << " instead of the expected " << n << " bytes from " << name << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// checksum the named file, expected to have size n
+int checksum_file(const string& dbpath, const string& name, uint64_t n, char *buf, size_t bufsize, uint32_t& crc) {
+    uint64_t ct = 0;
+    ifstream src;
+    src.open(dbpath + "/" + name);
+    if (!src.is_open()) {
+        cerr << "Error: couldn't open " << name << " for reading" << endl;
+        return 1;
+    }
+    crc = 0;
+    while (src.good() && ct < n) {
+        src.read(buf, min(uint64_t(bufsize), n-ct));
+        if (src.bad() || (src.fail() && !src.eof())) {
+            cerr << "Error while reading " << name << endl;
+            return 1;
+        }
+        crc = crc32c::Extend(crc, buf, src.gcount());
+        ct += src.gcount();
+    }
+    if (ct != n) {
+        cerr << "Error: read " << ct << " instead of the expected " << n << " bytes from " << name << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Write the manifest pages, which precede the inline files, and record the
+// directory for the trailer. The pages include the checksums of all files, so
+// the inline files are checksummed in advance (and emit verifies that they
+// haven't changed when it copies them).
+int emit_manifest_pages(const string& dbpath, layout& plan, char *buf, size_t bufsize, ostream& dest, uint64_t& pos) {
+    using namespace RocksWormFormat;
+    assert(pos == plan.pages_offset);
+    for (auto& it : plan.files) {
+        if (it.inline_ && checksum_file(dbpath, it.name, it.size, buf, bufsize, it.crc32c)) return 1;
+    }
+
+    vector<const file_entry*> sorted = sorted_files(plan);
+    plan.pages_crc32c = 0;
+    plan.manifest_directory.clear();
+    for (size_t i = 0; i < sorted.size(); i += plan.manifest_page) {
+        size_t end = min(sorted.size(), i+plan.manifest_page);
+        string entries, names;
+        encode_entries(sorted, i, end, entries, names);
+        uint32_t crc = crc32c::Extend(crc32c::Value(entries.data(), entries.size()), names.data(), names.size());
+        if (entries.size()+names.size() > 0xffffffffULL) {
+            cerr << "Error: manifest page too large" << endl;
+            return 1;
+        }
+
+        char ref[kPageRefSize];
+        EncodeFixed64(ref, pos);
+        EncodeFixed32(ref+8, entries.size()+names.size());
+        EncodeFixed32(ref+12, crc);
+        EncodeFixed32(ref+16, end-i);
+        EncodeFixed32(ref+20, sorted[end-1]->name.size());
+        plan.manifest_directory.append(ref, kPageRefSize);
+        plan.manifest_directory += sorted[end-1]->name;
+
+        plan.pages_crc32c = crc32c::Extend(plan.pages_crc32c, entries.data(), entries.size());
+        plan.pages_crc32c = crc32c::Extend(plan.pages_crc32c, names.data(), names.size());
+        if (write_or_fail(dest, entries.data(), entries.size(), pos, "manifest")) return 1;
+        if (write_or_fail(dest, names.data(), names.size(), pos, "manifest")) return 1;
+    }
+    assert(pos == plan.pages_offset + plan.pages_size);
+    return 0;
+}
+
+int emit_metadata(const string& dbpath, layout& plan, char *buf, size_t bufsize, ostream& dest, uint64_t& pos) {
+    assert(pos == plan.metadata_offset);
+    plan.metadata_crc32c = 0;
+    for (auto& it : plan.files) {
+        if (!it.packed) continue;
+        assert(pos == it.metadata_copy);
+        if (copy_file(dbpath, it.name, it.metadata_offset, it.size-it.metadata_offset,
+                      buf, bufsize, dest, pos, plan.metadata_crc32c, nullptr)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// emit the contents of the i'th stripe (object i+1) sequentially, for uploads
+int emit_stripe(const string& dbpath, layout& plan, size_t i, ostream& dest) {
+    const size_t bufsize = 1048576;
+    unique_ptr<char[]> buf(new char[bufsize]);
+    uint64_t pos = 0;
+    stripe& the_stripe = plan.stripes[i];
+    the_stripe.crc32c = 0;
+    for (auto& it : plan.files) {
+        if (it.object != i+1) continue;
+        if (it.offset > pos) {
+            string padding(it.offset-pos, 0);
+            the_stripe.crc32c = crc32c::Extend(the_stripe.crc32c, padding.data(), padding.size());
+            if (write_or_fail(dest, padding.data(), padding.size(), pos, "padding")) return 1;
+        }
+        assert(pos == it.offset);
+        it.crc32c = 0;
+        if (copy_file(dbpath, it.name, 0, it.size, buf.get(), bufsize, dest, pos, it.crc32c, &the_stripe.crc32c)) {
+            return 1;
+        }
+    }
+    assert(pos == the_stripe.size);
+    dest.flush();
+    if (!dest.good()) {
+        cerr << "Error writing stripe " << the_stripe.name << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// A piece of an SST to be copied into place by copy_contents
+struct copy_task {
+    file_entry *file;
+    uint64_t from, n;
+    uint32_t crc32c;
+};
+
+// copy [from, from+n) of src_fd to dest_fd at the same offset plus
+// dest_offset, checksumming it. Each chunk is read for the checksum and then
+// copied within the kernel by copy_file_range, falling back to writing it
+// out if the destination doesn't support that (e.g. it's on another
+// filesystem, with older kernels).
+int copy_range(int src_fd, int dest_fd, uint64_t from, uint64_t n, uint64_t dest_offset,
+               char *buf, size_t bufsize, uint32_t& crc, const string& name) {
+    bool kernel_copy = true;
+    for (uint64_t ct = 0; ct < n; ) {
+        ssize_t k = pread(src_fd, buf, min(uint64_t(bufsize), n-ct), from+ct);
+        if (k <= 0) {
+            cerr << "Error while reading " << name << endl;
+            return 1;
+        }
+        crc = crc32c::Extend(crc, buf, k);
+        for (ssize_t done = 0; done < k; ) {
+            loff_t off_in = from+ct+done, off_out = dest_offset+off_in;
+            ssize_t w = -1;
+            if (kernel_copy) {
+                w = copy_file_range(src_fd, &off_in, dest_fd, &off_out, k-done, 0);
+                if (w < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                    kernel_copy = false;
+                }
+            }
+            if (!kernel_copy) {
+                w = pwrite(dest_fd, buf+done, k-done, off_out);
+            }
+            if (w <= 0 && !(w < 0 && errno == EINTR)) {
+                cerr << "Error while writing " << name << " to destination" << endl;
+                return 1;
+            }
+            if (w > 0) done += w;
+        }
+        ct += k;
+    }
+    return 0;
+}
+
+// Copy the SSTs into place, at their planned offsets within the objects
+// (dest_fds[i] being object i), using the given number of threads. Large SSTs
+// are divided into pieces, whose checksums are then combined.
+int copy_contents(const string& dbpath, layout& plan, const vector<int>& dest_fds, unsigned int threads) {
+    const uint64_t piece_size = 67108864;
+    const size_t bufsize = 1048576;
+    vector<copy_task> tasks;
+    for (auto& it : plan.files) {
+        if (it.inline_ || it.in_base) continue;
+        uint64_t from = 0;
+        do {
+            tasks.push_back(copy_task{&it, from, min(piece_size, it.size-from), 0});
+            from += piece_size;
+        } while (from < it.size);
+    }
+
+    atomic<size_t> next_task(0);
+    atomic<bool> failed(false);
+    auto worker = [&]() {
+        unique_ptr<char[]> buf(new char[bufsize]);
+        size_t i;
+        while (!failed && (i = next_task++) < tasks.size()) {
+            copy_task& task = tasks[i];
+            const file_entry& it = *task.file;
+            int src_fd = open((dbpath + "/" + it.name).c_str(), O_RDONLY);
+            if (src_fd < 0) {
+                cerr << "Error: couldn't open " << it.name << " for reading" << endl;
+                failed = true;
+                break;
+            }
+            posix_fadvise(src_fd, task.from, task.n, POSIX_FADV_SEQUENTIAL);
+            if (copy_range(src_fd, dest_fds[it.object], task.from, task.n, it.offset,
+                           buf.get(), bufsize, task.crc32c, it.name)) {
+                failed = true;
+            }
+            close(src_fd);
+        }
+    };
+    vector<thread> workers;
+    for (unsigned int i = 1; i < threads && i < tasks.size(); i++) {
+        workers.push_back(thread(worker));
+    }
+    worker();
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (failed) return 1;
+
+    // combine the checksums of the pieces of each file, and of the files
+    // (and the padding between them) of each stripe
+    for (auto& it : plan.files) {
+        if (!it.inline_ && !it.in_base) it.crc32c = 0;
+    }
+    for (auto& task : tasks) {
+        task.file->crc32c = crc32c::Combine(task.file->crc32c, task.crc32c, task.n);
+    }
+    vector<uint64_t> stripe_pos(plan.stripes.size(), 0);
+    for (auto& it : plan.stripes) {
+        it.crc32c = 0;
+    }
+    for (auto& it : plan.files) {
+        if (it.object == 0 || it.in_base) continue;
+        stripe& the_stripe = plan.stripes[it.object-1];
+        uint64_t& pos = stripe_pos[it.object-1];
+        assert(it.offset >= pos);
+        string padding(it.offset-pos, 0);
+        the_stripe.crc32c = crc32c::Extend(the_stripe.crc32c, padding.data(), padding.size());
+        the_stripe.crc32c = crc32c::Combine(the_stripe.crc32c, it.crc32c, it.size);
+        pos = it.offset + it.size;
+    }
+    plan.contents_copied = true;
+    return 0;
+}
+
+int emit(const string& dbpath, layout& plan, ostream& dest) {
+    // emit the file contents, at the planned offsets, and the manifest pages
+    // and metadata region before the inline files
+    const size_t bufsize = 1048576;
+    unique_ptr<char[]> buf(new char[bufsize]);
+    uint64_t pos = 0;
+    bool metadata_done = false;
+    plan.inline_crc32c = 0;
+    auto emit_before_inline = [&]() {
+        if (plan.manifest_page && emit_manifest_pages(dbpath, plan, buf.get(), bufsize, dest, pos)) return 1;
+        return emit_metadata(dbpath, plan, buf.get(), bufsize, dest, pos);
+    };
+    for (auto& it : plan.files) {
+        if (it.object) continue;
+        if (it.inline_ && !metadata_done) {
+            if (emit_before_inline()) return 1;
+            metadata_done = true;
+        }
+        if (plan.contents_copied && !it.inline_) {
+            // already in place; skip over it
+            pos = it.offset + it.size;
+            dest.seekp(pos);
+            continue;
+        }
+        if (it.offset > pos) {
+            string padding(it.offset-pos, 0);
+            if (write_or_fail(dest, padding.data(), padding.size(), pos, "padding")) return 1;
+        }
+        assert(pos == it.offset);
+
+        uint32_t expected = it.crc32c;
+        it.crc32c = 0;
+        if (copy_file(dbpath, it.name, 0, it.size, buf.get(), bufsize, dest, pos,
+                      it.crc32c, it.inline_ ? &plan.inline_crc32c : nullptr)) {
+            return 1;
+        }
+        if (it.inline_ && plan.manifest_page && it.crc32c != expected) {
+            cerr << "Error: " << it.name << " changed while writing" << endl;
+            return 1;
+        }
+    }
+    if (!metadata_done && emit_before_inline()) return 1;
+
+    // emit the manifest
+    int ret = plan.format == 0 ? emit_roc0_manifest(plan, dest, pos) : emit_roc1_trailer(plan, dest, pos);
+    if (ret) return ret;
     dest.flush();
     if (!dest.good()) {
         cerr << "Error writing trailing manifest to destination" << endl;
@@ -120,6 +864,355 @@ int emit(const string& dbpath, const vector<file_entry>& manifest, ostream& dest
     return 0;
 }
 
+// Stream the stripes and then the RocksWorm file to their URLs, as multipart
+// uploads; the RocksWorm file goes last, so that once it appears, so have the
+// stripes it refers to.
+int upload(const string& dbpath, layout& plan, const string& url, const string& stripe_url_prefix,
+           HTTPUploadOptions opts) {
+    auto t0 = chrono::steady_clock::now();
+    uint64_t largest = plan.contents_size;
+    for (auto& it : plan.stripes) {
+        largest = max(largest, it.size);
+    }
+    // raise the part size to a whole number of MiB keeping within 10,000
+    // parts, allowing for the trailer
+    const uint64_t max_parts = 10000;
+    if ((largest + (64 << 20)) / opts.part_size >= max_parts) {
+        opts.part_size = ((largest + (64 << 20)) / (max_parts-1) / 1048576 + 1) * 1048576;
+    }
+    HTTP::CURLpool connpool(opts.parallel_parts + 1);
+    opts.connpool = &connpool;
+
+    uint64_t total = 0;
+    for (size_t i = 0; i <= plan.stripes.size(); i++) {
+        // the stripes, then the RocksWorm file
+        bool roc = i == plan.stripes.size();
+        string object_url = roc ? url : stripe_url_prefix + plan.stripes[i].name;
+        HTTPMultipartUpload up(object_url, opts);
+        Status s = up.Begin();
+        if (!s.ok()) {
+            cerr << "Error initiating upload: " << s.ToString() << endl;
+            return 1;
+        }
+        ostream dest(&up);
+        if (roc ? emit(dbpath, plan, dest) : emit_stripe(dbpath, plan, i, dest)) {
+            if (!up.status().ok()) {
+                cerr << "Error uploading " << object_url.substr(0, object_url.find('?')) << ": " << up.status().ToString() << endl;
+            }
+            up.Abort();
+            return 1;
+        }
+        s = up.Finish();
+        if (!s.ok()) {
+            cerr << "Error completing upload: " << s.ToString() << endl;
+            return 1;
+        }
+        total += up.size();
+    }
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cerr << "Uploaded " << plan.files.size() << " files, " << total/1048576.0 << " MiB in "
+         << plan.stripes.size()+1 << " object(s), in " << secs << "s ("
+         << total/1048576.0/max(secs, 1e-6) << " MiB/s, " << opts.part_size/1048576 << " MiB parts, "
+         << opts.parallel_parts << " at once)" << endl;
+    return 0;
+}
+
+// A scratch directory, removed (with its contents, to one level of
+// subdirectories) when this goes out of scope
+struct scratch_dir {
+    string path;
+    explicit scratch_dir(const string& path_) : path(path_) {}
+    ~scratch_dir() {
+        for (string sub : {"/db", "/sst", ""}) {
+            string dn = path + sub;
+            DIR *dir = opendir(dn.c_str());
+            if (dir == nullptr) continue;
+            while (struct dirent *ent = readdir(dir)) {
+                if (ent->d_type != DT_DIR) unlink((dn + "/" + ent->d_name).c_str());
+            }
+            closedir(dir);
+            rmdir(dn.c_str());
+        }
+    }
+};
+
+// Rewrite the database into a fresh one at dir/db, with HTTPTableOptions and
+// all the keys in one level (the bottommost, where lookups
+// binary-search the SSTs by key range). The key space is divided among the
+// threads at SST boundaries, balancing the bytes each reads; each thread
+// writes its range into SSTs with SstFileWriter, which the new database then
+// ingests. The SSTs are sized to total/4 per thread, within 64 MiB to 1 GiB:
+// large enough that there are few tables to open, but enough of them to
+// build (and spread among stripes) in parallel.
+int optimize(DB *db, const vector<LiveFileMetaData>& md, const string& dir, bool partitioned,
+             unsigned int threads) {
+    auto t0 = chrono::steady_clock::now();
+    uint64_t total = 0;
+    vector<pair<string,uint64_t>> boundaries;
+    for (auto& it : md) {
+        if (it.column_family_name != kDefaultColumnFamilyName) {
+            cerr << "Error: --optimize supports only the default column family" << endl;
+            return 1;
+        }
+        boundaries.push_back(make_pair(it.smallestkey, it.size));
+        total += it.size;
+    }
+    sort(boundaries.begin(), boundaries.end());
+    const uint64_t target_file_size = max(uint64_t(64) << 20, min(uint64_t(1) << 30, total / (4*threads)));
+
+    // each range begins at the smallest key of an SST, once the preceding
+    // ranges cover their share of the bytes
+    vector<string> lower_bounds = {""};
+    uint64_t covered = 0;
+    for (auto& it : boundaries) {
+        if (covered >= total * lower_bounds.size() / threads && it.first > lower_bounds.back()) {
+            lower_bounds.push_back(it.first);
+        }
+        covered += it.second;
+    }
+
+    Options sstopts;
+    sstopts.table_factory.reset(NewBlockBasedTableFactory(HTTPTableOptions(partitioned)));
+    if (mkdir((dir + "/sst").c_str(), 0755)) {
+        cerr << "Error: couldn't create " << dir << "/sst" << endl;
+        return 1;
+    }
+    vector<vector<string>> ssts(lower_bounds.size());
+    atomic<uint64_t> entries(0);
+    atomic<bool> failed(false);
+    auto build = [&](size_t i) {
+        ReadOptions rdopts;
+        rdopts.fill_cache = false;
+        rdopts.readahead_size = 4194304;
+        Slice upper_bound;
+        if (i+1 < lower_bounds.size()) {
+            upper_bound = lower_bounds[i+1];
+            rdopts.iterate_upper_bound = &upper_bound;
+        }
+        unique_ptr<Iterator> it(db->NewIterator(rdopts));
+        unique_ptr<SstFileWriter> writer;
+        Status s;
+        auto finish = [&]() {
+            s = writer->Finish();
+            writer.reset();
+        };
+        for (i ? it->Seek(lower_bounds[i]) : it->SeekToFirst(); !failed && s.ok() && it->Valid(); it->Next()) {
+            if (!writer) {
+                ssts[i].push_back(dir + "/sst/" + to_string(i) + "-" + to_string(ssts[i].size()) + ".sst");
+                writer.reset(new SstFileWriter(EnvOptions(), sstopts));
+                s = writer->Open(ssts[i].back());
+                if (!s.ok()) break;
+            }
+            s = writer->Put(it->key(), it->value());
+            entries++;
+            if (s.ok() && writer->FileSize() >= target_file_size) {
+                finish();
+            }
+        }
+        if (s.ok()) s = it->status();
+        if (s.ok() && writer) finish();
+        if (!s.ok()) {
+            cerr << "Error while optimizing database: " << s.ToString() << endl;
+            failed = true;
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < lower_bounds.size(); i++) {
+        workers.push_back(thread(build, i));
+    }
+    build(0);
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (failed) return 1;
+
+    // ingest the SSTs into a new database; since they don't overlap, they
+    // all go into the bottommost level
+    vector<string> all_ssts;
+    for (auto& it : ssts) {
+        all_ssts.insert(all_ssts.end(), it.begin(), it.end());
+    }
+    Options dbopts = sstopts;
+    dbopts.create_if_missing = true;
+    dbopts.error_if_exists = true;
+    dbopts.disable_auto_compactions = true;
+    DB *rawdb = nullptr;
+    Status s = DB::Open(dbopts, dir + "/db", &rawdb);
+    if (s.ok() && all_ssts.size()) {
+        IngestExternalFileOptions ingestopts;
+        ingestopts.move_files = true;
+        s = rawdb->IngestExternalFile(all_ssts, ingestopts);
+    }
+    delete rawdb;
+    if (!s.ok()) {
+        cerr << "Error creating optimized database: " << s.ToString() << endl;
+        return 1;
+    }
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cerr << "Optimized " << entries << " entries into " << all_ssts.size() << " SSTs of up to "
+         << target_file_size/1048576 << " MiB, in " << secs << "s ("
+         << lower_bounds.size() << " threads)" << endl;
+    return 0;
+}
+
+// Build the database at dir/db from the key/value records in the file at path
+// ("-" for standard input), in the given format (see usage). If unsorted, the
+// records are sorted in runs using sort_buffer bytes of memory in all.
+int bulk_load(const string& path, const string& format, bool sorted, uint64_t sort_buffer, const string& dir,
+              bool partitioned, unsigned int threads) {
+    auto t0 = chrono::steady_clock::now();
+    ifstream file;
+    istream *in = &cin;
+    if (path != "-") {
+        file.open(path, ios::binary);
+        if (!file.is_open()) {
+            cerr << "Error: couldn't open " << path << " for reading" << endl;
+            return 1;
+        }
+        in = &file;
+    } else {
+        ios::sync_with_stdio(false);
+    }
+
+    BulkLoaderOptions opts;
+    opts.table_options = HTTPTableOptions(partitioned);
+    opts.threads = threads;
+    opts.sorted = sorted;
+    // the loader holds a run being filled, plus one being sorted and written
+    // by each thread
+    opts.sort_buffer_size = max(sort_buffer / (threads+1), uint64_t(1));
+    opts.scratch_dir = dir + "/sst";
+    BulkLoader loader(dir + "/db", opts);
+    Status s;
+    uint64_t records = 0;
+    if (format == "tsv") {
+        string line;
+        while (s.ok() && getline(*in, line)) {
+            records++;
+            size_t tab = line.find('\t');
+            if (tab == string::npos) {
+                cerr << "Error: no tab on line " << records << " of " << path << endl;
+                return 1;
+            }
+            s = loader.Add(Slice(line.data(), tab), Slice(line.data()+tab+1, line.size()-tab-1));
+        }
+    } else {
+        string key, value;
+        char n[8];
+        while (s.ok() && in->read(n, sizeof(n))) {
+            key.resize(RocksWormFormat::DecodeFixed32(n));
+            value.resize(RocksWormFormat::DecodeFixed32(n+4));
+            if (!in->read(&key[0], key.size()) || !in->read(&value[0], value.size())) {
+                cerr << "Error: truncated record " << records+1 << " in " << path << endl;
+                return 1;
+            }
+            records++;
+            s = loader.Add(key, value);
+        }
+        if (s.ok() && in->gcount()) {
+            cerr << "Error: truncated record " << records+1 << " in " << path << endl;
+            return 1;
+        }
+    }
+    if (s.ok() && in->bad()) {
+        cerr << "Error while reading " << path << endl;
+        return 1;
+    }
+    if (s.ok()) {
+        s = loader.Finish();
+    }
+    if (!s.ok()) {
+        cerr << "Error while bulk loading: " << s.ToString() << endl;
+        return 1;
+    }
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cerr << "Loaded " << records << " records (" << loader.entries() << " keys) into "
+         << loader.ssts() << " SSTs, in " << secs << "s (" << records/max(secs, 1e-6) << " records/s)" << endl;
+    return 0;
+}
+
+// Get the ETag of an object of the base, for the delta to record. The object
+// mustn't have changed size since the base was made.
+int base_etag(const string& url, uint64_t size, string& etag) {
+    long response_code = -1;
+    HTTP::headers response_headers;
+    CURLcode c = HTTP::HEAD(url, HTTP::headers(), response_code, response_headers);
+    if (c != CURLE_OK || response_code < 200 || response_code >= 300) {
+        cerr << "Error: couldn't HEAD base object " << url << " (";
+        if (c != CURLE_OK) cerr << curl_easy_strerror(c);
+        else cerr << "HTTP " << response_code;
+        cerr << ")" << endl;
+        return 1;
+    }
+    auto content_length = response_headers.find("content-length");
+    if (content_length == response_headers.end() || strtoull(content_length->second.c_str(), nullptr, 10) != size) {
+        cerr << "Error: base object " << url << " isn't the size the base records" << endl;
+        return 1;
+    }
+    auto it = response_headers.find("etag");
+    etag = it != response_headers.end() ? it->second : "";
+    if (etag.empty()) {
+        cerr << "Warning: base object " << url << " lacks an ETag, so readers of the delta can check only its size" << endl;
+    }
+    return 0;
+}
+
+// Find the SSTs already in the base, the prior RocksWorm file at base_url: those
+// with the same name, size and checksum, which are then referred to where they
+// lie within its objects instead of being included (and needn't be read
+// again). The base may itself be a delta; its files are located wherever they
+// lie.
+int share_with_base(const string& dbpath, layout& plan, const string& base_url) {
+    RocksWormDeltaHTTPEnv env(base_url, HTTPEnvOptions());
+    const size_t bufsize = 1048576;
+    unique_ptr<char[]> buf(new char[bufsize]);
+    map<string, uint32_t> base_objects;
+    size_t shared = 0;
+    uint64_t shared_bytes = 0;
+    for (auto& it : plan.files) {
+        if (it.inline_) continue;
+        RocksWormFileLocation loc;
+        Status s = env.LocateFile("/" + it.name, loc);
+        if (s.IsNotFound()) continue;
+        if (!s.ok()) {
+            cerr << "Error reading base " << base_url << ": " << s.ToString() << endl;
+            return 1;
+        }
+        uint32_t crc;
+        if (!loc.has_crc32c || loc.size != it.size
+            || checksum_file(dbpath, it.name, it.size, buf.get(), bufsize, crc) || crc != loc.crc32c) {
+            continue;
+        }
+        auto object = base_objects.find(loc.object_url);
+        if (object == base_objects.end()) {
+            // the delta records the object's URL for all its readers, so it
+            // mustn't carry credentials, such as a presigned URL's query string
+            size_t query = loc.object_url.find('?');
+            if (query != string::npos) {
+                cerr << "Error: the URL of base object " << loc.object_url.substr(0, query)
+                     << " has a query string, which the delta would record" << endl;
+                return 1;
+            }
+            string etag;
+            if (base_etag(loc.object_url, loc.object_size, etag)) return 1;
+            object = base_objects.insert(make_pair(loc.object_url, plan.bases.size())).first;
+            plan.bases.push_back(stripe{loc.object_url, loc.object_size, 0, etag});
+        }
+        it.in_base = true;
+        it.base_object = object->second;
+        it.offset = loc.offset;
+        it.crc32c = crc;
+        shared++;
+        shared_bytes += it.size;
+    }
+    cerr << "Found " << shared << " SSTs, " << shared_bytes/1048576.0 << " MiB in "
+         << plan.bases.size() << " object(s) of the base" << endl;
+    return 0;
+}
+
 int main(int argc, char** argv) {
     if (IS_BIG_ENDIAN) {
         // FIXME
@@ -132,15 +1225,223 @@ int main(int argc, char** argv) {
     Options dbopts;
     ReadOptions rdopts;
 
+    layout plan;
+    static struct option long_options[] = {
+        {"format", required_argument, 0, 'f'},
+        {"align", required_argument, 0, 'a'},
+        {"pack-metadata", no_argument, 0, 'p'},
+        {"global-filter", required_argument, 0, 'g'},
+        {"global-index", required_argument, 0, 'i'},
+        {"manifest-page", required_argument, 0, 'm'},
+        {"stripes", required_argument, 0, 's'},
+        {"threads", required_argument, 0, 't'},
+        {"upload", required_argument, 0, 'u'},
+        {"upload-parts", required_argument, 0, 'U'},
+        {"part-size", required_argument, 0, 'P'},
+        {"optimize", no_argument, 0, 'o'},
+        {"bulk-load", required_argument, 0, 'b'},
+        {"unsorted", no_argument, 0, 'n'},
+        {"sort-buffer", required_argument, 0, 'S'},
+        {"base", required_argument, 0, 'B'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    bool align_given = false;
+    unsigned int stripes = 0;
+    unsigned int threads = max(1U, thread::hardware_concurrency());
+    string upload_url;
+    HTTPUploadOptions upload_opts;
+    bool optimize_db = false;
+    string bulk_format;
+    bool unsorted = false;
+    uint64_t sort_buffer = 1ULL << 30;
+    bool sort_buffer_given = false;
+    string base_url;
+    int c;
+    while ((c = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+        switch (c) {
+            case 'f':
+                plan.format = strtoul(optarg, nullptr, 10);
+                if (plan.format > 1) {
+                    cerr << "Error: unknown RocksWorm format " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'a':
+                plan.alignment = strtoull(optarg, nullptr, 10);
+                if (plan.alignment == 0 || plan.alignment > 0xffffffffULL) {
+                    cerr << "Error: invalid alignment " << optarg << endl;
+                    return 1;
+                }
+                align_given = true;
+                break;
+            case 'p':
+                plan.pack_metadata = true;
+                break;
+            case 'g':
+                plan.filter_bits_per_key = strtoul(optarg, nullptr, 10);
+                if (plan.filter_bits_per_key == 0 || plan.filter_bits_per_key > 64) {
+                    cerr << "Error: invalid filter bits per key " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'i':
+                plan.index_stride = strtoul(optarg, nullptr, 10);
+                if (plan.index_stride == 0) {
+                    cerr << "Error: invalid global index stride " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'm':
+                plan.manifest_page = strtoul(optarg, nullptr, 10);
+                if (plan.manifest_page == 0) {
+                    cerr << "Error: invalid manifest page size " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 's':
+                stripes = strtoul(optarg, nullptr, 10);
+                if (stripes == 0 || stripes > 1024) {
+                    cerr << "Error: invalid number of stripes " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 't':
+                threads = strtoul(optarg, nullptr, 10);
+                if (threads == 0 || threads > 1024) {
+                    cerr << "Error: invalid number of threads " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'u':
+                upload_url = optarg;
+                break;
+            case 'U':
+                upload_opts.parallel_parts = strtoul(optarg, nullptr, 10);
+                if (upload_opts.parallel_parts == 0 || upload_opts.parallel_parts > 1024) {
+                    cerr << "Error: invalid number of upload parts " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'P':
+                upload_opts.part_size = strtoull(optarg, nullptr, 10) << 20;
+                if (upload_opts.part_size < (5 << 20) || upload_opts.part_size > (5ULL << 30)) {
+                    cerr << "Error: invalid part size " << optarg << " (must be 5 to 5120 MiB)" << endl;
+                    return 1;
+                }
+                break;
+            case 'o':
+                optimize_db = true;
+                break;
+            case 'b':
+                bulk_format = optarg;
+                if (bulk_format != "tsv" && bulk_format != "binary") {
+                    cerr << "Error: unknown bulk load format " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'n':
+                unsorted = true;
+                break;
+            case 'S':
+                sort_buffer = strtoull(optarg, nullptr, 10) << 20;
+                if (sort_buffer == 0 || sort_buffer > (1ULL << 50)) {
+                    cerr << "Error: invalid sort buffer size " << optarg << endl;
+                    return 1;
+                }
+                sort_buffer_given = true;
+                break;
+            case 'B':
+                base_url = optarg;
+                if (base_url.find("://") == string::npos) {
+                    cerr << "Error: invalid base URL " << optarg << endl;
+                    return 1;
+                }
+                if (base_url.find('?') != string::npos) {
+                    cerr << "Error: the base URL has a query string, which the delta would record" << endl;
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (plan.format == 0) {
+        if (align_given && plan.alignment != 1) {
+            cerr << "Error: alignment requires RocksWorm format 1" << endl;
+            return 1;
+        }
+        if (plan.pack_metadata || plan.filter_bits_per_key || plan.index_stride || plan.manifest_page || stripes
+            || base_url.size()) {
+            cerr << "Error: --pack-metadata, --global-filter, --global-index, --manifest-page, --stripes and --base require RocksWorm format 1" << endl;
+            return 1;
+        }
+        plan.alignment = 1;
+    }
+    argc -= optind-1;
+    argv += optind-1;
+
     if (argc < 2 || *(argv[1]) == 0) {
         usage();
         return 1;
     }
+    if (bulk_format.size() && optimize_db) {
+        cerr << "Error: --bulk-load already produces an optimized database; omit --optimize" << endl;
+        return 1;
+    }
+    if (unsorted && bulk_format.empty()) {
+        cerr << "Error: --unsorted requires --bulk-load" << endl;
+        return 1;
+    }
+    if (sort_buffer_given && !unsorted) {
+        cerr << "Error: --sort-buffer requires --unsorted" << endl;
+        return 1;
+    }
+    if (upload_url.size() && argc >= 3) {
+        cerr << "Error: --upload precludes a destination path" << endl;
+        return 1;
+    }
+    if (base_url.size() && base_url == upload_url) {
+        cerr << "Error: the delta would replace the base it refers to; upload it to another URL" << endl;
+        return 1;
+    }
+    if (stripes && argc < 3 && upload_url.empty()) {
+        cerr << "Error: --stripes requires a destination path or --upload" << endl;
+        return 1;
+    }
     string dbpath(argv[1]);
     if (dbpath[dbpath.size()-1] == '/') {
         dbpath.erase(dbpath.size()-1);
     }
 
+    // --optimize and --bulk-load build a database in a scratch directory, next
+    // to the destination if any, so that the SSTs can then be copied into
+    // place within one filesystem
+    unique_ptr<scratch_dir> scratch;
+    auto make_scratch = [&]() {
+        const char *tmpdir = getenv("TMPDIR");
+        string tmpl = argc >= 3 ? string(argv[2]) + ".scratch.XXXXXX"
+                                : string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/MakeRocksWormFileFromDB.XXXXXX";
+        if (mkdtemp(&tmpl[0]) == nullptr) {
+            cerr << "Error: couldn't create scratch directory " << tmpl << endl;
+            return false;
+        }
+        scratch.reset(new scratch_dir(tmpl));
+        return true;
+    };
+    // the global index needs unpartitioned SST indexes (and makes them less
+    // important, since it locates data blocks itself)
+    bool partitioned = plan.index_stride == 0;
+
+    // with --bulk-load, build the database from the input
+    if (bulk_format.size()) {
+        if (!make_scratch() || bulk_load(dbpath, bulk_format, !unsorted, sort_buffer, scratch->path, partitioned, threads)) {
+            return 1;
+        }
+        dbpath = scratch->path + "/db";
+    }
+
     // open database
     s = rocksdb::DB::OpenForReadOnly(dbopts,dbpath,&rawdb);
     if (!s.ok()) {
@@ -161,10 +1462,67 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // with --optimize, rewrite the database into the scratch directory and
+    // convert that instead
+    if (optimize_db) {
+        if (!make_scratch()) return 1;
+        vector<LiveFileMetaData> source_md;
+        db->GetLiveFilesMetaData(&source_md);
+        if (optimize(db.get(), source_md, scratch->path, partitioned, threads)) return 1;
+        db.reset();
+        dbpath = scratch->path + "/db";
+        s = rocksdb::DB::OpenForReadOnly(dbopts,dbpath,&rawdb);
+        if (!s.ok()) {
+            cerr << "Error opening optimized database: " << s.ToString() << endl;
+            return 1;
+        }
+        db.reset(rawdb);
+    }
+
     // make a list of the files to concatenate
-    vector<file_entry> manifest;
+    vector<file_entry>& manifest = plan.files;
     vector<LiveFileMetaData> md;
     db->GetLiveFilesMetaData(&md);
+
+    // the size of each SST's data blocks, following which is its metadata,
+    // and the total number of entries
+    map<string,uint64_t> data_sizes;
+    uint64_t num_entries = 0;
+    if (plan.pack_metadata || plan.filter_bits_per_key || plan.index_stride) {
+        TablePropertiesCollection props;
+        s = db->GetPropertiesOfAllTables(&props);
+        if (!s.ok()) {
+            cerr << "Error in GetPropertiesOfAllTables: " << s.ToString() << endl;
+            return 1;
+        }
+        for (auto& it : props) {
+            if (plan.pack_metadata) {
+                data_sizes[it.first.substr(it.first.rfind('/')+1)] = it.second->data_size;
+            }
+            num_entries += it.second->num_entries;
+            if (plan.index_stride && (it.second->comparator_name != "leveldb.BytewiseComparator"
+                                      || it.second->index_partitions)) {
+                cerr << "Error: --global-index supports only bytewise-ordered SSTs with unpartitioned indexes" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // build the global filter, sized by the number of entries (an upper bound
+    // on the number of distinct keys)
+    if (plan.filter_bits_per_key) {
+        RocksWormFormat::GlobalFilterBuilder filter(num_entries, plan.filter_bits_per_key);
+        unique_ptr<Iterator> it(db->NewIterator(rdopts));
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            filter.Add(it->key().data(), it->key().size());
+        }
+        if (!it->status().ok()) {
+            cerr << "Error iterating over database: " << it->status().ToString() << endl;
+            return 1;
+        }
+        plan.global_filter = filter.Finish();
+    }
+
     for (auto it : md) {
         string fn(it.name);
         if (fn.size() > 0 && fn[0] == '/') {
@@ -172,6 +1530,15 @@ int main(int argc, char** argv) {
         }
         // TODO: ensure no additional slashes in fn
         manifest.push_back(file_entry(fn,it.size));
+        if (plan.index_stride) {
+            manifest.back().smallest_key = it.smallestkey;
+            if (index_sst(dbpath, manifest.back(), plan.index_stride)) return 1;
+        }
+        auto data_size = data_sizes.find(fn);
+        if (data_size != data_sizes.end() && data_size->second < it.size) {
+            manifest.back().packed = true;
+            manifest.back().metadata_offset = data_size->second;
+        }
     }
     vector<string> stdfiles = {"IDENTITY", "CURRENT"};
     size_t sz;
@@ -180,7 +1547,7 @@ int main(int argc, char** argv) {
             cerr << "Error: couldn't determine file size of " << it << endl;
             return 1;
         }
-        manifest.push_back(file_entry(it,sz));
+        manifest.push_back(file_entry(it,sz,true));
     }
     string fn_manifest;
     if (!findMANIFEST(dbpath,fn_manifest)) {
@@ -191,18 +1558,73 @@ int main(int argc, char** argv) {
         cerr << "Error: couldn't determine size of manifest file " << fn_manifest << endl;
         return 1;
     }
-    manifest.push_back(file_entry(fn_manifest,sz));
-    
-    // emit RocksWorm file to either destination file or standard out
-    if (argc >= 3) {
-        ofstream dest;
-        dest.open(argv[2]);
-        if (!dest.is_open()) {
-            cerr << "Error: couldn't open " << argv[2] << " for writing" << endl;
+    manifest.push_back(file_entry(fn_manifest,sz,true));
+
+    // name the stripes after the destination, with the stripe number first
+    // so that they have distinct key prefixes in object storage
+    // (or the upload URL, sans query)
+    string dest_dir, dest_name;
+    if (argc >= 3 || upload_url.size()) {
+        dest_name = upload_url.size() ? upload_url.substr(0, upload_url.find('?')) : argv[2];
+        size_t slash = dest_name.rfind('/');
+        if (slash != string::npos) {
+            dest_dir = dest_name.substr(0, slash+1);
+            dest_name.erase(0, slash+1);
+        }
+    }
+    for (unsigned int i = 1; i <= stripes; i++) {
+        plan.stripes.push_back(stripe{to_string(i) + "." + dest_name, 0, 0});
+    }
+    if (base_url.size() && share_with_base(dbpath, plan, base_url)) return 1;
+    plan_layout(plan);
+
+    // emit RocksWorm file to the upload URL, standard out, or else to the
+    // destination file (and stripes) after copying the SSTs into place
+    if (upload_url.size()) {
+        return upload(dbpath, plan, upload_url, dest_dir, upload_opts);
+    }
+    if (argc < 3) {
+        return emit(dbpath,plan,cout);
+    }
+    auto t0 = chrono::steady_clock::now();
+    ofstream dest;
+    dest.open(argv[2]);
+    if (!dest.is_open()) {
+        cerr << "Error: couldn't open " << argv[2] << " for writing" << endl;
+        return 1;
+    }
+    vector<string> object_paths = {argv[2]};
+    for (auto& it : plan.stripes) {
+        object_paths.push_back(dest_dir + it.name);
+    }
+    vector<int> dest_fds;
+    for (size_t i = 0; i < object_paths.size(); i++) {
+        int fd = open(object_paths[i].c_str(), O_WRONLY | (i ? O_CREAT | O_TRUNC : 0), 0644);
+        if (fd < 0) {
+            cerr << "Error: couldn't open " << object_paths[i] << " for writing" << endl;
             return 1;
         }
-        return emit(dbpath,manifest,dest);
-    } else {
-        return emit(dbpath,manifest,cout);
+        dest_fds.push_back(fd);
     }
+    int ret = copy_contents(dbpath, plan, dest_fds, threads);
+    for (int fd : dest_fds) {
+        if (close(fd) && !ret) {
+            cerr << "Error writing to destination" << endl;
+            ret = 1;
+        }
+    }
+    if (ret || emit(dbpath,plan,dest)) return 1;
+    dest.close();
+
+    // report throughput
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    uint64_t total = 0;
+    for (auto& path : object_paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) total += st.st_size;
+    }
+    cerr << "Wrote " << plan.files.size() << " files, " << total/1048576.0 << " MiB in "
+         << object_paths.size() << " object(s), in " << secs << "s ("
+         << total/1048576.0/max(secs, 1e-6) << " MiB/s, " << threads << " threads)" << endl;
+    return 0;
 }
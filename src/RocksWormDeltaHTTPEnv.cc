@@ -0,0 +1,101 @@
+#include "RocksWorm/RocksWormDeltaHTTPEnv.h"
+#include <stdlib.h>
+using namespace std;
+using namespace rocksdb;
+
+// remove the . and .. segments from an absolute path (RFC 3986 5.2.4)
+static string RemoveDotSegments(const string& path) {
+    vector<string> segments;
+    bool trailing_slash = false;
+    for (size_t pos = 1; pos <= path.size(); ) {
+        size_t end = min(path.find('/', pos), path.size());
+        string segment = path.substr(pos, end-pos);
+        trailing_slash = segment == "." || segment == "..";
+        if (segment == "..") {
+            if (!segments.empty()) segments.pop_back();
+        } else if (segment != ".") {
+            segments.push_back(move(segment));
+        }
+        pos = end+1;
+    }
+    string ans;
+    for (const auto& segment : segments) {
+        ans += "/" + segment;
+    }
+    if (trailing_slash || ans.empty()) ans += "/";
+    return ans;
+}
+
+string RocksWormDeltaHTTPEnv::ResolveURL(const string& base, const string& ref) {
+    if (ref.find("://") != string::npos) return ref;
+    size_t scheme = base.find("://");
+    if (scheme == string::npos) return ref;
+    if (ref.compare(0, 2, "//") == 0) return base.substr(0, scheme+1) + ref;
+
+    // end of the scheme and host, where the path begins
+    size_t origin = min(base.find_first_of("/?#", scheme+3), base.size());
+    string ans;
+    if (ref.size() && ref[0] == '/') {
+        ans = base.substr(0, origin) + ref;
+    } else {
+        size_t slash = base.rfind('/', base.find('?'));
+        ans = slash == string::npos || slash < origin ? base.substr(0, origin) + "/" + ref
+                                                      : base.substr(0, slash+1) + ref;
+    }
+    size_t path_end = min(ans.find_first_of("?#", origin), ans.size());
+    return ans.substr(0, origin) + RemoveDotSegments(ans.substr(origin, path_end-origin)) + ans.substr(path_end);
+}
+
+Status RocksWormDeltaHTTPEnv::PriorObject(const string& object, size_t& i, string& url) {
+    // objects of prior RocksWorm files are aliased by their index
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+    char *end = nullptr;
+    i = strtoul(object.c_str()+1, &end, 10);
+    if (*end || i == 0 || i >= manifest->objects.size() || manifest->objects[i].name != object) {
+        return Status::NotFound(object);
+    }
+    url = ResolveURL(base_url_, manifest->objects[i].url);
+    return Status::OK();
+}
+
+Status RocksWormDeltaHTTPEnv::CheckPriorObject(const string& object, size_t i, const string& url) {
+    {
+        lock_guard<mutex> lock(checked_mu_);
+        auto it = checked_.find(i);
+        if (it != checked_.end()) return it->second;
+    }
+
+    HTTP::headers response_headers;
+    Status s = RetryHead(object, response_headers);
+    if (!s.ok()) return s;  // perhaps transient, so not remembered
+    const RocksWormObject& expected = atomic_load(&manifest_)->objects[i];
+    auto etag = response_headers.find("etag");
+    auto content_length = response_headers.find("content-length");
+    if (content_length == response_headers.end()
+        || strtoull(content_length->second.c_str(), nullptr, 10) != expected.size
+        || (expected.etag.size() && (etag == response_headers.end() || etag->second != expected.etag))) {
+        Error(&http_logger_, "%s has changed since the RocksWorm delta %s was made",
+              CensorURL(url).c_str(), CensorURL(base_url_).c_str());
+        s = Status::Corruption("RocksWorm delta's prior object has changed", object);
+    }
+    lock_guard<mutex> lock(checked_mu_);
+    checked_[i] = s;
+    return s;
+}
+
+Status RocksWormDeltaHTTPEnv::ObjectURL(const string& object, string& url) {
+    if (object.empty() || object[0] != '@') return RocksWormHTTPEnv::ObjectURL(object, url);
+    size_t i;
+    Status s = PriorObject(object, i, url);
+    if (!s.ok()) return s;
+    return CheckPriorObject(object, i, url);
+}
+
+Status RocksWormDeltaHTTPEnv::PrepareHead(const string& fname, string& url, HTTP::headers& request_headers) {
+    if (fname.empty() || fname[0] != '@') return RocksWormHTTPEnv::PrepareHead(fname, url, request_headers);
+    request_headers.clear();
+    size_t i;
+    return PriorObject(fname, i, url);
+}
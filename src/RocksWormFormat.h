@@ -0,0 +1,345 @@
+// RocksWorm file format definitions shared by MakeRocksWormFileFromDB and
+// RocksWormHTTPEnv.
+//
+// ROC0 is described in MakeRocksWormFileFromDB.cc. ROC1 lays out the file as
+// follows:
+//
+//   file contents   each constituent file, starting at a multiple of the
+//                   alignment (zero-padded in between), except for the
+//                   inline files placed unaligned at the end; the SSTs may
+//                   instead be striped across separate objects (see below)
+//   manifest pages  optionally, the paged manifest (see below), placed
+//                   before the metadata and inline files
+//   metadata        optionally, copies of the trailing metadata of each SST
+//                   (index and filter blocks, etc.), placed together before
+//                   the inline files
+//   sections        the manifest, file names, and any other sections listed
+//                   in the footer
+//   footer          kFooterSize bytes at the very end
+//
+// The manifest section is an array of kEntrySize-byte entries, sorted by file
+// name (bytewise), so it can be searched in place. Each entry gives the
+// offset, size and CRC32C of a file, and locates its name within the names
+// section. The footer gives the offset, size and CRC32C of each section, and
+// is itself checksummed:
+//
+//   FOOTER  ::= uint32 alignment, uint32 flags, uint64 file_count,
+//               SECTION[kSectionCount], 16 zero bytes,
+//               uint32 crc32c of the preceding footer bytes, "ROC1"
+//   SECTION ::= uint64 offset, uint64 size, uint32 crc32c, uint32 zero
+//   ENTRY   ::= uint64 offset, uint64 size, uint32 name_offset,
+//               uint32 name_size, uint32 crc32c, uint32 object
+//
+// The metadata map section locates the copied metadata of each SST, in the
+// order of the copies:
+//
+//   MAPPING ::= uint64 entry index (within the manifest section),
+//               uint64 offset within the file where its metadata begins,
+//               uint64 offset of the copy within the RocksWorm file
+//
+// The global filter section is a Bloom filter over all keys of the database,
+// probed at positions derived from FilterHash of the key:
+//
+//   FILTER  ::= uint32 num_probes, uint32 zero, uint64 num_bits,
+//               byte[ceil(num_bits/8)]
+//
+// The global index section locates the data blocks of each SST that may hold
+// a given user key (bytewise-ordered). Each SST's consecutive data blocks
+// are grouped a few at a time, and each group carries an upper bound on its
+// user keys, taken from the SST's index block (see SSTBlocks.h):
+//
+//   INDEX   ::= RUN*
+//   RUN     ::= uint64 entry index (within the manifest section),
+//               uint32 size, byte[size] smallest user key in the SST,
+//               uint32 group_count, GROUP[group_count]
+//   GROUP   ::= uint32 size, byte[size] upper bound on the group's user keys,
+//               uint64 offset of the first block within the SST,
+//               uint32 block_count, uint32 block_size[block_count]
+//
+// Each block size excludes the block trailer following it.
+//
+// If the footer has kFlagPagedManifest, the manifest is instead divided into
+// pages of consecutive entries, each followed by its own names, so that
+// readers can fetch them on demand. The pages are placed together after the
+// SSTs' contents (so that they aren't loaded with the trailer), and the
+// manifest section locates them all. The names section is then empty, and
+// the manifest directory section lists the pages in order, with the name of
+// each page's last entry:
+//
+//   PAGE    ::= ENTRY[entry_count], byte[] names
+//   PAGEREF ::= uint64 offset, uint32 size, uint32 crc32c,
+//               uint32 entry_count, uint32 name_size, byte[name_size] name
+//
+// The name offsets of a page's entries are relative to its names. Entry
+// indices (in the metadata map and global index) still count the entries of
+// the whole manifest.
+//
+// The objects section, if present, lists the stripe objects holding the SSTs
+// (MakeRocksWormFileFromDB --stripes), so that reads of the database spread
+// across several objects. Each entry's object is its file's index within the
+// list, counting from 1, or zero for the RocksWorm file itself, and its offset
+// is within that object. Stripes are named relative to the RocksWorm file's
+// URL, and laid out like the file contents above.
+//
+//   OBJECT  ::= uint64 size, uint32 crc32c of the object,
+//               uint32 name_size, byte[name_size] name
+//
+// A delta file (MakeRocksWormFileFromDB --base) holds only the files not
+// found in a prior RocksWorm file of the same database, and its entries for
+// the rest locate them within the prior file's objects (its roc file or
+// stripes), listed after any stripes of its own. These objects are named by
+// URL (absolute, or relative to the delta's URL), and always contain a slash,
+// which stripe names lack, so that readers unaware of deltas reject the file
+// as corrupt instead of misreading it. Their URLs carry no query string (which
+// could hold credentials). Their crc32c is zero (unknown); instead each is
+// followed by the ETag the object had when the delta was made (empty if the
+// server sent none), by which readers detect that it has since changed.
+//
+//   BASE_OBJECT ::= OBJECT, uint32 etag_size, byte[etag_size] etag
+//
+// Integers are little-endian. Sections absent from a file have zero size.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "crc32c.h"
+
+namespace RocksWormFormat {
+
+const size_t kMagicSize = 4;
+const char kMagicV0[] = "ROC0";
+const char kMagicV1[] = "ROC1";
+
+const size_t kFooterSize = 256;
+const size_t kEntrySize = 32;
+const size_t kMappingSize = 24;
+const unsigned int kSectionCount = 9;
+
+// footer section table slots; the others are reserved
+enum Section : unsigned int {
+    kManifestSection = 0,
+    kNamesSection = 1,
+    // contiguous region holding the small files needed to open the database
+    // (CURRENT, IDENTITY, MANIFEST-*), just before the other sections, so
+    // that readers can load them along with the manifest
+    kInlineSection = 2,
+    // copies of the SSTs' trailing metadata, which table opens read, packed
+    // together so that readers can load it all in one request; and the map
+    // locating each copy
+    kMetadataSection = 3,
+    kMetadataMapSection = 4,
+    kGlobalFilterSection = 5,
+    kGlobalIndexSection = 6,
+    kManifestDirectorySection = 7,
+    kObjectsSection = 8,
+};
+
+// footer flags
+const uint32_t kFlagPagedManifest = 1;
+const size_t kPageRefSize = 24;         // excluding the name
+const size_t kObjectSize = 16;          // excluding the name
+
+inline void EncodeFixed32(char *buf, uint32_t v) {
+    for (int i = 0; i < 4; i++) buf[i] = char((v >> (8*i)) & 0xff);
+}
+
+inline void EncodeFixed64(char *buf, uint64_t v) {
+    for (int i = 0; i < 8; i++) buf[i] = char((v >> (8*i)) & 0xff);
+}
+
+inline uint32_t DecodeFixed32(const char *buf) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | uint8_t(buf[i]);
+    return v;
+}
+
+inline uint64_t DecodeFixed64(const char *buf) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | uint8_t(buf[i]);
+    return v;
+}
+
+struct SectionHandle {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t crc32c = 0;
+};
+
+struct Footer {
+    uint32_t alignment = 1;
+    uint32_t flags = 0;
+    uint64_t file_count = 0;
+    SectionHandle sections[kSectionCount];
+
+    // write kFooterSize bytes
+    void EncodeTo(char *buf) const {
+        memset(buf, 0, kFooterSize);
+        EncodeFixed32(buf, alignment);
+        EncodeFixed32(buf+4, flags);
+        EncodeFixed64(buf+8, file_count);
+        for (unsigned int i = 0; i < kSectionCount; i++) {
+            char *p = buf + 16 + 24*i;
+            EncodeFixed64(p, sections[i].offset);
+            EncodeFixed64(p+8, sections[i].size);
+            EncodeFixed32(p+16, sections[i].crc32c);
+        }
+        size_t crc_pos = kFooterSize - kMagicSize - 4;
+        EncodeFixed32(buf+crc_pos, crc32c::Value(buf, crc_pos));
+        memcpy(buf+crc_pos+4, kMagicV1, kMagicSize);
+    }
+
+    // read kFooterSize bytes, verifying the magic and checksum
+    bool DecodeFrom(const char *buf) {
+        size_t crc_pos = kFooterSize - kMagicSize - 4;
+        if (memcmp(buf+crc_pos+4, kMagicV1, kMagicSize) != 0
+            || DecodeFixed32(buf+crc_pos) != crc32c::Value(buf, crc_pos)) {
+            return false;
+        }
+        alignment = DecodeFixed32(buf);
+        flags = DecodeFixed32(buf+4);
+        file_count = DecodeFixed64(buf+8);
+        for (unsigned int i = 0; i < kSectionCount; i++) {
+            const char *p = buf + 16 + 24*i;
+            sections[i].offset = DecodeFixed64(p);
+            sections[i].size = DecodeFixed64(p+8);
+            sections[i].crc32c = DecodeFixed32(p+16);
+        }
+        return true;
+    }
+};
+
+struct Entry {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t name_offset = 0;
+    uint32_t name_size = 0;
+    uint32_t crc32c = 0;
+    uint32_t object = 0;
+
+    // write kEntrySize bytes
+    void EncodeTo(char *buf) const {
+        EncodeFixed64(buf, offset);
+        EncodeFixed64(buf+8, size);
+        EncodeFixed32(buf+16, name_offset);
+        EncodeFixed32(buf+20, name_size);
+        EncodeFixed32(buf+24, crc32c);
+        EncodeFixed32(buf+28, object);
+    }
+
+    void DecodeFrom(const char *buf) {
+        offset = DecodeFixed64(buf);
+        size = DecodeFixed64(buf+8);
+        name_offset = DecodeFixed32(buf+16);
+        name_size = DecodeFixed32(buf+20);
+        crc32c = DecodeFixed32(buf+24);
+        object = DecodeFixed32(buf+28);
+    }
+};
+
+struct Mapping {
+    uint64_t entry = 0;
+    uint64_t file_offset = 0;
+    uint64_t copy_offset = 0;
+
+    // write kMappingSize bytes
+    void EncodeTo(char *buf) const {
+        EncodeFixed64(buf, entry);
+        EncodeFixed64(buf+8, file_offset);
+        EncodeFixed64(buf+16, copy_offset);
+    }
+
+    void DecodeFrom(const char *buf) {
+        entry = DecodeFixed64(buf);
+        file_offset = DecodeFixed64(buf+8);
+        copy_offset = DecodeFixed64(buf+16);
+    }
+};
+
+// 64-bit hash of a key for the global filter (MurmurHash64A)
+inline uint64_t FilterHash(const char *data, size_t n) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x5bd1e9955bd1e995ULL ^ (n * m);
+    const char *end = data + (n & ~size_t(7));
+    for (; data != end; data += 8) {
+        uint64_t k = DecodeFixed64(data);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (n & 7) {
+        case 7: h ^= uint64_t(uint8_t(data[6])) << 48; // fall through
+        case 6: h ^= uint64_t(uint8_t(data[5])) << 40; // fall through
+        case 5: h ^= uint64_t(uint8_t(data[4])) << 32; // fall through
+        case 4: h ^= uint64_t(uint8_t(data[3])) << 24; // fall through
+        case 3: h ^= uint64_t(uint8_t(data[2])) << 16; // fall through
+        case 2: h ^= uint64_t(uint8_t(data[1])) << 8; // fall through
+        case 1: h ^= uint64_t(uint8_t(data[0]));
+                h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+const size_t kFilterHeaderSize = 16;
+
+class GlobalFilterBuilder {
+    uint32_t num_probes_;
+    uint64_t num_bits_;
+    std::string filter_;
+
+public:
+    // size the filter for up to num_keys keys
+    GlobalFilterBuilder(uint64_t num_keys, unsigned int bits_per_key) {
+        num_probes_ = std::max(1U, std::min(30U, (unsigned int)(bits_per_key * 0.69 + 0.5)));
+        num_bits_ = std::max(uint64_t(64), num_keys * bits_per_key);
+        filter_.assign(kFilterHeaderSize + (num_bits_+7)/8, 0);
+        EncodeFixed32(&filter_[0], num_probes_);
+        EncodeFixed64(&filter_[8], num_bits_);
+    }
+
+    void Add(const char *key, size_t n) {
+        uint64_t h = FilterHash(key, n);
+        const uint64_t delta = (h >> 33) | (h << 31);
+        char *bits = &filter_[kFilterHeaderSize];
+        for (uint32_t i = 0; i < num_probes_; i++) {
+            uint64_t bit = h % num_bits_;
+            bits[bit/8] |= char(1 << (bit%8));
+            h += delta;
+        }
+    }
+
+    const std::string& Finish() const { return filter_; }
+};
+
+// check the filter's header
+inline bool GlobalFilterValid(const char *filter, size_t size) {
+    if (size < kFilterHeaderSize) return false;
+    uint32_t num_probes = DecodeFixed32(filter);
+    uint64_t num_bits = DecodeFixed64(filter+8);
+    return num_probes >= 1 && num_bits >= 1 && (num_bits+7)/8 == size-kFilterHeaderSize;
+}
+
+// false if the key is definitely absent from a (valid) filter
+inline bool GlobalFilterMayContain(const char *filter, const char *key, size_t n) {
+    uint32_t num_probes = DecodeFixed32(filter);
+    uint64_t num_bits = DecodeFixed64(filter+8);
+    uint64_t h = FilterHash(key, n);
+    const uint64_t delta = (h >> 33) | (h << 31);
+    const char *bits = filter + kFilterHeaderSize;
+    for (uint32_t i = 0; i < num_probes; i++) {
+        uint64_t bit = h % num_bits;
+        if ((bits[bit/8] & (1 << (bit%8))) == 0) return false;
+        h += delta;
+    }
+    return true;
+}
+
+}
@@ -1,94 +1,1063 @@
 #include "RocksWorm/RocksWormHTTPEnv.h"
+#include "RocksWormFormat.h"
+#include "SSTBlocks.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
 using namespace std;
 using namespace rocksdb;
 
-// get the last n bytes of the roc file
-Status RocksWormHTTPEnv::GetTail(size_t n, Slice* ans, char* scratch) {
+// get the last n bytes of the roc file, and its total size
+Status RocksWormHTTPEnv::GetTail(size_t n, Slice* ans, char* scratch, uint64_t& rocsz) {
     assert(n);
     assert(scratch);
     assert(ans);
-    // HEAD the file to determine its size
-    HTTP::headers headers;
-    Status s = RetryHead("", headers);
+    Status s = RetryGetSuffix("", n, ans, scratch, rocsz);
     if (!s.ok()) return s;
-    auto it = headers.find("content-length");
-    if (it == headers.end()) return Status::IOError("HTTP HEAD response didn't include Content-Length header");
-    unsigned long long rocsz = strtoull(it->second.c_str(), nullptr, 10);
-
     if (!rocsz) return Status::Corruption("HTTP server reports empty RocksWorm file");
+    return Status::OK();
+}
+
+// Parse the ROC0 manifest at the end of trailer. See comments in
+// MakeRocksWormFileFromDB.cc for details about the format
+static Status ParseManifestV0(const Slice& trailer, RocksWormManifestPage& ans) {
+    uint64_t manifest_size = *(uint64_t*)(trailer.data() + trailer.size() - 12);
+    assert(trailer.size() >= manifest_size+12);
+    const char *pos = trailer.data()+trailer.size()-12-manifest_size;
+    const char *last_pos = pos+manifest_size;
+    uint64_t current_offset = 0;
+    while (pos < last_pos) {
+        if (pos+8 >= last_pos) return Status::Corruption("invalid RocksWorm file");
+        uint64_t filesz = *(uint64_t*)pos;
+        pos += 8;
+
+        if (pos+8 >= last_pos) return Status::Corruption("invalid RocksWorm file");
+        uint64_t namelen = *(uint64_t*)pos;
+        pos += 8;
+        if (pos+namelen > last_pos) return Status::Corruption("invalid RocksWorm file");
+        std::string name;
+        name.assign(pos,namelen);
+        pos += namelen;
+
+        RocksWormManifestEntry entry;
+        entry.offset = current_offset;
+        entry.size = filesz;
+        current_offset += filesz;
+        ans.push_back(make_pair(move(name), entry));
+    }
+
+    // the entries are in the order of the file contents; sort them by name
+    sort(ans.begin(), ans.end(),
+         [](const pair<string, RocksWormManifestEntry>& a, const pair<string, RocksWormManifestEntry>& b) {
+             return a.first < b.first;
+         });
+    for (size_t i = 1; i < ans.size(); i++) {
+        if (ans[i-1].first == ans[i].first) return Status::Corruption("duplicate manifest entries in RocksWorm file");
+    }
+    return Status::OK();
+}
+
+// Whether to load the given ROC1 section along with the manifest. The
+// sections other than the manifest and names (or the directory of a paged
+// manifest) are optional, and the larger ones are subject to size limits.
+static bool LoadSection(const RocksWormFormat::Footer& footer, unsigned int i, const HTTPEnvOptions& opts) {
+    using namespace RocksWormFormat;
+    const SectionHandle& h = footer.sections[i];
+    bool paged = footer.flags & kFlagPagedManifest;
+    switch (i) {
+        case kManifestSection:
+        case kNamesSection:
+            return !paged;
+        case kManifestDirectorySection:
+            return paged;
+        case kInlineSection:
+        case kMetadataMapSection:
+        case kObjectsSection:
+            return h.size > 0;
+        case kMetadataSection:
+            return h.size > 0 && h.size <= opts.metadata_region_max;
+        case kGlobalFilterSection:
+            return h.size > 0 && h.size <= opts.global_filter_max;
+        case kGlobalIndexSection:
+            return h.size > 0 && h.size <= opts.global_index_max;
+    }
+    return false;
+}
+
+// Parse count ROC1 manifest entries, with the names they refer to, into a
+// page, verifying that they're sorted and lie within their objects. The
+// metadata copies for the entries, given their indices from first_index, are
+// taken from the tail.
+static Status ParsePage(const char *entries, uint64_t count, const Slice& names, uint64_t first_index,
+                        const vector<RocksWormObject>& objects, const RocksWormTail& tail,
+                        RocksWormManifestPage& ans) {
+    using namespace RocksWormFormat;
+    ans.clear();
+    ans.reserve(count);
+    for (uint64_t i = 0; i < count; i++) {
+        Entry e;
+        e.DecodeFrom(entries+i*kEntrySize);
+        if (uint64_t(e.name_offset)+e.name_size > names.size() || e.object >= objects.size()
+            || e.offset > objects[e.object].size || e.size > objects[e.object].size-e.offset) {
+            return Status::Corruption("invalid RocksWorm file manifest");
+        }
+        string name(names.data()+e.name_offset, e.name_size);
+        if (!ans.empty() && ans.back().first >= name) {
+            return Status::Corruption(ans.back().first == name ? "duplicate manifest entries in RocksWorm file"
+                                                               : "invalid RocksWorm file manifest");
+        }
+        RocksWormManifestEntry entry;
+        entry.object = e.object;
+        entry.offset = e.offset;
+        entry.size = e.size;
+        entry.crc32c = e.crc32c;
+        entry.has_crc32c = true;
+        ans.push_back(make_pair(move(name), entry));
+    }
+
+    auto m = lower_bound(tail.metadata_copies.begin(), tail.metadata_copies.end(), first_index,
+                         [](const RocksWormMetadataCopy& copy, uint64_t index) { return copy.entry < index; });
+    for (; m != tail.metadata_copies.end() && m->entry < first_index+count; m++) {
+        RocksWormManifestEntry& entry = ans[m->entry-first_index].second;
+        if (m->metadata_offset > entry.size) return Status::Corruption("invalid RocksWorm file metadata map");
+        entry.has_metadata_copy = true;
+        entry.metadata_offset = m->metadata_offset;
+        entry.metadata_copy = m->metadata_copy;
+    }
+    return Status::OK();
+}
+
+// Parse the directory of a paged manifest
+static Status ParseDirectory(const Slice& section, RocksWormManifest& ans) {
+    using namespace RocksWormFormat;
+    const char *p = section.data(), *limit = p + section.size();
+    uint64_t first_index = 0, end = ans.pages_offset;
+    while (p < limit) {
+        RocksWormManifestPageRef ref;
+        if (limit-p < kPageRefSize) return Status::Corruption("invalid RocksWorm file manifest directory");
+        ref.offset = DecodeFixed64(p);
+        ref.size = DecodeFixed32(p+8);
+        ref.crc32c = DecodeFixed32(p+12);
+        ref.count = DecodeFixed32(p+16);
+        uint32_t name_size = DecodeFixed32(p+20);
+        p += kPageRefSize;
+        if (limit-p < name_size) return Status::Corruption("invalid RocksWorm file manifest directory");
+        ref.last_name.assign(p, name_size);
+        p += name_size;
+        ref.first_index = first_index;
+        first_index += ref.count;
+        // the pages are consecutive, sorted and nonempty
+        if (ref.offset != end || ref.count == 0 || ref.size < ref.count*kEntrySize
+            || (!ans.directory.empty() && ans.directory.back().last_name >= ref.last_name)) {
+            return Status::Corruption("invalid RocksWorm file manifest directory");
+        }
+        end += ref.size;
+        ans.directory.push_back(move(ref));
+    }
+    if (first_index != ans.file_count || end != ans.pages_offset+ans.pages_size) {
+        return Status::Corruption("invalid RocksWorm file manifest directory");
+    }
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::ParseObjects(const Slice& section, bool deltas, vector<RocksWormObject>& ans) {
+    using namespace RocksWormFormat;
+    const char *p = section.data(), *limit = p + section.size();
+    while (p < limit) {
+        RocksWormObject object;
+        if (limit-p < kObjectSize) return Status::Corruption("invalid RocksWorm file objects");
+        object.size = DecodeFixed64(p);
+        uint32_t name_size = DecodeFixed32(p+12);
+        p += kObjectSize;
+        if (limit-p < name_size) return Status::Corruption("invalid RocksWorm file objects");
+        object.name.assign(p, name_size);
+        p += name_size;
+        // object names are distinguished from file names by lacking a slash;
+        // objects of prior RocksWorm files, named by URL, get an alias
+        if (object.name.empty() || (object.name.find('/') != string::npos && !deltas)) {
+            return Status::Corruption("invalid RocksWorm file objects");
+        }
+        if (object.name.find('/') != string::npos) {
+            object.url = move(object.name);
+            object.name = "@" + to_string(ans.size());
+            if (limit-p < 4) return Status::Corruption("invalid RocksWorm file objects");
+            uint32_t etag_size = DecodeFixed32(p);
+            p += 4;
+            if (limit-p < etag_size) return Status::Corruption("invalid RocksWorm file objects");
+            object.etag.assign(p, etag_size);
+            p += etag_size;
+        }
+        ans.push_back(move(object));
+    }
+    return Status::OK();
+}
+
+// Parse the global index section into runs
+static Status ParseGlobalIndex(const Slice& section, uint64_t file_count, vector<RocksWormIndexRun>& ans) {
+    using namespace RocksWormFormat;
+    const char *p = section.data(), *limit = p + section.size();
+    auto get32 = [&](uint32_t& v) { if (limit-p < 4) return false; v = DecodeFixed32(p); p += 4; return true; };
+    auto get64 = [&](uint64_t& v) { if (limit-p < 8) return false; v = DecodeFixed64(p); p += 8; return true; };
+    auto get_string = [&](string& v) {
+        uint32_t size;
+        if (!get32(size) || limit-p < size) return false;
+        v.assign(p, size);
+        p += size;
+        return true;
+    };
+    const Status corrupt = Status::Corruption("invalid RocksWorm file global index");
+
+    while (p < limit) {
+        uint32_t group_count;
+        RocksWormIndexRun run;
+        if (!get64(run.entry) || run.entry >= file_count || !get_string(run.smallest) || !get32(group_count)) {
+            return corrupt;
+        }
+        for (uint32_t i = 0; i < group_count; i++) {
+            RocksWormIndexGroup group;
+            uint32_t block_count;
+            if (!get_string(group.largest) || !get64(group.offset) || !get32(block_count)
+                || limit-p < 4*uint64_t(block_count)) {
+                return corrupt;
+            }
+            for (uint32_t j = 0; j < block_count; j++) {
+                group.block_sizes.push_back(DecodeFixed32(p));
+                p += 4;
+            }
+            run.groups.push_back(move(group));
+        }
+        ans.push_back(move(run));
+    }
+    return Status::OK();
+}
+
+// Parse the ROC1 manifest, given the trailer of the roc file containing its
+// footer and the sections to load. Also locates or parses the other loaded
+// sections used from memory. See RocksWormFormat.h
+static Status ParseManifestV1(const HTTPEnvOptions& opts, bool deltas, RocksWormTail& tail,
+                              RocksWormManifest& ans, RocksWormManifestPage& page) {
+    using namespace RocksWormFormat;
+    const Slice trailer(tail.data);
+    const uint64_t trailer_offset = tail.offset;
+    Footer footer;
+    if (trailer.size() < kFooterSize || !footer.DecodeFrom(trailer.data()+trailer.size()-kFooterSize)) {
+        return Status::Corruption("invalid RocksWorm file footer");
+    }
+
+    // locate and verify the sections
+    const SectionHandle& metadata = footer.sections[kMetadataSection];
+    bool use_metadata = LoadSection(footer, kMetadataSection, opts);
+    Slice sections[kSectionCount];
+    for (unsigned int i = 0; i < kSectionCount; i++) {
+        const SectionHandle& h = footer.sections[i];
+        if (!LoadSection(footer, i, opts)) continue;
+        if (h.offset < trailer_offset || h.offset+h.size > trailer_offset+trailer.size()-kFooterSize) {
+            return Status::Corruption("invalid RocksWorm file section");
+        }
+        sections[i] = Slice(trailer.data()+(h.offset-trailer_offset), h.size);
+        if (crc32c::Value(sections[i].data(), sections[i].size()) != h.crc32c) {
+            return Status::Corruption(i == kInlineSection ? "RocksWorm file checksum mismatch"
+                                                          : "RocksWorm file manifest checksum mismatch");
+        }
+    }
+    const Slice& mappings = sections[kMetadataMapSection];
+    if (mappings.size() % kMappingSize) return Status::Corruption("invalid RocksWorm file manifest");
+
+    for (size_t i = 0; use_metadata && i < mappings.size(); i += kMappingSize) {
+        Mapping m;
+        m.DecodeFrom(mappings.data()+i);
+        if (m.entry >= footer.file_count || m.copy_offset < metadata.offset
+            || m.copy_offset > metadata.offset+metadata.size) {
+            return Status::Corruption("invalid RocksWorm file metadata map");
+        }
+        RocksWormMetadataCopy copy;
+        copy.entry = m.entry;
+        copy.metadata_offset = m.file_offset;
+        copy.metadata_copy = m.copy_offset;
+        tail.metadata_copies.push_back(copy);
+    }
+    sort(tail.metadata_copies.begin(), tail.metadata_copies.end(),
+         [](const RocksWormMetadataCopy& a, const RocksWormMetadataCopy& b) { return a.entry < b.entry; });
+
+    Status s = RocksWormHTTPEnv::ParseObjects(sections[kObjectsSection], deltas, ans.objects);
+    if (!s.ok()) return s;
 
-    // GET the file tail
-    return RetryGet("", (rocsz>=n ? rocsz-n : 0), std::min((unsigned long long)n,rocsz), headers, ans, scratch);
+    ans.file_count = footer.file_count;
+    if (footer.flags & kFlagPagedManifest) {
+        const SectionHandle& pages = footer.sections[kManifestSection];
+        ans.paged = true;
+        ans.pages_offset = pages.offset;
+        ans.pages_size = pages.size;
+        ans.pages_crc32c = pages.crc32c;
+        if (pages.offset > trailer_offset+trailer.size() || pages.size > trailer_offset+trailer.size()-pages.offset) {
+            return Status::Corruption("invalid RocksWorm file section");
+        }
+        s = ParseDirectory(sections[kManifestDirectorySection], ans);
+        if (!s.ok()) return s;
+    } else {
+        const Slice& entries = sections[kManifestSection];
+        if (entries.size() != footer.file_count*kEntrySize) return Status::Corruption("invalid RocksWorm file manifest");
+        s = ParsePage(entries.data(), footer.file_count, sections[kNamesSection], 0, ans.objects, tail, page);
+        if (!s.ok()) return s;
+    }
+
+    tail.global_filter = sections[kGlobalFilterSection];
+    if (tail.global_filter.size() && !GlobalFilterValid(tail.global_filter.data(), tail.global_filter.size())) {
+        return Status::Corruption("invalid RocksWorm file global filter");
+    }
+    return ParseGlobalIndex(sections[kGlobalIndexSection], footer.file_count, tail.global_index);
 }
 
-// Read the .roc manifest if we haven't already. See comments in roc.cc for
-// details about the format
-Status RocksWormHTTPEnv::EnsureManifest() {
-    if (manifest_.size()) return Status::OK();
+static void LogPage(Logger *logger, const string& url, const RocksWormManifestPage& page) {
+    ostringstream msg;
+    msg << url << " RocksWorm manifest:" << endl;
+    for (auto& entry : page) {
+        msg << entry.first << ' ' << entry.second.offset << ' ' << entry.second.size << endl;
+    }
+    Info(logger, "%s", msg.str().c_str());
+}
 
-    size_t rdsz = 16384;
+// Read the .roc manifest if we haven't already.
+Status RocksWormHTTPEnv::EnsureManifest(shared_ptr<const RocksWormManifest>& manifest) {
+    using namespace RocksWormFormat;
+    manifest = atomic_load(&manifest_);
+    if (manifest) return Status::OK();
+    lock_guard<mutex> lock(manifest_mu_);
+    manifest = atomic_load(&manifest_);
+    if (manifest) return Status::OK();
+
+    // the first guess should cover the manifest and inline files of a typical
+    // database; costing about the same round trip as a smaller one
+    size_t rdsz = 65536;
     unique_ptr<char[]> scratch(new char[rdsz]);
     Slice tail;
+    uint64_t rocsz = 0;
 
-    // fetch tail of roc file
-    Status s = GetTail(rdsz, &tail, scratch.get());
+    // fetch tail of roc file, learning its size in the same round trip
+    Status s = GetTail(rdsz, &tail, scratch.get(), rocsz);
     if (!s.ok()) return s;
 
-    // read magic and manifest size
+    // read magic and determine the size of the trailer holding the manifest
     if (tail.size() < 12) return Status::Corruption("invalid RocksWorm file");
-    const char *magic = tail.data() + tail.size() - 4;
-    if (magic[0] != 'R' || magic[1] != 'O' || magic[2] != 'C' || magic[3] != '0') {
+    const char *magic = tail.data() + tail.size() - kMagicSize;
+    uint64_t need = 0;
+    bool v1 = false;
+    if (memcmp(magic, kMagicV0, kMagicSize) == 0) {
+        uint64_t manifest_size = *(uint64_t*)(tail.data() + tail.size() - 12);
+        if (manifest_size > rocsz-12) return Status::Corruption("invalid RocksWorm file");
+        need = manifest_size+12;
+    } else if (memcmp(magic, kMagicV1, kMagicSize) == 0) {
+        Footer footer;
+        if (tail.size() < kFooterSize || !footer.DecodeFrom(tail.data()+tail.size()-kFooterSize)) {
+            return Status::Corruption("invalid RocksWorm file footer");
+        }
+        need = kFooterSize;
+        for (unsigned int i = 0; i < kSectionCount; i++) {
+            const SectionHandle& h = footer.sections[i];
+            if (!LoadSection(footer, i, opts_)) continue;
+            if (h.offset > rocsz-kFooterSize) return Status::Corruption("invalid RocksWorm file section");
+            need = max(need, rocsz-h.offset);
+        }
+        v1 = true;
+    } else {
         return Status::Corruption("not a RocksWorm file");
     }
-    uint64_t manifest_size = *(uint64_t*)(tail.data() + tail.size() - 12);
 
-    // ensure we have the entire manifest
-    while (tail.size() < manifest_size+12) {
-        uint64_t last = tail.size();
-        rdsz *= 4;
-        scratch.reset(new char[rdsz]);
-        s = GetTail(rdsz, &tail, scratch.get());
+    // if the trailer is larger than our first guess, fetch exactly the rest
+    // of it
+    if (tail.size() < need) {
+        unique_ptr<char[]> bigger(new char[need]);
+        size_t have = tail.size();
+        memcpy(bigger.get()+need-have, tail.data(), have);
+        HTTP::headers headers;
+        Slice rest;
+        s = RetryGet("", rocsz-need, need-have, headers, &rest, bigger.get());
         if (!s.ok()) return s;
-        if (tail.size() <= last) return Status::Corruption("invalid RocksWorm file");
+        if (rest.size() != need-have) return Status::Corruption("invalid RocksWorm file");
+        scratch = move(bigger);
+        tail = Slice(scratch.get(), need);
     }
 
-    // read each file entry
-    char *pos = (char*)(tail.data()+tail.size()-12-manifest_size);
-    const char *last_pos = pos+manifest_size;
-    uint64_t current_offset = 0;
+    // keep the tail to serve the files within it (the inline files of ROC1),
+    // the metadata copies and the global filter from memory
+    auto keep = make_shared<RocksWormTail>();
+    keep->offset = rocsz-tail.size();
+    keep->data.assign(tail.data(), tail.size());
+    scratch.reset();
+    tail = Slice(keep->data);
+
     RocksWormManifest ans;
-    while (pos < last_pos) {
-        if (pos+8 >= last_pos) return Status::Corruption("invalid RocksWorm file");
-        uint64_t filesz = *(uint64_t*)pos;
-        pos += 8;
+    ans.objects.push_back(RocksWormObject());
+    ans.objects[0].size = rocsz;
+    auto page = make_shared<RocksWormManifestPage>();
+    s = v1 ? ParseManifestV1(opts_, AcceptsDeltas(), *keep, ans, *page) : ParseManifestV0(tail, *page);
+    if (!s.ok()) return s;
+    if (!ans.paged) {
+        // a single page, already loaded
+        if (page->empty()) return Status::Corruption("empty RocksWorm file");
+        RocksWormManifestPageRef ref;
+        ref.last_name = page->back().first;
+        ref.count = ans.file_count = page->size();
+        ans.directory.push_back(move(ref));
+        if (opts_.http_stderr_log_level <= InfoLogLevel::INFO_LEVEL) {
+            LogPage(&http_logger_, CensorURL(base_url_), *page);
+        }
+    }
+    if (ans.directory.empty()) return Status::Corruption("empty RocksWorm file");
 
-        if (pos+8 >= last_pos) return Status::Corruption("invalid RocksWorm file");
-        uint64_t namelen = *(uint64_t*)pos;
-        pos += 8;
-        if (pos+namelen > last_pos) return Status::Corruption("invalid RocksWorm file");
-        std::string name;
-        name.assign(pos,namelen);
-        pos += namelen;
-        
-        if (ans.find(name) != ans.end()) return Status::Corruption("duplicate manifest entries in RocksWorm file");
-        ans[name] = pair<uint64_t,uint64_t>(current_offset,filesz);
-        current_offset += filesz;       
+    pages_.reset(new shared_ptr<const RocksWormManifestPage>[ans.directory.size()]);
+    if (!ans.paged) {
+        pages_[0] = move(page);
     }
+    atomic_store(&tail_, shared_ptr<const RocksWormTail>(move(keep)));
 
-    if (ans.size() == 0) return Status::Corruption("empty RocksWorm file");
+    manifest = make_shared<const RocksWormManifest>(move(ans));
+    atomic_store(&manifest_, manifest);
+    return Status::OK();
+}
 
+Status RocksWormHTTPEnv::EnsurePage(const RocksWormManifest& manifest, size_t i,
+                                    shared_ptr<const RocksWormManifestPage>& page) {
+    assert(i < manifest.directory.size());
+    page = atomic_load(&pages_[i]);
+    if (page) return Status::OK();
+
+    // wait for the page's load in flight, if any; otherwise load it ourselves
+    promise<Status> loaded;
+    {
+        unique_lock<mutex> lock(pages_mu_);
+        page = atomic_load(&pages_[i]);
+        if (page) return Status::OK();
+        auto it = page_loads_.find(i);
+        if (it != page_loads_.end()) {
+            shared_future<Status> load = it->second;
+            lock.unlock();
+            Status s = load.get();
+            if (!s.ok()) return s;
+            page = atomic_load(&pages_[i]);
+            assert(page);
+            return Status::OK();
+        }
+        page_loads_[i] = loaded.get_future().share();
+    }
+
+    Status s = LoadPage(manifest, i, page);
+    if (s.ok()) {
+        atomic_store(&pages_[i], page);
+    }
+    {
+        lock_guard<mutex> lock(pages_mu_);
+        page_loads_.erase(i);
+    }
+    loaded.set_value(s);
+    return s;
+}
+
+Status RocksWormHTTPEnv::LoadPage(const RocksWormManifest& manifest, size_t i,
+                                  shared_ptr<const RocksWormManifestPage>& page) {
+    // the page may lie within the tail (in a small file); otherwise fetch it
+    const RocksWormManifestPageRef& ref = manifest.directory[i];
+    shared_ptr<const RocksWormTail> tail;
+    Slice contents;
+    unique_ptr<char[]> scratch;
+    if (!GetFromTail(ref.offset, ref.size, tail, contents)) {
+        scratch.reset(new char[ref.size]);
+        HTTP::headers headers;
+        Status s = RetryGet("", ref.offset, ref.size, headers, &contents, scratch.get());
+        if (!s.ok()) return s;
+        if (contents.size() != ref.size) return Status::IOError("Unexpected HTTP response body length");
+        tail = atomic_load(&tail_);
+    }
+    if (crc32c::Value(contents.data(), contents.size()) != ref.crc32c) {
+        return Status::Corruption("RocksWorm file manifest checksum mismatch");
+    }
+
+    auto ans = make_shared<RocksWormManifestPage>();
+    size_t entries_size = ref.count*RocksWormFormat::kEntrySize;
+    Status s = ParsePage(contents.data(), ref.count, Slice(contents.data()+entries_size, ref.size-entries_size),
+                         ref.first_index, manifest.objects, *tail, *ans);
+    if (!s.ok()) return s;
+    if (ans->back().first != ref.last_name
+        || (i > 0 && ans->front().first <= manifest.directory[i-1].last_name)) {
+        return Status::Corruption("invalid RocksWorm file manifest");
+    }
     if (opts_.http_stderr_log_level <= InfoLogLevel::INFO_LEVEL) {
-        ostringstream msg;
-        msg << CensorURL(base_url_) << " RocksWorm manifest:" << endl;
-        for (auto entry : ans) {
-            msg << entry.first << ' ' << entry.second.first << ' ' << entry.second.second << endl;
+        LogPage(&http_logger_, CensorURL(base_url_), *ans);
+    }
+    page = move(ans);
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::Lookup(const string& fname, RocksWormManifestEntry& entry) {
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+
+    // find the page that would hold the name, then the name within it
+    string name = fname.substr(fname.find('/')+1);
+    auto ref = lower_bound(manifest->directory.begin(), manifest->directory.end(), name,
+                           [](const RocksWormManifestPageRef& ref, const string& name) {
+                               return ref.last_name < name;
+                           });
+    if (ref == manifest->directory.end()) return Status::NotFound(fname);
+    shared_ptr<const RocksWormManifestPage> page;
+    s = EnsurePage(*manifest, ref-manifest->directory.begin(), page);
+    if (!s.ok()) return s;
+    auto it = lower_bound(page->begin(), page->end(), name,
+                          [](const pair<string, RocksWormManifestEntry>& entry, const string& name) {
+                              return entry.first < name;
+                          });
+    if (it == page->end() || it->first != name) return Status::NotFound(fname);
+    entry = it->second;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::LookupIndex(uint64_t index, RocksWormManifestEntry& entry) {
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+    if (index >= manifest->file_count) return Status::InvalidArgument("RocksWormHTTPEnv::LookupIndex");
+
+    auto ref = upper_bound(manifest->directory.begin(), manifest->directory.end(), index,
+                           [](uint64_t index, const RocksWormManifestPageRef& ref) {
+                               return index < ref.first_index;
+                           }) - 1;
+    shared_ptr<const RocksWormManifestPage> page;
+    s = EnsurePage(*manifest, ref-manifest->directory.begin(), page);
+    if (!s.ok()) return s;
+    entry = (*page)[index-ref->first_index].second;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::Locate(const string& fname, uint64_t& file_offset, uint64_t& file_size) {
+    RocksWormManifestEntry entry;
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+    file_offset = entry.offset;
+    file_size = entry.size;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::ObjectURL(const string& object, string& url) {
+    if (object.empty()) {
+        url = base_url_;
+        return Status::OK();
+    }
+
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+    for (size_t i = 1; i < manifest->objects.size(); i++) {
+        if (manifest->objects[i].name == object) {
+            // stripes are named relative to the roc file's URL (sans query)
+            size_t slash = base_url_.rfind('/', base_url_.find('?'));
+            url = base_url_.substr(0, slash == string::npos ? 0 : slash+1) + object;
+            return Status::OK();
+        }
+    }
+    return Status::NotFound(object);
+}
+
+Status RocksWormHTTPEnv::ResolveFile(const string& fname, string& object, uint64_t& object_size,
+                                     uint64_t& base_offset, uint64_t& size) {
+    if (fname.find('/') == string::npos) return Status::InvalidArgument("RocksWormHTTPEnv::ResolveFile");
+    RocksWormManifestEntry entry;
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+    const RocksWormObject& the_object = atomic_load(&manifest_)->objects[entry.object];
+    object = the_object.name;
+    object_size = the_object.size;
+    base_offset = entry.offset;
+    size = entry.size;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::GetValidator(const string& fname, string& validator) {
+    // object names lack slashes; file names are validated by the roc file
+    return BaseHTTPEnv::GetValidator(fname.find('/') == string::npos ? fname : "", validator);
+}
+
+void RocksWormHTTPEnv::CacheKey(const string& fname, string& url, string& name) {
+    if (fname.find('/') == string::npos && ObjectURL(fname, url).ok()) {
+        name.clear();
+        return;
+    }
+    BaseHTTPEnv::CacheKey(fname, url, name);
+}
+
+Status RocksWormHTTPEnv::PrepareHead(const string& fname, string& url, HTTP::headers& request_headers) {
+    // used on the roc file by RetryGetSuffix (from GetTail) to get its total
+    // size, if the server doesn't support suffix ranges, and on stripes by
+    // GetValidator
+    if (fname.find('/') != string::npos) return Status::InvalidArgument("RocksWormHTTPEnv::PrepareHead");
+    request_headers.clear();
+    return ObjectURL(fname, url);
+}
+
+Status RocksWormHTTPEnv::PrepareGet(const string& fname, uint64_t offset, size_t n,
+                                    string& url, HTTP::headers& request_headers) {
+    string object = fname;
+    if (fname.find('/') != string::npos) {
+        // range of a file, relative to its beginning
+        RocksWormManifestEntry entry;
+        Status s = Lookup(fname, entry);
+        if (!s.ok()) return s;
+        if (offset+n > entry.size) return Status::InvalidArgument("RocksWormHTTPEnv::PrepareGet");
+        object = atomic_load(&manifest_)->objects[entry.object].name;
+        offset += entry.offset;
+    }
+
+    // absolute range of an object (the roc file, used to read the manifest,
+    // or a stripe), as used by files resolved by ResolveFile
+    Status s = BaseHTTPEnv::PrepareGet("", offset, n, url, request_headers);
+    if (!s.ok()) return s;
+    return ObjectURL(object, url);
+}
+
+Status RocksWormHTTPEnv::GetChildren(const string& dir, vector<string>* result) {
+    assert(result);
+    if (dir.find('/') != dir.rfind('/')) return Status::InvalidArgument("RocksWormHTTPEnv::GetChildren");
+
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+    if (!manifest->paged) return ListFiles(result);
+
+    // CURRENT (which the writer places in the tail) names the MANIFEST
+    string current;
+    s = ReadFileToString(this, "/CURRENT", &current);
+    if (!s.ok()) return s;
+    if (current.empty() || current[current.size()-1] != '\n') {
+        return Status::Corruption("RocksWorm file has invalid CURRENT");
+    }
+    current.resize(current.size()-1);
+    uint64_t ignore;
+    s = GetFileSize("/" + current, &ignore);
+    if (!s.ok()) return s;
+    result->clear();
+    result->push_back("CURRENT");
+    result->push_back(current);
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::ListFiles(vector<string>* result) {
+    assert(result);
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+
+    result->clear();
+    if (!manifest->paged) {
+        shared_ptr<const RocksWormManifestPage> page;
+        s = EnsurePage(*manifest, 0, page);
+        if (!s.ok()) return s;
+        for (auto& entry : *page) {
+            result->push_back(entry.first);
+        }
+        assert(result->size());
+        return Status::OK();
+    }
+
+    // fetch all the pages at once
+    unique_ptr<char[]> scratch(new char[manifest->pages_size]);
+    HTTP::headers headers;
+    Slice pages;
+    s = RetryGet("", manifest->pages_offset, manifest->pages_size, headers, &pages, scratch.get());
+    if (!s.ok()) return s;
+    if (pages.size() != manifest->pages_size) return Status::IOError("Unexpected HTTP response body length");
+    if (crc32c::Value(pages.data(), pages.size()) != manifest->pages_crc32c) {
+        return Status::Corruption("RocksWorm file manifest checksum mismatch");
+    }
+    using namespace RocksWormFormat;
+    for (auto& ref : manifest->directory) {
+        const char *page = pages.data() + (ref.offset-manifest->pages_offset);
+        Slice names(page+ref.count*kEntrySize, ref.size-ref.count*kEntrySize);
+        for (uint64_t i = 0; i < ref.count; i++) {
+            Entry e;
+            e.DecodeFrom(page+i*kEntrySize);
+            if (uint64_t(e.name_offset)+e.name_size > names.size()) {
+                return Status::Corruption("invalid RocksWorm file manifest");
+            }
+            result->push_back(string(names.data()+e.name_offset, e.name_size));
+        }
+    }
+    assert(result->size());
+    return Status::OK();
+}
+
+bool RocksWormHTTPEnv::MayContain(const Slice& key) {
+    shared_ptr<const RocksWormManifest> manifest;
+    if (!EnsureManifest(manifest).ok()) return true;
+    shared_ptr<const RocksWormTail> tail = atomic_load(&tail_);
+    if (!tail || tail->global_filter.empty()) return true;
+    return RocksWormFormat::GlobalFilterMayContain(tail->global_filter.data(), key.data(), key.size());
+}
+
+// Search the data blocks of a global index group (and its trailers) for the
+// newest entry of the user key, updating found/sequence/type/value
+static Status SearchBlocks(const Slice& key, const RocksWormIndexGroup& group, const Slice& data,
+                           bool& found, uint64_t& sequence, unsigned char& type, string& value) {
+    using namespace SSTBlocks;
+    const char *p = data.data();
+    string contents;
+    for (uint32_t block_size : group.block_sizes) {
+        bool unsupported;
+        if (!UncompressBlock(p, block_size+kBlockTrailerSize, contents, unsupported)) {
+            return unsupported ? Status::NotSupported("RocksWormHTTPEnv::IndexedGet: unsupported block compression")
+                               : Status::Corruption("RocksWormHTTPEnv::IndexedGet: invalid data block");
+        }
+        p += block_size+kBlockTrailerSize;
+        BlockIter it(contents);
+        while (it.Next()) {
+            Slice user_key;
+            uint64_t entry_sequence;
+            unsigned char entry_type;
+            if (!ParseInternalKey(it.key(), user_key, entry_sequence, entry_type)) {
+                return Status::Corruption("RocksWormHTTPEnv::IndexedGet: invalid data block");
+            }
+            int c = user_key.compare(key);
+            if (c > 0) break;
+            if (c == 0 && (!found || entry_sequence > sequence)) {
+                found = true;
+                sequence = entry_sequence;
+                type = entry_type;
+                value.assign(it.value().data(), it.value().size());
+            }
+        }
+        if (it.corrupt()) return Status::Corruption("RocksWormHTTPEnv::IndexedGet: invalid data block");
+    }
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::IndexedGet(const Slice& key, string* value) {
+    assert(value);
+    shared_ptr<const RocksWormManifest> manifest;
+    Status s = EnsureManifest(manifest);
+    if (!s.ok()) return s;
+    shared_ptr<const RocksWormTail> tail = atomic_load(&tail_);
+    if (!tail || tail->global_index.empty()) return Status::NotSupported("RocksWorm file lacks a global index");
+
+    // find the first group of each SST whose upper bound is at least the key,
+    // along with the following groups whose bound equals it (as the key's
+    // entries may continue into them)
+    vector<pair<const RocksWormIndexRun*, const RocksWormIndexGroup*>> candidates;
+    for (const auto& run : tail->global_index) {
+        if (key.compare(run.smallest) < 0) continue;
+        auto first = lower_bound(run.groups.begin(), run.groups.end(), key,
+                                 [](const RocksWormIndexGroup& group, const Slice& key) {
+                                     return Slice(group.largest).compare(key) < 0;
+                                 });
+        if (first == run.groups.end()) continue;
+        auto last = first;
+        while (last+1 != run.groups.end() && Slice(last->largest) == key) last++;
+        for (auto it = first; it <= last; it++) {
+            candidates.push_back(make_pair(&run, &*it));
+        }
+    }
+    if (candidates.empty()) return Status::NotFound();
+
+    // fetch them all in one request (per object, if striped)
+    size_t total = 0;
+    vector<HTTPReadRequest> reqs;
+    map<uint32_t, vector<size_t>> by_object;
+    for (auto candidate : candidates) {
+        RocksWormManifestEntry entry;
+        s = LookupIndex(candidate.first->entry, entry);
+        if (!s.ok()) return s;
+        HTTPReadRequest req;
+        req.offset = entry.offset + candidate.second->offset;
+        req.n = 0;
+        for (uint32_t block_size : candidate.second->block_sizes) {
+            req.n += block_size + SSTBlocks::kBlockTrailerSize;
+        }
+        if (candidate.second->offset+req.n > entry.size) {
+            return Status::Corruption("invalid RocksWorm file global index");
+        }
+        total += req.n;
+        by_object[entry.object].push_back(reqs.size());
+        reqs.push_back(req);
+    }
+    unique_ptr<char[]> buf(new char[total]);
+    char *pos = buf.get();
+    for (auto& req : reqs) {
+        req.scratch = pos;
+        pos += req.n;
+    }
+    if (by_object.size() == 1) {
+        RetryGetRanges(manifest->objects[by_object.begin()->first].name, reqs);
+    } else {
+        for (auto& it : by_object) {
+            vector<HTTPReadRequest> object_reqs;
+            for (size_t i : it.second) {
+                object_reqs.push_back(reqs[i]);
+            }
+            RetryGetRanges(manifest->objects[it.first].name, object_reqs);
+            for (size_t i = 0; i < object_reqs.size(); i++) {
+                reqs[it.second[i]] = object_reqs[i];
+            }
         }
-        Info(&http_logger_, "%s", msg.str().c_str());
     }
 
-    manifest_ = ans;
+    bool found = false;
+    uint64_t sequence = 0;
+    unsigned char type = 0;
+    for (size_t i = 0; i < reqs.size(); i++) {
+        if (!reqs[i].status.ok()) return reqs[i].status;
+        if (reqs[i].result.size() != reqs[i].n) return Status::IOError("Unexpected HTTP response body length");
+        s = SearchBlocks(key, *candidates[i].second, reqs[i].result, found, sequence, type, *value);
+        if (!s.ok()) return s;
+    }
+
+    if (!found) return Status::NotFound();
+    switch (type) {
+        case SSTBlocks::kTypeValue:
+            return Status::OK();
+        case SSTBlocks::kTypeDeletion:
+        case SSTBlocks::kTypeSingleDeletion:
+            value->clear();
+            return Status::NotFound();
+    }
+    value->clear();
+    return Status::NotSupported("RocksWormHTTPEnv::IndexedGet: unsupported entry type");
+}
+
+bool RocksWormHTTPEnv::GetFromTail(uint64_t offset, uint64_t n, shared_ptr<const RocksWormTail>& tail, Slice& contents) {
+    tail = atomic_load(&tail_);
+    if (!tail || offset < tail->offset || offset+n > tail->offset+tail->data.size()) {
+        return false;
+    }
+    contents = Slice(tail->data.data()+(offset-tail->offset), n);
+    return true;
+}
+
+// Files served from the in-memory tail; they hold a reference to it
+class RocksWormInlineSequentialFile : public SequentialFile {
+    shared_ptr<const RocksWormTail> tail_;
+    Slice contents_;
+    uint64_t pos_ = 0;
+
+public:
+    RocksWormInlineSequentialFile(const shared_ptr<const RocksWormTail>& tail, const Slice& contents)
+        : tail_(tail), contents_(contents) {}
+
+    Status Read(size_t n, Slice* result, char* scratch) override {
+        n = min(uint64_t(n), contents_.size()-pos_);
+        *result = Slice(contents_.data()+pos_, n);
+        pos_ += n;
+        return Status::OK();
+    }
+
+    Status Skip(uint64_t n) override {
+        pos_ = min(pos_+n, uint64_t(contents_.size()));
+        return Status::OK();
+    }
+};
+
+class RocksWormInlineRandomAccessFile : public RandomAccessFile {
+    shared_ptr<const RocksWormTail> tail_;
+    Slice contents_;
+
+public:
+    RocksWormInlineRandomAccessFile(const shared_ptr<const RocksWormTail>& tail, const Slice& contents)
+        : tail_(tail), contents_(contents) {}
+
+    Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const override {
+        if (offset > contents_.size()) return Status::InvalidArgument("RocksWormHTTPEnv read beyond end of file");
+        n = min(uint64_t(n), contents_.size()-offset);
+        *result = Slice(contents_.data()+offset, n);
+        return Status::OK();
+    }
+};
+
+// A file whose trailing metadata, from metadata_offset, is served from its
+// copy in the in-memory tail (e.g. the blocks read by SST table opens). Other
+// reads go to the underlying file.
+class RocksWormPackedRandomAccessFile : public RandomAccessFile {
+    unique_ptr<RandomAccessFile> file_;
+    shared_ptr<const RocksWormTail> tail_;
+    uint64_t metadata_offset_;
+    Slice metadata_;
+
+public:
+    RocksWormPackedRandomAccessFile(unique_ptr<RandomAccessFile>&& file, const shared_ptr<const RocksWormTail>& tail,
+                                    uint64_t metadata_offset, const Slice& metadata)
+        : file_(move(file)), tail_(tail), metadata_offset_(metadata_offset), metadata_(metadata) {}
+
+    Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const override {
+        if (offset < metadata_offset_) {
+            return file_->Read(offset, n, result, scratch);
+        }
+        offset -= metadata_offset_;
+        if (offset > metadata_.size()) return Status::InvalidArgument("RocksWormHTTPEnv read beyond end of file");
+        n = min(uint64_t(n), metadata_.size()-offset);
+        *result = Slice(metadata_.data()+offset, n);
+        return Status::OK();
+    }
+
+    Status Prefetch(uint64_t offset, size_t n) override {
+        // table opens prefetch the end of the file, which we already have
+        if (offset+n > metadata_offset_) return Status::OK();
+        return file_->Prefetch(offset, n);
+    }
+
+    void Hint(AccessPattern pattern) override {
+        file_->Hint(pattern);
+    }
+};
+
+Status RocksWormHTTPEnv::NewSequentialFile(const string& fname, unique_ptr<SequentialFile>* result,
+                                           const EnvOptions& options) {
+    RocksWormManifestEntry entry;
+    if (fname.find('/') == string::npos) return Status::InvalidArgument("RocksWormHTTPEnv::NewSequentialFile");
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+
+    shared_ptr<const RocksWormTail> tail;
+    Slice contents;
+    if (entry.object == 0 && GetFromTail(entry.offset, entry.size, tail, contents)) {
+        result->reset(new RocksWormInlineSequentialFile(tail, contents));
+        return Status::OK();
+    }
+    return BaseHTTPEnv::NewSequentialFile(fname, result, options);
+}
+
+Status RocksWormHTTPEnv::NewRandomAccessFile(const string& fname, unique_ptr<RandomAccessFile>* result,
+                                             const EnvOptions& options) {
+    RocksWormManifestEntry entry;
+    if (fname.find('/') == string::npos) return Status::InvalidArgument("RocksWormHTTPEnv::NewRandomAccessFile");
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+
+    shared_ptr<const RocksWormTail> tail;
+    Slice contents;
+    if (entry.object == 0 && GetFromTail(entry.offset, entry.size, tail, contents)) {
+        result->reset(new RocksWormInlineRandomAccessFile(tail, contents));
+        return Status::OK();
+    }
+    s = BaseHTTPEnv::NewRandomAccessFile(fname, result, options);
+    if (s.ok() && entry.has_metadata_copy
+        && GetFromTail(entry.metadata_copy, entry.size-entry.metadata_offset, tail, contents)) {
+        result->reset(new RocksWormPackedRandomAccessFile(move(*result), tail, entry.metadata_offset, contents));
+    }
+    return s;
+}
+
+Status RocksWormHTTPEnv::LocateFile(const string& fname, RocksWormFileLocation& ans) {
+    if (fname.find('/') == string::npos) return Status::InvalidArgument("RocksWormHTTPEnv::LocateFile");
+    RocksWormManifestEntry entry;
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+    const RocksWormObject& object = atomic_load(&manifest_)->objects[entry.object];
+    s = ObjectURL(object.name, ans.object_url);
+    if (!s.ok()) return s;
+    ans.object_size = object.size;
+    ans.offset = entry.offset;
+    ans.size = entry.size;
+    ans.crc32c = entry.crc32c;
+    ans.has_crc32c = entry.has_crc32c;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::GetFileChecksum(const string& fname, uint32_t& crc32c) {
+    RocksWormManifestEntry entry;
+    Status s = Lookup(fname, entry);
+    if (!s.ok()) return s;
+    if (!entry.has_crc32c) return Status::NotSupported("RocksWorm file lacks checksums");
+    crc32c = entry.crc32c;
+    return Status::OK();
+}
+
+Status RocksWormHTTPEnv::MultiRead(vector<RocksWormReadRequest>& reqs) {
+    // a range of an object covering one or more of the reads
+    struct Span {
+        uint32_t object;
+        uint64_t offset, end;
+        vector<pair<RocksWormReadRequest*, uint64_t>> members; // with absolute offsets
+    };
+    struct Range {
+        uint32_t object;
+        uint64_t offset;
+        RocksWormReadRequest *req;
+    };
+
+    // resolve the reads to ranges of the objects, sorted by object and offset
+    vector<Range> ranges;
+    for (auto& req : reqs) {
+        req.result = Slice();
+        RocksWormManifestEntry entry;
+        req.status = Lookup(req.fname, entry);
+        if (req.status.ok() && req.offset+req.n > entry.size) {
+            req.status = Status::InvalidArgument("RocksWormHTTPEnv::MultiRead");
+        }
+        if (req.status.ok() && req.n) {
+            assert(req.scratch);
+            ranges.push_back(Range{entry.object, entry.offset+req.offset, &req});
+        }
+    }
+    sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+        return a.object < b.object || (a.object == b.object && a.offset < b.offset);
+    });
+
+    // merge nearby ranges
+    vector<Span> spans;
+    for (auto& range : ranges) {
+        uint64_t end = range.offset+range.req->n;
+        if (spans.empty() || range.object != spans.back().object
+            || range.offset > spans.back().end+opts_.multi_range_gap) {
+            spans.push_back(Span{range.object, range.offset, end, {}});
+        } else {
+            spans.back().end = max(spans.back().end, end);
+        }
+        spans.back().members.push_back(make_pair(range.req, range.offset));
+    }
+
+    // fetch the spans in batches of multi-range GETs, each of one object
+    shared_ptr<const RocksWormManifest> manifest = atomic_load(&manifest_);
+    unsigned int batch_max = max(opts_.multi_range_max, 1U);
+    for (size_t i = 0, batch_end; i < spans.size(); i = batch_end) {
+        size_t total = 0;
+        batch_end = i+1;
+        while (batch_end < min(spans.size(), i+batch_max) && spans[batch_end].object == spans[i].object) {
+            batch_end++;
+        }
+        for (size_t j = i; j < batch_end; j++) {
+            total += spans[j].end-spans[j].offset;
+        }
+        unique_ptr<char[]> buf(new char[total]);
+        vector<HTTPReadRequest> batch;
+        char *pos = buf.get();
+        for (size_t j = i; j < batch_end; j++) {
+            HTTPReadRequest r;
+            r.offset = spans[j].offset;
+            r.n = spans[j].end-spans[j].offset;
+            r.scratch = pos;
+            pos += r.n;
+            batch.push_back(r);
+        }
+
+        RetryGetRanges(manifest->objects[spans[i].object].name, batch);
+
+        for (size_t j = i; j < batch_end; j++) {
+            const HTTPReadRequest& r = batch[j-i];
+            for (auto& member : spans[j].members) {
+                RocksWormReadRequest *req = member.first;
+                if (!r.status.ok()) {
+                    req->status = r.status;
+                } else if (r.result.size() != r.n) {
+                    req->status = Status::IOError("Unexpected HTTP response body length");
+                } else {
+                    memcpy(req->scratch, r.result.data()+(member.second-r.offset), req->n);
+                    req->result = Slice(req->scratch, req->n);
+                }
+            }
+        }
+    }
+
+    for (auto& req : reqs) {
+        if (!req.status.ok()) return req.status;
+    }
     return Status::OK();
 }
@@ -0,0 +1,222 @@
+// Minimal decoding of RocksDB block-based table (SST) files, shared by
+// MakeRocksWormFileFromDB (to read index blocks when building the global
+// index) and RocksWormHTTPEnv (to search the data blocks it fetches using the
+// global index).
+//
+// This covers the table format written by RocksDB 5.x: the footer, block
+// handles, block trailers, uncompressed and Snappy-compressed blocks, and the
+// prefix-compressed entries of data, index and metaindex blocks, whose keys
+// (except in the metaindex) are internal keys. See table/format.h and
+// table/block_builder.cc in RocksDB for the authoritative description.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "rocksdb/slice.h"
+
+namespace SSTBlocks {
+
+const uint64_t kBlockBasedTableMagicNumber = 0x88e241b785f4cff7ULL;
+const uint64_t kLegacyBlockBasedTableMagicNumber = 0xdb4775248b80fb57ULL;
+const size_t kLegacyFooterSize = 48;
+const size_t kFooterSize = 53;          // format_version 1 and later
+const size_t kBlockTrailerSize = 5;     // compression type, uint32 checksum
+
+// compression types in block trailers (the ones we can decode)
+const char kNoCompression = 0x0;
+const char kSnappyCompression = 0x1;
+
+// internal key value types
+const unsigned char kTypeDeletion = 0x0;
+const unsigned char kTypeValue = 0x1;
+const unsigned char kTypeSingleDeletion = 0x7;
+
+inline bool GetVarint64(const char*& p, const char *limit, uint64_t& v) {
+    v = 0;
+    for (unsigned int shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64_t byte = uint8_t(*p++);
+        v |= (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+inline bool GetVarint32(const char*& p, const char *limit, uint32_t& v) {
+    uint64_t v64;
+    if (!GetVarint64(p, limit, v64) || v64 > 0xffffffffULL) return false;
+    v = uint32_t(v64);
+    return true;
+}
+
+inline uint32_t DecodeFixed32(const char *buf) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | uint8_t(buf[i]);
+    return v;
+}
+
+inline uint64_t DecodeFixed64(const char *buf) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | uint8_t(buf[i]);
+    return v;
+}
+
+// location of a block within the SST; size excludes the trailer
+struct BlockHandle {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+
+    bool DecodeFrom(const char*& p, const char *limit) {
+        return GetVarint64(p, limit, offset) && GetVarint64(p, limit, size);
+    }
+};
+
+// Decode the footer, given the last n bytes of the SST (n >= kFooterSize)
+inline bool DecodeFooter(const char *tail, size_t n, BlockHandle& metaindex, BlockHandle& index) {
+    if (n < kLegacyFooterSize) return false;
+    const char *end = tail + n;
+    uint64_t magic = DecodeFixed64(end-8);
+    const char *p;
+    if (magic == kBlockBasedTableMagicNumber) {
+        if (n < kFooterSize) return false;
+        p = end - kFooterSize + 1;  // skip checksum type
+    } else if (magic == kLegacyBlockBasedTableMagicNumber) {
+        p = end - kLegacyFooterSize;
+    } else {
+        return false;
+    }
+    return metaindex.DecodeFrom(p, end-12) && index.DecodeFrom(p, end-12);
+}
+
+// Decode the raw Snappy format
+inline bool SnappyUncompress(const char *p, size_t n, std::string& out) {
+    const char *limit = p + n;
+    uint32_t len;
+    if (!GetVarint32(p, limit, len)) return false;
+    out.clear();
+    out.reserve(len);
+    while (p < limit) {
+        unsigned char tag = uint8_t(*p++);
+        size_t length, offset;
+        switch (tag & 3) {
+            case 0: // literal
+                length = tag >> 2;
+                if (length >= 60) {
+                    size_t extra = length - 59;
+                    if (size_t(limit-p) < extra) return false;
+                    length = 0;
+                    for (size_t i = 0; i < extra; i++) length |= size_t(uint8_t(p[i])) << (8*i);
+                    p += extra;
+                }
+                length++;
+                if (size_t(limit-p) < length) return false;
+                out.append(p, length);
+                p += length;
+                continue;
+            case 1: // copy with 1-byte offset
+                if (limit-p < 1) return false;
+                length = ((tag >> 2) & 7) + 4;
+                offset = (size_t(tag >> 5) << 8) | uint8_t(*p++);
+                break;
+            case 2: // copy with 2-byte offset
+                if (limit-p < 2) return false;
+                length = (tag >> 2) + 1;
+                offset = uint8_t(p[0]) | (size_t(uint8_t(p[1])) << 8);
+                p += 2;
+                break;
+            default: // copy with 4-byte offset
+                if (limit-p < 4) return false;
+                length = (tag >> 2) + 1;
+                offset = DecodeFixed32(p);
+                p += 4;
+        }
+        if (offset == 0 || offset > out.size()) return false;
+        // copies may overlap their own output
+        size_t from = out.size() - offset;
+        for (size_t i = 0; i < length; i++) out.push_back(out[from+i]);
+    }
+    return out.size() == len;
+}
+
+// Get the contents of a block given it and its trailer, uncompressing it if
+// necessary. Returns false if the block is invalid or uses an unsupported
+// compression type (unsupported is then set).
+inline bool UncompressBlock(const char *data, size_t n, std::string& contents, bool& unsupported) {
+    unsupported = false;
+    if (n < kBlockTrailerSize) return false;
+    size_t size = n - kBlockTrailerSize;
+    switch (data[size]) {
+        case kNoCompression:
+            contents.assign(data, size);
+            return true;
+        case kSnappyCompression:
+            return SnappyUncompress(data, size, contents);
+    }
+    unsupported = true;
+    return false;
+}
+
+// Iterates over the entries of an (uncompressed) block
+class BlockIter {
+    const char *p_, *limit_;
+    std::string key_;
+    rocksdb::Slice value_;
+    bool corrupt_;
+
+public:
+    BlockIter(const std::string& contents) : corrupt_(false) {
+        const char *data = contents.data();
+        size_t n = contents.size();
+        if (n < 4) {
+            p_ = limit_ = data;
+            corrupt_ = true;
+            return;
+        }
+        uint64_t num_restarts = DecodeFixed32(data+n-4);
+        if (4*(num_restarts+1) > n) {
+            p_ = limit_ = data;
+            corrupt_ = true;
+            return;
+        }
+        p_ = data;
+        limit_ = data + n - 4*(num_restarts+1);
+    }
+
+    // advance to the next entry, returning false at the end of the block or
+    // if it's corrupt
+    bool Next() {
+        if (p_ >= limit_) return false;
+        uint32_t shared, non_shared, value_size;
+        if (!GetVarint32(p_, limit_, shared) || !GetVarint32(p_, limit_, non_shared)
+            || !GetVarint32(p_, limit_, value_size) || shared > key_.size()
+            || size_t(limit_-p_) < uint64_t(non_shared)+value_size) {
+            corrupt_ = true;
+            p_ = limit_;
+            return false;
+        }
+        key_.resize(shared);
+        key_.append(p_, non_shared);
+        p_ += non_shared;
+        value_ = rocksdb::Slice(p_, value_size);
+        p_ += value_size;
+        return true;
+    }
+
+    const std::string& key() const { return key_; }
+    const rocksdb::Slice& value() const { return value_; }
+    bool corrupt() const { return corrupt_; }
+};
+
+// Split an internal key into the user key, sequence number and value type
+inline bool ParseInternalKey(const rocksdb::Slice& ikey, rocksdb::Slice& user_key,
+                             uint64_t& sequence, unsigned char& type) {
+    if (ikey.size() < 8) return false;
+    uint64_t packed = DecodeFixed64(ikey.data()+ikey.size()-8);
+    user_key = rocksdb::Slice(ikey.data(), ikey.size()-8);
+    sequence = packed >> 8;
+    type = uint8_t(packed & 0xff);
+    return true;
+}
+
+}
@@ -0,0 +1,92 @@
+// CRC32C (Castagnoli) checksums, using the SSE4.2 instruction where the
+// compiler targets it and a lookup table otherwise.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace crc32c {
+
+#ifndef __SSE4_2__
+struct Table {
+    uint32_t t[256];
+    Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+            }
+            t[i] = c;
+        }
+    }
+};
+#endif
+
+// Extend crc with the n bytes at data. Start with crc=0 for a fresh checksum.
+inline uint32_t Extend(uint32_t crc, const char *data, size_t n) {
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+    uint64_t c = ~crc;
+#ifdef __SSE4_2__
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    for (; n; n--, p++) {
+        c = _mm_crc32_u8(uint32_t(c), *p);
+    }
+#else
+    static const Table table;
+    for (; n; n--, p++) {
+        c = table.t[(c ^ *p) & 0xff] ^ (uint32_t(c) >> 8);
+    }
+#endif
+    return ~uint32_t(c);
+}
+
+inline uint32_t Value(const char *data, size_t n) {
+    return Extend(0, data, n);
+}
+
+// Combine the checksums of two consecutive pieces of data, crc1 of the first
+// and crc2 of the second (of length n2), into that of the whole, by applying
+// n2 zero bytes to crc1 as powers of the CRC operator over GF(2), after zlib's
+// crc32_combine.
+inline uint32_t Combine(uint32_t crc1, uint32_t crc2, uint64_t n2) {
+    auto times = [](const uint32_t *mat, uint32_t vec) {
+        uint32_t sum = 0;
+        for (; vec; vec >>= 1, mat++) {
+            if (vec & 1) sum ^= *mat;
+        }
+        return sum;
+    };
+    auto square = [&times](uint32_t *sq, const uint32_t *mat) {
+        for (int i = 0; i < 32; i++) sq[i] = times(mat, mat[i]);
+    };
+    if (n2 == 0) return crc1;
+
+    // the operator for one zero bit, then two and four
+    uint32_t odd[32], even[32];
+    odd[0] = 0x82F63B78;
+    for (int i = 1; i < 32; i++) odd[i] = uint32_t(1) << (i-1);
+    square(even, odd);
+    square(odd, even);
+    // apply the operators for each set bit of n2 (in bytes)
+    do {
+        square(even, odd);
+        if (n2 & 1) crc1 = times(even, crc1);
+        n2 >>= 1;
+        if (!n2) break;
+        square(odd, even);
+        if (n2 & 1) crc1 = times(odd, crc1);
+        n2 >>= 1;
+    } while (n2);
+    return crc1 ^ crc2;
+}
+
+}
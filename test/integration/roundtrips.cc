@@ -1,12 +1,16 @@
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <chrono>
 #include "rocksdb/db.h"
 #include "rocksdb/env.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/table.h"
+#include "rocksdb/filter_policy.h"
 #include "gtest/gtest.h"
 #include "test_httpd.h"
 #include "RocksWorm/RocksWormHTTPEnv.h"
+#include "RocksWorm/RocksWormDeltaHTTPEnv.h"
 using namespace std;
 using namespace rocksdb;
 
@@ -39,10 +43,10 @@ void make_testdb1(string& ans) {
     ans = DBPATH;
 }
 
-int MakeRocksWormFileFromDB(const string& dbpath, string& ans) {
+int MakeRocksWormFileFromDB(const string& dbpath, string& ans, const string& options = "") {
     string fn = dbpath + ".rocksworm";
     stringstream cmd;
-    cmd << "build/bin/MakeRocksWormFileFromDB " << dbpath << " " << fn;
+    cmd << "build/bin/MakeRocksWormFileFromDB " << options << " " << dbpath << " " << fn;
     ans = fn;
     return system(cmd.str().c_str());
 }
@@ -335,6 +339,352 @@ TEST(roundtrip, univ) {
     httpd.Stop();
 }
 
+TEST(roundtrip, pack_metadata) {
+    string dbpath;
+    make_univdb(dbpath);
+
+    unsigned int open_requests[2];
+    for (int pack = 0; pack <= 1; pack++) {
+        string fn_RocksWorm;
+        ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,pack ? "--pack-metadata" : ""));
+
+        TestHTTPd httpd;
+        map<string,string> httpfiles;
+        httpfiles["/RocksWorm_integration_tests_roundtrip_pack_metadata"] = fn_RocksWorm;
+        httpd.Start(PORT,httpfiles);
+
+        stringstream localurl;
+        localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_pack_metadata";
+        RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+        Status s;
+        DB *db = nullptr;
+        Options dbopts;
+        ReadOptions rdopts;
+        string v;
+
+        dbopts.env = &env;
+        dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+        s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+        ASSERT_TRUE(s.ok());
+        open_requests[pack] = httpd.Requests();
+
+        for (uint64_t i = 0; i < 1000000; i += 997) {
+            uint64_t hi = __builtin_bswap64(hash64(i));
+            ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+            uint64_t j = *(uint64_t*)v.c_str();
+            ASSERT_EQ(i,j);
+        }
+
+        delete db;
+        httpd.Stop();
+    }
+
+    // the manifest, inline files and packed metadata come in at most two
+    // requests (if they exceed the first guess at the trailer size)
+    ASSERT_LE(open_requests[1], 2);
+    ASSERT_LT(open_requests[1], open_requests[0]);
+}
+
+TEST(roundtrip, global_filter) {
+    string dbpath;
+    make_univdb(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--global-filter 10"));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_global_filter"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_global_filter";
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    vector<string> children;
+    ASSERT_TRUE(env.GetChildren("/", &children).ok());
+    unsigned int requests = httpd.Requests();
+
+    // no false negatives, few false positives, and no requests
+    unsigned int false_positives = 0;
+    for (uint64_t i = 0; i < 100000; i++) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(env.MayContain(Slice((const char*)&hi, sizeof(uint64_t))));
+        hi = __builtin_bswap64(hash64(i+1000000));
+        if (env.MayContain(Slice((const char*)&hi, sizeof(uint64_t)))) {
+            false_positives++;
+        }
+    }
+    ASSERT_LT(false_positives, 3000);
+    ASSERT_EQ(requests, httpd.Requests());
+
+    httpd.Stop();
+
+    // without the filter, any key may be present
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+    httpd.Start(PORT,httpfiles);
+    RocksWormHTTPEnv env2(localurl.str(), HTTPEnvOptions());
+    ASSERT_TRUE(env2.MayContain(Slice("bogus")));
+    httpd.Stop();
+}
+
+TEST(roundtrip, global_index) {
+    string dbpath;
+    make_univdb(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--global-index 2"));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_global_index"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_global_index";
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    vector<string> children;
+    ASSERT_TRUE(env.GetChildren("/", &children).ok());
+
+    // each lookup takes one request
+    string v;
+    for (uint64_t i = 0; i < 1000000; i += 9973) {
+        unsigned int requests = httpd.Requests();
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(env.IndexedGet(Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(sizeof(uint64_t), v.size());
+        ASSERT_EQ(i,*(uint64_t*)v.c_str());
+        ASSERT_EQ(requests+1, httpd.Requests());
+
+        hi = __builtin_bswap64(hash64(i+1000000));
+        ASSERT_TRUE(env.IndexedGet(Slice((const char*)&hi, sizeof(uint64_t)), &v).IsNotFound());
+    }
+
+    httpd.Stop();
+
+    // without the index
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+    httpd.Start(PORT,httpfiles);
+    RocksWormHTTPEnv env2(localurl.str(), HTTPEnvOptions());
+    ASSERT_TRUE(env2.IndexedGet(Slice("bogus"), &v).IsNotSupported());
+    httpd.Stop();
+}
+
+TEST(roundtrip, paged_manifest) {
+    string dbpath;
+    make_univdb(dbpath);
+
+    vector<string> children[2];
+    for (int paged = 0; paged <= 1; paged++) {
+        string fn_RocksWorm;
+        ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,paged ? "--manifest-page 2" : ""));
+
+        TestHTTPd httpd;
+        map<string,string> httpfiles;
+        httpfiles["/RocksWorm_integration_tests_roundtrip_paged_manifest"] = fn_RocksWorm;
+        httpd.Start(PORT,httpfiles);
+
+        stringstream localurl;
+        localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_paged_manifest";
+        RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+        // lookups load pages as needed
+        uint64_t size;
+        ASSERT_TRUE(env.GetFileSize("/CURRENT", &size).ok());
+        ASSERT_TRUE(env.GetFileSize("/000000.sst", &size).IsNotFound());
+        ASSERT_TRUE(env.GetFileSize("/ZZZ", &size).IsNotFound());
+
+        Status s;
+        DB *db = nullptr;
+        Options dbopts;
+        ReadOptions rdopts;
+        string v;
+
+        dbopts.env = &env;
+        dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+        s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+        ASSERT_TRUE(s.ok());
+
+        for (uint64_t i = 0; i < 1000000; i += 997) {
+            uint64_t hi = __builtin_bswap64(hash64(i));
+            ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+            uint64_t j = *(uint64_t*)v.c_str();
+            ASSERT_EQ(i,j);
+        }
+        delete db;
+
+        if (paged) {
+            // GetChildren lists only CURRENT and its MANIFEST, without fetching any pages
+            unsigned int requests = httpd.Requests();
+            vector<string> listed;
+            ASSERT_TRUE(env.GetChildren("/", &listed).ok());
+            ASSERT_EQ(requests, httpd.Requests());
+            ASSERT_EQ(2, listed.size());
+            ASSERT_EQ(string("CURRENT"), listed[0]);
+            ASSERT_EQ(0, listed[1].find("MANIFEST-"));
+        }
+
+        ASSERT_TRUE(env.ListFiles(&children[paged]).ok());
+        httpd.Stop();
+    }
+
+    // ListFiles enumerates all the pages
+    ASSERT_GT(children[0].size(), 3);
+    ASSERT_EQ(children[0], children[1]);
+}
+
+TEST(roundtrip, stripes) {
+    string dbpath;
+    make_univdb(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--stripes 3 --global-index 2"));
+
+    // the stripes are written next to the RocksWorm file, and served next to
+    // it as well
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_stripes"] = fn_RocksWorm;
+    string dir = fn_RocksWorm.substr(0, fn_RocksWorm.rfind('/')+1);
+    string name = fn_RocksWorm.substr(dir.size());
+    for (int i = 1; i <= 3; i++) {
+        string stripe = to_string(i) + "." + name;
+        ASSERT_TRUE(ifstream(dir + stripe).good());
+        httpfiles["/" + stripe] = dir + stripe;
+    }
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_stripes";
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    for (uint64_t i = 0; i < 1000000; i += 997) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(i,*(uint64_t*)v.c_str());
+        ASSERT_TRUE(env.IndexedGet(Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(i,*(uint64_t*)v.c_str());
+    }
+    delete db;
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, mirrors) {
+    string dbpath;
+    make_testdb1(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+
+    // nothing listens on the primary URL's port; the mirror serves the file
+    // under another path
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/mirror/RocksWorm_integration_tests_roundtrip_mirrors"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl, mirrorurl;
+    localurl << "http://localhost:" << (PORT+1) << "/RocksWorm_integration_tests_roundtrip_mirrors";
+    mirrorurl << "http://localhost:" << PORT << "/mirror/RocksWorm_integration_tests_roundtrip_mirrors";
+    HTTPEnvOptions envopts;
+    envopts.mirror_urls.push_back(mirrorurl.str());
+    // failing over to the mirror mustn't wait out the retry delay
+    envopts.retry_initial_delay = 60000000;
+    envopts.http_stderr_log_level = InfoLogLevel::INFO_LEVEL;
+    RocksWormHTTPEnv env(localurl.str(), envopts);
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    auto t0 = chrono::steady_clock::now();
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    s = db->Get(rdopts, Slice("foo"), &v);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(string("Lorem"),v);
+
+    s = db->Get(rdopts, Slice("bar"), &v);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(string("ipsum"),v);
+    ASSERT_GT(30.0, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+
+    delete db;
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, mirror_not_found) {
+    string dbpath;
+    make_testdb1(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+
+    // the primary URL is 404; the mirror serves the file
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/mirror/RocksWorm_integration_tests_roundtrip_mirror_not_found"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl, mirrorurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_mirror_not_found";
+    mirrorurl << "http://localhost:" << PORT << "/mirror/RocksWorm_integration_tests_roundtrip_mirror_not_found";
+    HTTPEnvOptions envopts;
+    envopts.mirror_urls.push_back(mirrorurl.str());
+    // moving on to the mirror mustn't wait out the retry delay
+    envopts.retry_initial_delay = 60000000;
+    envopts.http_stderr_log_level = InfoLogLevel::INFO_LEVEL;
+    RocksWormHTTPEnv env(localurl.str(), envopts);
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    auto t0 = chrono::steady_clock::now();
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    s = db->Get(rdopts, Slice("foo"), &v);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(string("Lorem"),v);
+    ASSERT_GT(30.0, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+
+    delete db;
+
+    // a file missing from every mirror fails once each has been tried
+    stringstream bogusurl, bogusmirror;
+    bogusurl << "http://localhost:" << PORT << "/bogus";
+    bogusmirror << "http://localhost:" << PORT << "/mirror/bogus";
+    HTTPEnvOptions bogusopts = envopts;
+    bogusopts.mirror_urls = { bogusmirror.str() };
+    RocksWormHTTPEnv bogus(bogusurl.str(), bogusopts);
+    unsigned int requests = httpd.Requests();
+    uint64_t size;
+    ASSERT_FALSE(bogus.GetFileSize("/CURRENT", &size).ok());
+    ASSERT_EQ(requests+2, httpd.Requests());
+
+    httpd.Stop();
+}
+
 TEST(roundtrip, retry) {
     string dbpath;
     make_testdb1(dbpath);
@@ -378,3 +728,686 @@ TEST(roundtrip, retry) {
 
     httpd.Stop();
 }
+
+// A failed request retried against a server that ignores suffix ranges, sending
+// the whole file instead, must still fall back to HEAD and a GET of the tail
+TEST(roundtrip, retry_suffix_unsupported) {
+    string dbpath;
+    make_univdb(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+    // the whole file overflows the first guess at the trailer size
+    struct stat st;
+    ASSERT_EQ(0, stat(fn_RocksWorm.c_str(), &st));
+    ASSERT_LT(65536, st.st_size);
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_retry_suffix_unsupported"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+    httpd.SuffixRanges(false);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_retry_suffix_unsupported";
+    HTTPEnvOptions envopts;
+    envopts.http_stderr_log_level = InfoLogLevel::INFO_LEVEL;
+    RocksWormHTTPEnv env(localurl.str(), envopts);
+
+    httpd.FailNextRequests(1);
+    uint64_t size;
+    ASSERT_TRUE(env.GetFileSize("/CURRENT", &size).ok());
+    // the failure, the whole file, HEAD, the tail (and perhaps the rest of
+    // the trailer)
+    ASSERT_LE(4, httpd.Requests());
+    ASSERT_GE(5, httpd.Requests());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    for (uint64_t i = 0; i < 1000000; i += 9973) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        uint64_t j = *(uint64_t*)v.c_str();
+        ASSERT_EQ(i,j);
+    }
+    delete db;
+
+    httpd.Stop();
+}
+
+// The manifest of a small file comes in one round trip, whether or not the
+// server supports suffix ranges
+TEST(roundtrip, manifest_round_trips) {
+    string dbpath;
+    make_testdb1(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+    struct stat st;
+    ASSERT_EQ(0, stat(fn_RocksWorm.c_str(), &st));
+    ASSERT_GT(65536, st.st_size);
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_manifest_round_trips"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_manifest_round_trips";
+    for (int suffix = 1; suffix >= 0; suffix--) {
+        httpd.SuffixRanges(suffix);
+        RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+        unsigned int requests = httpd.Requests();
+        uint64_t size;
+        ASSERT_TRUE(env.GetFileSize("/CURRENT", &size).ok());
+        ASSERT_EQ(requests+1, httpd.Requests());
+    }
+
+    httpd.Stop();
+}
+
+// Several small SSTs, lying within one page of the range cache. Reading one of
+// them mustn't leave that page cut short at its end, for the others to find.
+TEST(roundtrip, range_cache) {
+    string DBPATH = "/tmp/RocksWorm_integration_tests_roundtrip_range_cache";
+    stringstream cmd;
+    cmd << "rm -rf " << DBPATH;
+    system(cmd.str().c_str());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    dbopts.create_if_missing = true;
+    dbopts.disable_auto_compactions = true;
+
+    s = DB::Open(dbopts,DBPATH,&db);
+    ASSERT_TRUE(s.ok());
+    for (uint64_t i = 0; i < 3; i++) {
+        for (uint64_t j = 0; j < 400; j++) {
+            stringstream k, v;
+            k << i << '_' << j;
+            v << hash64(i*400+j);
+            s = db->Put(WriteOptions(), k.str(), v.str()); ASSERT_TRUE(s.ok());
+        }
+        s = db->Flush(FlushOptions()); ASSERT_TRUE(s.ok());
+    }
+    vector<LiveFileMetaData> ssts;
+    db->GetLiveFilesMetaData(&ssts);
+    delete db;
+    ASSERT_EQ(3,ssts.size());
+
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(DBPATH,fn_RocksWorm));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_range_cache"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_range_cache";
+
+    // read each SST whole, in either order, through a fresh cache
+    for (int rev = 0; rev < 2; rev++) {
+        HTTPRangeCache cache(1048576);
+        HTTPEnvOptions envopts;
+        envopts.range_cache = &cache;
+        RocksWormHTTPEnv env(localurl.str(), envopts);
+
+        for (size_t i = 0; i < ssts.size(); i++) {
+            const LiveFileMetaData& sst = ssts[rev ? ssts.size()-1-i : i];
+            string contents;
+            ASSERT_TRUE(ReadFileToString(Env::Default(), DBPATH + sst.name, &contents).ok());
+
+            unique_ptr<RandomAccessFile> file;
+            s = env.NewRandomAccessFile(sst.name, &file, EnvOptions());
+            ASSERT_TRUE(s.ok());
+            unique_ptr<char[]> scratch(new char[contents.size()]);
+            Slice result;
+            s = file->Read(0, contents.size(), &result, scratch.get());
+            ASSERT_TRUE(s.ok());
+            ASSERT_EQ(contents, result.ToString());
+        }
+
+        dbopts = Options();
+        dbopts.env = &env;
+        dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+        s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+        ASSERT_TRUE(s.ok());
+        string v;
+        s = db->Get(ReadOptions(), Slice("1_234"), &v);
+        ASSERT_TRUE(s.ok());
+        stringstream want;
+        want << hash64(634);
+        ASSERT_EQ(want.str(), v);
+        delete db;
+    }
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, multiread) {
+    string dbpath;
+    make_testdb1(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_multiread"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_multiread";
+
+    // with and without multi-range support from the server
+    for (int multi = 1; multi >= 0; multi--) {
+        httpd.MultiRange(multi);
+        HTTPEnvOptions envopts;
+        envopts.multi_range_gap = 0;
+        envopts.multi_range_max = 4;
+        RocksWormHTTPEnv env(localurl.str(), envopts);
+
+        vector<string> children;
+        ASSERT_TRUE(env.GetChildren("/", &children).ok());
+
+        // many small reads scattered across the files
+        vector<RocksWormReadRequest> reqs;
+        vector<string> expected;
+        for (const auto& child : children) {
+            string fname = "/" + child, contents;
+            uint64_t file_size = 0;
+            ASSERT_TRUE(env.GetFileSize(fname, &file_size).ok());
+            ASSERT_TRUE(ReadFileToString(Env::Default(), dbpath + fname, &contents).ok());
+            ASSERT_EQ(file_size, contents.size());
+            for (uint64_t ofs = 0; ofs < file_size; ofs += 1 + ofs/2) {
+                RocksWormReadRequest req;
+                req.fname = fname;
+                req.offset = ofs;
+                req.n = std::min(uint64_t(7), file_size-ofs);
+                reqs.push_back(req);
+                expected.push_back(contents.substr(ofs, req.n));
+            }
+        }
+        ASSERT_LT(8, reqs.size());
+        string scratch(reqs.size()*7, 0);
+        for (size_t i = 0; i < reqs.size(); i++) {
+            reqs[i].scratch = &scratch[i*7];
+        }
+
+        ASSERT_TRUE(env.MultiRead(reqs).ok());
+        for (size_t i = 0; i < reqs.size(); i++) {
+            ASSERT_TRUE(reqs[i].status.ok());
+            ASSERT_EQ(expected[i], reqs[i].result.ToString());
+        }
+
+        RocksWormReadRequest bogus;
+        bogus.fname = "/bogus";
+        bogus.n = 1;
+        bogus.scratch = &scratch[0];
+        reqs.push_back(bogus);
+        ASSERT_TRUE(env.MultiRead(reqs).IsNotFound());
+        ASSERT_TRUE(reqs[0].status.ok());
+        ASSERT_TRUE(reqs.back().status.IsNotFound());
+    }
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, formats) {
+    string dbpath;
+    make_testdb1(dbpath);
+
+    for (string options : {"--format 0", "--align 1", "--align 65536"}) {
+        string fn_RocksWorm;
+        ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,options));
+
+        TestHTTPd httpd;
+        map<string,string> httpfiles;
+        httpfiles["/RocksWorm_integration_tests_roundtrip_formats"] = fn_RocksWorm;
+        httpd.Start(PORT,httpfiles);
+
+        stringstream localurl;
+        localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_formats";
+        RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+        Status s;
+        DB *db = nullptr;
+        Options dbopts;
+        ReadOptions rdopts;
+        string v;
+
+        dbopts.env = &env;
+        dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+
+        s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+        ASSERT_TRUE(s.ok());
+
+        s = db->Get(rdopts, Slice("foo"), &v);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(string("Lorem"),v);
+
+        s = db->Get(rdopts, Slice("bogus"), &v);
+        ASSERT_TRUE(s.IsNotFound());
+
+        delete db;
+
+        // checksums are recorded from format 1
+        uint32_t crc;
+        s = env.GetFileChecksum("/CURRENT", crc);
+        if (options == "--format 0") {
+            ASSERT_TRUE(s.IsNotSupported());
+        } else {
+            ASSERT_TRUE(s.ok());
+        }
+
+        // the files needed to open the database came with the manifest, so
+        // they're still readable with the server down
+        httpd.Stop();
+        for (string fn : {"CURRENT", "IDENTITY"}) {
+            ifstream local(dbpath + "/" + fn);
+            string expected((istreambuf_iterator<char>(local)), istreambuf_iterator<char>());
+            ASSERT_TRUE(expected.size() > 0);
+
+            unique_ptr<SequentialFile> file;
+            s = env.NewSequentialFile("/" + fn, &file, EnvOptions());
+            ASSERT_TRUE(s.ok());
+            string buf(expected.size() + 1, 0);
+            Slice contents;
+            s = file->Read(buf.size(), &contents, &buf[0]);
+            ASSERT_TRUE(s.ok());
+            ASSERT_EQ(expected, contents.ToString());
+        }
+    }
+}
+
+TEST(roundtrip, threads) {
+    string dbpath;
+    make_univdb(dbpath);
+
+    // the SSTs are copied in parallel when writing to a destination path, and
+    // sequentially to standard out, with the same result
+    auto slurp = [](const string& fn) {
+        ifstream f(fn, ios::binary);
+        return string((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+    };
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--threads 1 --pack-metadata"));
+    string serial = slurp(fn_RocksWorm);
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--threads 8 --pack-metadata"));
+    ASSERT_TRUE(serial == slurp(fn_RocksWorm));
+    stringstream cmd;
+    cmd << "build/bin/MakeRocksWormFileFromDB --pack-metadata " << dbpath << " > " << fn_RocksWorm;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+    ASSERT_TRUE(serial == slurp(fn_RocksWorm));
+}
+
+TEST(roundtrip, upload) {
+    string dbpath;
+    make_univdb(dbpath);
+
+    // upload the RocksWorm file and its stripes in several 5 MiB parts to the
+    // test server, which then serves them at the same URLs
+    string updir = "/tmp/RocksWorm_integration_tests_roundtrip_upload";
+    stringstream cmd;
+    cmd << "rm -rf " << updir << " && mkdir -p " << updir;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+    TestHTTPd httpd;
+    httpd.AcceptUploads(updir);
+    httpd.Start(PORT,map<string,string>());
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/uploads/RocksWorm_integration_tests_roundtrip_upload";
+    cmd.str("");
+    cmd << "build/bin/MakeRocksWormFileFromDB --upload " << localurl.str()
+        << " --part-size 5 --upload-parts 3 --stripes 2 " << dbpath;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+    ASSERT_GT(httpd.Parts(),3);
+
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    for (uint64_t i = 0; i < 1000000; i += 997) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(i,*(uint64_t*)v.c_str());
+    }
+    delete db;
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, optimize) {
+    string dbpath;
+    make_univdb(dbpath);
+    string fn_RocksWorm;
+    ASSERT_EQ(0,MakeRocksWormFileFromDB(dbpath,fn_RocksWorm,"--optimize --threads 2 --pack-metadata"));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_optimize"] = fn_RocksWorm;
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_optimize";
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    rocksdb::BlockBasedTableOptions bbto;
+    bbto.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+    dbopts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(bbto));
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    // at most one SST per thread (given the 64 MiB minimum), each with large
+    // blocks and a partitioned index
+    TablePropertiesCollection props;
+    ASSERT_TRUE(db->GetPropertiesOfAllTables(&props).ok());
+    ASSERT_GE(props.size(),1);
+    ASSERT_LE(props.size(),2);
+    for (auto& it : props) {
+        ASSERT_GT(it.second->index_partitions,0);
+        ASSERT_GT(it.second->data_size / it.second->num_data_blocks,128*1024);
+    }
+
+    for (uint64_t i = 0; i < 1000000; i += 997) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(i,*(uint64_t*)v.c_str());
+        hi = __builtin_bswap64(hash64(i+1000000));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).IsNotFound());
+    }
+    delete db;
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, bulk_load) {
+    // a TSV file of unsorted keys, each given twice; the second value wins
+    string fn_input = "/tmp/RocksWorm_integration_tests_roundtrip_bulk_load.tsv";
+    const unsigned int N = 100000;
+    {
+        ofstream input(fn_input);
+        for (int pass = 0; pass < 2; pass++) {
+            for (unsigned int i = 0; i < N; i++) {
+                unsigned int k = (i * 7919) % N;
+                input << "key" << k << "\t" << (pass ? "value" : "old") << k << "\n";
+            }
+        }
+        ASSERT_TRUE(input.good());
+    }
+    string fn_RocksWorm = "/tmp/RocksWorm_integration_tests_roundtrip_bulk_load.rocksworm";
+    stringstream cmd;
+    cmd << "build/bin/MakeRocksWormFileFromDB --bulk-load tsv --unsorted --pack-metadata "
+        << fn_input << " " << fn_RocksWorm;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_bulk_load"] = fn_RocksWorm;
+    httpfiles["/RocksWorm_integration_tests_roundtrip_bulk_load_binary"] =
+        "/tmp/RocksWorm_integration_tests_roundtrip_bulk_load_binary.rocksworm";
+    httpd.Start(PORT,httpfiles);
+
+    stringstream localurl;
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_bulk_load";
+    RocksWormHTTPEnv env(localurl.str(), HTTPEnvOptions());
+
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    ReadOptions rdopts;
+    string v;
+
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    unique_ptr<Iterator> it(db->NewIterator(rdopts));
+    unsigned int n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ASSERT_EQ("value" + it->key().ToString().substr(3), it->value().ToString());
+        n++;
+    }
+    ASSERT_TRUE(it->status().ok());
+    ASSERT_EQ(N,n);
+    it.reset();
+    for (unsigned int i = 0; i < N; i += 97) {
+        ASSERT_TRUE(db->Get(rdopts, "key" + to_string(i), &v).ok());
+        ASSERT_EQ("value" + to_string(i), v);
+    }
+    ASSERT_TRUE(db->Get(rdopts, "key" + to_string(N), &v).IsNotFound());
+    delete db;
+
+    // the same records in the binary format, with lengths little-endian, sorted
+    // in many small runs
+    string fn_binary = "/tmp/RocksWorm_integration_tests_roundtrip_bulk_load.bin";
+    {
+        ifstream tsv(fn_input);
+        ofstream input(fn_binary, ios::binary);
+        string line;
+        while (getline(tsv, line)) {
+            size_t tab = line.find('\t');
+            uint32_t n[2] = { uint32_t(tab), uint32_t(line.size()-tab-1) };
+            for (uint32_t x : n) {
+                char le[4] = { char(x), char(x >> 8), char(x >> 16), char(x >> 24) };
+                input.write(le, 4);
+            }
+            input << line.substr(0, tab) << line.substr(tab+1);
+        }
+        ASSERT_TRUE(input.good());
+    }
+    string fn_RocksWorm_binary = "/tmp/RocksWorm_integration_tests_roundtrip_bulk_load_binary.rocksworm";
+    cmd.str("");
+    cmd << "build/bin/MakeRocksWormFileFromDB --bulk-load binary --unsorted --sort-buffer 1 --threads 2 "
+        << fn_binary << " " << fn_RocksWorm_binary;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+
+    localurl.str("");
+    localurl << "http://localhost:" << PORT << "/RocksWorm_integration_tests_roundtrip_bulk_load_binary";
+    RocksWormHTTPEnv binary_env(localurl.str(), HTTPEnvOptions());
+    dbopts.env = &binary_env;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+    it.reset(db->NewIterator(rdopts));
+    n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ASSERT_EQ("value" + it->key().ToString().substr(3), it->value().ToString());
+        n++;
+    }
+    ASSERT_TRUE(it->status().ok());
+    ASSERT_EQ(N,n);
+    it.reset();
+    delete db;
+
+    httpd.Stop();
+}
+
+TEST(roundtrip, delta) {
+    // a striped RocksWorm file of the database, to serve as the base
+    string dbpath;
+    make_univdb(dbpath);
+    string dir = "/tmp/", base_name = "RocksWorm_integration_tests_roundtrip_delta_base";
+    string delta_name = "RocksWorm_integration_tests_roundtrip_delta";
+    stringstream cmd;
+    cmd << "build/bin/MakeRocksWormFileFromDB --stripes 2 " << dbpath << " " << dir << base_name;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+
+    TestHTTPd httpd;
+    map<string,string> httpfiles;
+    for (auto& name : {base_name, "1." + base_name, "2." + base_name, delta_name}) {
+        httpfiles["/" + name] = dir + name;
+    }
+    httpd.Start(PORT,httpfiles);
+    stringstream base_url, delta_url;
+    base_url << "http://localhost:" << PORT << "/" << base_name;
+    delta_url << "http://localhost:" << PORT << "/" << delta_name;
+
+    // add some keys and overwrite others, leaving the existing SSTs as they
+    // are, then write a delta holding only the new SST
+    Status s;
+    DB *db = nullptr;
+    Options dbopts;
+    dbopts.compaction_style = kCompactionStyleUniversal;
+    dbopts.disable_auto_compactions = true;
+    s = DB::Open(dbopts,dbpath,&db);
+    ASSERT_TRUE(s.ok());
+    auto put = [&](uint64_t i) {
+        uint64_t hi = __builtin_bswap64(hash64(i)), v = i+1;
+        s = db->Put(WriteOptions(), Slice((const char*)&hi,sizeof(uint64_t)), Slice((const char*)&v,sizeof(uint64_t)));
+        ASSERT_TRUE(s.ok());
+    };
+    for (uint64_t i = 0; i < 1000000; i += 997) put(i);
+    for (uint64_t i = 1000000; i < 1001000; i++) put(i);
+    s = db->Flush(FlushOptions()); ASSERT_TRUE(s.ok());
+    delete db;
+    db = nullptr;
+
+    cmd.str("");
+    cmd << "build/bin/MakeRocksWormFileFromDB --pack-metadata --base " << base_url.str() << " "
+        << dbpath << " " << dir << delta_name;
+    ASSERT_EQ(0,system(cmd.str().c_str()));
+    struct stat base_st, delta_st;
+    ASSERT_EQ(0,stat((dir + base_name).c_str(),&base_st));
+    ASSERT_EQ(0,stat((dir + delta_name).c_str(),&delta_st));
+    ASSERT_LT(delta_st.st_size*10, base_st.st_size);
+
+    // the delta refers to the base's objects, so only RocksWormDeltaHTTPEnv
+    // can read it
+    {
+        RocksWormHTTPEnv env(delta_url.str(), HTTPEnvOptions());
+        Options plainopts;
+        plainopts.env = &env;
+        plainopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+        ASSERT_FALSE(rocksdb::DB::OpenForReadOnly(plainopts,"",&db).ok());
+    }
+
+    RocksWormDeltaHTTPEnv env(delta_url.str(), HTTPEnvOptions());
+    ReadOptions rdopts;
+    string v;
+    dbopts = Options();
+    dbopts.env = &env;
+    dbopts.info_log_level = InfoLogLevel::WARN_LEVEL;
+    s = rocksdb::DB::OpenForReadOnly(dbopts,"",&db);
+    ASSERT_TRUE(s.ok());
+
+    for (uint64_t i = 0; i < 1001000; i += 331) {
+        uint64_t hi = __builtin_bswap64(hash64(i));
+        ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).ok());
+        ASSERT_EQ(i >= 1000000 || i%997 == 0 ? i+1 : i, *(uint64_t*)v.c_str());
+    }
+    uint64_t hi = __builtin_bswap64(hash64(1001000));
+    ASSERT_TRUE(db->Get(rdopts, Slice((const char*)&hi, sizeof(uint64_t)), &v).IsNotFound());
+    delete db;
+
+    // envs on the base and the delta, sharing range and disk caches: the SSTs
+    // they share are cached under their objects' URLs, so once read through
+    // the base, the delta reads them from the caches
+    string cache_dir = dir + "RocksWorm_integration_tests_roundtrip_delta_cache";
+    cmd.str("");
+    cmd << "rm -rf " << cache_dir;
+    system(cmd.str().c_str());
+    HTTPRangeCache range_cache(256 << 20);
+    HTTPDiskCache disk_cache(cache_dir, 256 << 20);
+    ASSERT_TRUE(disk_cache.Open().ok());
+    HTTPEnvOptions cacheopts;
+    cacheopts.range_cache = &range_cache;
+    cacheopts.disk_cache = &disk_cache;
+    RocksWormHTTPEnv cached_base(base_url.str(), cacheopts);
+    RocksWormDeltaHTTPEnv cached_delta(delta_url.str(), cacheopts);
+
+    vector<string> children, shared;
+    ASSERT_TRUE(cached_delta.GetChildren("/", &children).ok());
+    for (const auto& child : children) {
+        string fname = "/" + child;
+        RocksWormFileLocation in_delta, in_base;
+        ASSERT_TRUE(cached_delta.LocateFile(fname, in_delta).ok());
+        if (cached_base.LocateFile(fname, in_base).ok() && in_base.object_url == in_delta.object_url) {
+            ASSERT_EQ(in_base.offset, in_delta.offset);
+            shared.push_back(fname);
+        }
+    }
+    ASSERT_FALSE(shared.empty());
+
+    auto read_whole = [](Env& env, const string& fname, string& contents) {
+        uint64_t size = 0;
+        ASSERT_TRUE(env.GetFileSize(fname, &size).ok());
+        unique_ptr<RandomAccessFile> file;
+        ASSERT_TRUE(env.NewRandomAccessFile(fname, &file, EnvOptions()).ok());
+        contents.resize(size);
+        Slice result;
+        ASSERT_TRUE(file->Read(0, size, &result, &contents[0]).ok());
+        ASSERT_EQ(size, result.size());
+        if (result.data() != contents.data()) {
+            contents = result.ToString();
+        }
+    };
+
+    map<string,string> from_base;
+    for (const auto& fname : shared) {
+        read_whole(cached_base, fname, from_base[fname]);
+    }
+    HTTPRangeCache::Stats range_before = range_cache.GetStats();
+    for (const auto& fname : shared) {
+        string contents;
+        read_whole(cached_delta, fname, contents);
+        ASSERT_EQ(from_base[fname], contents);
+    }
+    HTTPRangeCache::Stats range_after = range_cache.GetStats();
+    ASSERT_GT(range_after.hits, range_before.hits);
+    ASSERT_EQ(range_before.misses, range_after.misses);
+
+    // and with a fresh range cache, from the disk cache
+    HTTPRangeCache fresh_range_cache(256 << 20);
+    cacheopts.range_cache = &fresh_range_cache;
+    RocksWormDeltaHTTPEnv cached_delta2(delta_url.str(), cacheopts);
+    HTTPDiskCache::Stats disk_before = disk_cache.GetStats();
+    for (const auto& fname : shared) {
+        string contents;
+        read_whole(cached_delta2, fname, contents);
+        ASSERT_EQ(from_base[fname], contents);
+    }
+    HTTPDiskCache::Stats disk_after = disk_cache.GetStats();
+    ASSERT_GT(disk_after.hits, disk_before.hits);
+    ASSERT_EQ(disk_before.misses, disk_after.misses);
+
+    // once the base's objects change (per their ETags), the delta is rejected
+    cmd.str("");
+    cmd << "touch -m -d @1";
+    for (auto& name : {base_name, "1." + base_name, "2." + base_name}) {
+        cmd << " " << dir << name;
+    }
+    ASSERT_EQ(0, system(cmd.str().c_str()));
+    {
+        RocksWormDeltaHTTPEnv changed_env(delta_url.str(), HTTPEnvOptions());
+        dbopts.env = &changed_env;
+        ASSERT_FALSE(rocksdb::DB::OpenForReadOnly(dbopts,"",&db).ok());
+    }
+
+    httpd.Stop();
+}
@@ -2,6 +2,8 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <unistd.h>
 using namespace std;
 
 int on_request(void *cls, struct MHD_Connection *connection,
@@ -44,18 +46,109 @@ void TestHTTPd::Stop() {
     }
 }
 
-bool get_range_header(MHD_Connection *connection, size_t& lo, size_t& hi) {
+// parse the range header into inclusive [lo,hi] pairs, resolving suffix
+// ranges ("-N") against the file size (or ignoring the header if they're
+// unsupported)
+bool get_range_header(MHD_Connection *connection, size_t file_size, bool suffix_ranges,
+                      vector<pair<size_t,size_t>>& ranges) {
+    ranges.clear();
     const char* crangehdr = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "range");
     if (!crangehdr) return false;
     string rangehdr(crangehdr);
-    if (rangehdr.size() < 9 || rangehdr.substr(0,6) != "bytes=") return false;
-    size_t dashpos = rangehdr.find('-');
-    if (dashpos == string::npos || rangehdr.rfind('-') != dashpos || dashpos < 7 || dashpos == rangehdr.size()-1) return false;
-    string slo = rangehdr.substr(6,dashpos-6);
-    string shi = rangehdr.substr(dashpos+1);
-    lo = strtoull(slo.c_str(), nullptr, 10);
-    hi = strtoull(shi.c_str(), nullptr, 10);
-    return true;
+    if (rangehdr.size() < 8 || rangehdr.substr(0,6) != "bytes=") return false;
+    istringstream specs(rangehdr.substr(6));
+    string spec;
+    while (getline(specs, spec, ',')) {
+        size_t dashpos = spec.find('-');
+        if (dashpos == string::npos || spec.rfind('-') != dashpos || dashpos == spec.size()-1) {
+            ranges.clear();
+            return false;
+        }
+        if (dashpos == 0) {
+            if (!suffix_ranges) {
+                ranges.clear();
+                return false;
+            }
+            size_t suffix = strtoull(spec.substr(1).c_str(), nullptr, 10);
+            suffix = min(suffix, file_size);
+            ranges.push_back(make_pair(file_size-suffix, file_size-1));
+            continue;
+        }
+        string slo = spec.substr(0,dashpos);
+        string shi = spec.substr(dashpos+1);
+        ranges.push_back(make_pair(strtoull(slo.c_str(), nullptr, 10), strtoull(shi.c_str(), nullptr, 10)));
+    }
+    return ranges.size() > 0;
+}
+
+int collect_argument(void *cls, enum MHD_ValueKind kind, const char *key, const char *value) {
+    (*reinterpret_cast<map<string,string>*>(cls))[key] = value ? value : "";
+    return MHD_YES;
+}
+
+// the text of each <tag> element in an XML document
+vector<string> xml_elements(const string& xml, const string& tag) {
+    vector<string> ans;
+    size_t pos = 0;
+    while ((pos = xml.find("<" + tag + ">", pos)) != string::npos) {
+        pos += tag.size()+2;
+        size_t end = xml.find("</" + tag + ">", pos);
+        if (end == string::npos) break;
+        ans.push_back(xml.substr(pos, end-pos));
+        pos = end;
+    }
+    return ans;
+}
+
+int TestHTTPd::OnUpload(MHD_Connection *connection, const char *url, const char *method,
+                        const string& body, unsigned int& response_code, string& response_body,
+                        string& etag) {
+    map<string,string> args;
+    MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND, &collect_argument, &args);
+    lock_guard<mutex> lock(mu_);
+    response_code = 404;
+    if (string(method) == "POST" && args.count("uploads")) {
+        string id = to_string(++next_upload_id_);
+        uploads_[id].clear();
+        response_code = 200;
+        response_body = "<InitiateMultipartUploadResult><UploadId>" + id + "</UploadId></InitiateMultipartUploadResult>";
+        return MHD_YES;
+    }
+    auto upload = uploads_.find(args["uploadId"]);
+    if (upload == uploads_.end()) return MHD_YES;
+    auto part_etag = [](unsigned int n, size_t size) {
+        return "\"" + to_string(n) + "-" + to_string(size) + "\"";
+    };
+    if (string(method) == "PUT") {
+        unsigned int n = strtoul(args["partNumber"].c_str(), nullptr, 10);
+        upload->second[n] = body;
+        ++parts_;
+        response_code = 200;
+        etag = part_etag(n, body.size());
+    } else if (string(method) == "POST") {
+        // assemble the listed parts, which must match those uploaded
+        vector<string> numbers = xml_elements(body, "PartNumber"), etags = xml_elements(body, "ETag");
+        string path = upload_dir_ + "/" + to_string(next_upload_id_) + ".upload";
+        ofstream out(path, ios::binary);
+        response_code = 400;
+        if (numbers.empty() || numbers.size() != etags.size()) return MHD_YES;
+        for (size_t i = 0; i < numbers.size(); i++) {
+            unsigned int n = strtoul(numbers[i].c_str(), nullptr, 10);
+            auto part = upload->second.find(n);
+            if (part == upload->second.end() || etags[i] != part_etag(n, part->second.size())) return MHD_YES;
+            out.write(part->second.data(), part->second.size());
+        }
+        out.close();
+        if (!out.good()) return MHD_YES;
+        files_[url] = path;
+        uploads_.erase(upload);
+        response_code = 200;
+        response_body = "<CompleteMultipartUploadResult><Key>" + string(url) + "</Key></CompleteMultipartUploadResult>";
+    } else if (string(method) == "DELETE") {
+        uploads_.erase(upload);
+        response_code = 204;
+    }
+    return MHD_YES;
 }
 
 int TestHTTPd::OnRequest(MHD_Connection *connection,
@@ -66,25 +159,90 @@ int TestHTTPd::OnRequest(MHD_Connection *connection,
     unsigned int response_code = 404;
     int ret;
 
-    if (requests_to_fail_ == 0) {
+    // gather the request bodies of uploads across calls, before responding
+    bool is_upload = upload_dir_.size() && string(method) != "GET" && string(method) != "HEAD";
+    unique_ptr<string> body;
+    if (is_upload) {
+        if (*con_cls == nullptr) {
+            *con_cls = new string();
+            return MHD_YES;
+        }
+        if (*upload_data_size) {
+            reinterpret_cast<string*>(*con_cls)->append(upload_data, *upload_data_size);
+            *upload_data_size = 0;
+            return MHD_YES;
+        }
+        body.reset(reinterpret_cast<string*>(*con_cls));
+        *con_cls = nullptr;
+    }
+
+    ++requests_;
+    string entry_path;
+    if (requests_to_fail_ == 0 && !is_upload) {
+        lock_guard<mutex> lock(mu_);
         auto entry = files_.find(url);
-        if (entry != files_.end()) {
-            int fd = open(entry->second.c_str(), O_RDONLY);
+        if (entry != files_.end()) entry_path = entry->second;
+    }
+    if (requests_to_fail_ == 0 && is_upload) {
+        string response_body, etag;
+        if (OnUpload(connection, url, method, *body, response_code, response_body, etag) != MHD_YES) return MHD_NO;
+        if (!(response = MHD_create_response_from_buffer(response_body.size(), (void*) response_body.data(), MHD_RESPMEM_MUST_COPY))) return MHD_NO;
+        if (etag.size()) MHD_add_response_header(response, "ETag", etag.c_str());
+    } else if (requests_to_fail_ == 0) {
+        if (entry_path.size()) {
+            int fd = open(entry_path.c_str(), O_RDONLY);
             if (fd > 0) {
                 struct stat st;
                 if (fstat(fd,&st) == 0) {
-                    size_t lo, hi;
-                    if (get_range_header(connection,lo,hi)) {
+                    vector<pair<size_t,size_t>> ranges;
+                    bool valid = true;
+                    get_range_header(connection,st.st_size,suffix_ranges_,ranges);
+                    for (auto& r : ranges) {
+                        valid = valid && r.second >= r.first && r.first < size_t(st.st_size) && r.second < size_t(st.st_size);
+                    }
+                    if (!valid) {
+                        close(fd);
+                        response_code = 416;
+                    } else if (ranges.size() == 1) {
+                        size_t lo = ranges[0].first, hi = ranges[0].second;
                         //cout << lo << " - " << hi << endl;
-                        if (hi >= lo && lo < size_t(st.st_size) && hi < size_t(st.st_size)) {
-                            response_code = 206;
-                            // TODO set content-range response header, "lo-hi/st.st_size"
-                            if (!(response = MHD_create_response_from_fd_at_offset(hi-lo+1, fd, lo))) return MHD_NO;
-                        } else response_code = 416;
+                        response_code = 206;
+                        if (!(response = MHD_create_response_from_fd_at_offset(hi-lo+1, fd, lo))) return MHD_NO;
+                        ostringstream content_range;
+                        content_range << "bytes " << lo << "-" << hi << "/" << st.st_size;
+                        MHD_add_response_header(response, "Content-Range", content_range.str().c_str());
+                    } else if (ranges.size() > 1 && multi_range_) {
+                        // multipart/byteranges response
+                        const string boundary = "RocksWormTestHTTPdBoundary";
+                        string body;
+                        for (auto& r : ranges) {
+                            ostringstream part;
+                            part << "\r\n--" << boundary << "\r\n"
+                                 << "Content-Type: application/octet-stream\r\n"
+                                 << "Content-Range: bytes " << r.first << "-" << r.second << "/" << st.st_size << "\r\n\r\n";
+                            body += part.str();
+                            size_t n = r.second-r.first+1, pos = body.size();
+                            body.resize(pos+n);
+                            if (pread(fd, &body[pos], n, r.first) != ssize_t(n)) {
+                                close(fd);
+                                return MHD_NO;
+                            }
+                        }
+                        body += "\r\n--" + boundary + "--\r\n";
+                        close(fd);
+                        response_code = 206;
+                        if (!(response = MHD_create_response_from_buffer(body.size(), (void*) body.data(), MHD_RESPMEM_MUST_COPY))) return MHD_NO;
+                        MHD_add_response_header(response, "Content-Type", ("multipart/byteranges; boundary=" + boundary).c_str());
                     } else {
                         response_code = 200;
                         if (!(response = MHD_create_response_from_fd(st.st_size, fd))) return MHD_NO;
                     }
+                    if (response) {
+                        // a validator, for the disk cache
+                        ostringstream etag;
+                        etag << '"' << st.st_size << '-' << st.st_mtime << '"';
+                        MHD_add_response_header(response, "ETag", etag.str().c_str());
+                    }
                 } else response_code = 500;
             }
         }
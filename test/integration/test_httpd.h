@@ -13,12 +13,28 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 class TestHTTPd {
 	unsigned short port_;
 	std::map<std::string,std::string> files_;
 	MHD_Daemon *d_;
 	unsigned int requests_to_fail_;
+	bool multi_range_;
+	bool suffix_ranges_;
+	std::atomic<unsigned int> requests_;
+	// multipart uploads in progress, by upload ID, and completed uploads
+	// (added to files_ under mu_)
+	std::mutex mu_;
+	std::string upload_dir_;
+	unsigned int next_upload_id_;
+	std::map<std::string,std::map<unsigned int,std::string>> uploads_;
+	unsigned int parts_;
+
+	int OnUpload(MHD_Connection *connection, const char *url, const char *method,
+	             const std::string& body, unsigned int& response_code, std::string& response_body,
+	             std::string& etag);
 
 	friend int on_request(void *cls, struct MHD_Connection *connection,
                      const char *url, const char *method,
@@ -31,11 +47,23 @@ class TestHTTPd {
                      size_t *upload_data_size, void **con_cls);
 
 public:
-	TestHTTPd() : d_(nullptr), requests_to_fail_(0) {}
+	TestHTTPd() : d_(nullptr), requests_to_fail_(0), multi_range_(true), suffix_ranges_(true), requests_(0), next_upload_id_(0), parts_(0) {}
 	virtual ~TestHTTPd();
 
 	bool Start(unsigned short port, const std::map<std::string,std::string>& files);
 	void FailNextRequests(unsigned int n) { requests_to_fail_ = n; }
+	// if disabled, multi-range requests get the whole file (200)
+	void MultiRange(bool enabled) { multi_range_ = enabled; }
+	// if disabled, suffix range requests ("-N") get the whole file (200)
+	void SuffixRanges(bool enabled) { suffix_ranges_ = enabled; }
+	// number of requests received
+	unsigned int Requests() const { return requests_; }
+	// accept S3-style multipart uploads (POST ?uploads, PUT ?partNumber&uploadId,
+	// POST/DELETE ?uploadId), storing completed objects in dir and serving them
+	// at their paths
+	void AcceptUploads(const std::string& dir) { upload_dir_ = dir; }
+	// number of parts uploaded
+	unsigned int Parts() const { return parts_; }
 	void Stop();
 };
 
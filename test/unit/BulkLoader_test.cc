@@ -0,0 +1,73 @@
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "RocksWorm/BulkLoader.h"
+using namespace std;
+using namespace rocksdb;
+
+const char *BULK_LOADER_DIR = "/tmp/RocksWorm_unit_tests_BulkLoader";
+
+static string bulk_key(unsigned int i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "key%08u", i);
+    return buf;
+}
+
+TEST(BulkLoader, Unsorted) {
+    ASSERT_EQ(0, system((string("rm -rf ") + BULK_LOADER_DIR + " && mkdir -p " + BULK_LOADER_DIR).c_str()));
+    string dbpath = string(BULK_LOADER_DIR) + "/unsorted";
+
+    // small runs and SSTs, so that there are many of each; every key is added
+    // twice, and the second value must win
+    BulkLoaderOptions opts;
+    opts.sorted = false;
+    opts.sort_buffer_size = 65536;
+    opts.target_file_size = 262144;
+    BulkLoader loader(dbpath, opts);
+    const unsigned int N = 100000;
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < N; i++) {
+            unsigned int k = (i * 7919) % N;
+            ASSERT_TRUE(loader.Add(bulk_key(k), (pass ? "v" : "old") + to_string(k)).ok());
+        }
+    }
+    ASSERT_TRUE(loader.Finish().ok());
+    ASSERT_EQ(N, loader.entries());
+    ASSERT_GT(loader.ssts(), 1);
+
+    DB *rawdb = nullptr;
+    ASSERT_TRUE(DB::OpenForReadOnly(Options(), dbpath, &rawdb).ok());
+    unique_ptr<DB> db(rawdb);
+    unique_ptr<Iterator> it(db->NewIterator(ReadOptions()));
+    unsigned int i = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next(), i++) {
+        ASSERT_EQ(bulk_key(i), it->key().ToString());
+        ASSERT_EQ("v" + to_string(i), it->value().ToString());
+    }
+    ASSERT_TRUE(it->status().ok());
+    ASSERT_EQ(N, i);
+
+    // the SSTs were ingested into one level
+    vector<LiveFileMetaData> md;
+    db->GetLiveFilesMetaData(&md);
+    ASSERT_EQ(loader.ssts(), md.size());
+    for (auto& f : md) {
+        ASSERT_EQ(md[0].level, f.level);
+    }
+}
+
+TEST(BulkLoader, OutOfOrder) {
+    ASSERT_EQ(0, system((string("rm -rf ") + BULK_LOADER_DIR + " && mkdir -p " + BULK_LOADER_DIR).c_str()));
+    string dbpath = string(BULK_LOADER_DIR) + "/sorted";
+
+    BulkLoader loader(dbpath, BulkLoaderOptions());
+    ASSERT_TRUE(loader.Add("b", "1").ok());
+    ASSERT_TRUE(loader.Add("a", "2").IsInvalidArgument());
+    ASSERT_TRUE(loader.Add("c", "3").IsInvalidArgument());
+    ASSERT_FALSE(loader.Finish().ok());
+
+    DB *rawdb = nullptr;
+    ASSERT_FALSE(DB::OpenForReadOnly(Options(), dbpath, &rawdb).ok());
+}
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <sstream>
+#include <string.h>
+#include <thread>
+#include <algorithm>
 #include "gtest/gtest.h"
 #include "RocksWorm/GivenManifestHTTPEnv.h"
 using namespace std;
@@ -84,6 +87,424 @@ TEST(GivenManifestHTTPEnv, Read) {
     ASSERT_EQ(sz/2, data.size());
 }
 
+TEST(GivenManifestHTTPEnv, SequentialChunks) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.sequential_chunk_size = 100;
+    GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<SequentialFile> f;
+    Status s = env.NewSequentialFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+    if (data.data() != whole) memmove(whole, data.data(), sz);
+
+    // reads straddling chunk boundaries, with skips
+    s = env.NewSequentialFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char buf[sz];
+    uint64_t pos = 0;
+    for (int i = 0; pos < sz; i++) {
+        if (i % 5 == 4) {
+            ASSERT_TRUE(f->Skip(150).ok());
+            pos += 150;
+            continue;
+        }
+        s = f->Read(37, &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(std::min(uint64_t(37), pos < sz ? sz-pos : 0), data.size());
+        ASSERT_EQ(0, memcmp(whole+pos, data.data(), data.size()));
+        pos += data.size();
+    }
+    s = f->Read(37, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, data.size());
+}
+
+TEST(GivenManifestHTTPEnv, Readahead) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.readahead_initial_size = 64;
+    opts.readahead_max_size = 256;
+    GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(0, sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+
+    // small sequential reads, served increasingly from read-ahead windows,
+    // should reproduce the whole
+    s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char buf[16];
+    for (uint64_t ofs = 0; ofs < sz; ofs += sizeof(buf)) {
+        s = f->Read(ofs, sizeof(buf), &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(sizeof(buf), data.size());
+        ASSERT_EQ(0, memcmp(whole+ofs, data.data(), sizeof(buf)));
+    }
+
+    // a random read in between
+    s = f->Read(100, 10, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+100, data.data(), 10));
+}
+
+// records the offset of each GET request formulated, whether synchronous or a
+// prefetch
+class RequestLoggingEnv : public GivenManifestHTTPEnv {
+public:
+    mutex mu;
+    vector<uint64_t> offsets;
+
+    RequestLoggingEnv(const string& base_url, const manifest& the_manifest, const HTTPEnvOptions& opts)
+        : GivenManifestHTTPEnv(base_url, the_manifest, opts) {}
+
+    Status PrepareGet(const string& fname, uint64_t offset, size_t n,
+                      string& url, HTTP::headers& request_headers) override {
+        {
+            lock_guard<mutex> lock(mu);
+            offsets.push_back(offset);
+        }
+        return GivenManifestHTTPEnv::PrepareGet(fname, offset, n, url, request_headers);
+    }
+
+    bool Requested(uint64_t offset) {
+        lock_guard<mutex> lock(mu);
+        return find(offsets.begin(), offsets.end(), offset) != offsets.end();
+    }
+};
+
+TEST(GivenManifestHTTPEnv, ReadaheadAfterSeek) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.readahead_initial_size = 64;
+    opts.readahead_max_size = 256;
+    RequestLoggingEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(0, sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+
+    // a brief sequential run, leaving a prefetch of the window after it
+    // unread
+    s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char buf[16];
+    for (uint64_t ofs = 0; ofs < 32; ofs += sizeof(buf)) {
+        s = f->Read(ofs, sizeof(buf), &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(0, memcmp(whole+ofs, data.data(), sizeof(buf)));
+    }
+
+    // a sequential run elsewhere should still prefetch the window after the
+    // one its second read fetches, [456,520)
+    ASSERT_FALSE(env.Requested(520));
+    for (uint64_t ofs = 440; ofs < 600; ofs += sizeof(buf)) {
+        s = f->Read(ofs, sizeof(buf), &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(0, memcmp(whole+ofs, data.data(), sizeof(buf)));
+        if (ofs == 456) {
+            ASSERT_TRUE(env.Requested(520));
+        }
+    }
+}
+
+TEST(GivenManifestHTTPEnv, PrefetchHint) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.readahead_initial_size = 64;
+    opts.readahead_max_size = 256;
+    GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(0, sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+
+    // reads served from explicit prefetches, including beyond EOF
+    s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    ASSERT_TRUE(f->Prefetch(512, 1024).ok());
+    ASSERT_TRUE(f->Prefetch(100, 50).ok());
+    ASSERT_TRUE(f->Prefetch(2048, 10).ok());
+    char buf[sz];
+    s = f->Read(600, 100, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+600, data.data(), 100));
+    s = f->Read(120, 30, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+120, data.data(), 30));
+    s = f->Read(1000, 100, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(24, data.size());
+    ASSERT_EQ(0, memcmp(whole+1000, data.data(), 24));
+
+    // each access pattern hint, followed by sequential reads
+    RandomAccessFile::AccessPattern hints[] = {
+        RandomAccessFile::WILLNEED, RandomAccessFile::SEQUENTIAL, RandomAccessFile::RANDOM,
+        RandomAccessFile::DONTNEED, RandomAccessFile::NORMAL
+    };
+    for (auto hint : hints) {
+        s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+        ASSERT_TRUE(s.ok());
+        f->Hint(hint);
+        for (uint64_t ofs = 0; ofs < sz; ofs += 16) {
+            s = f->Read(ofs, 16, &data, buf);
+            ASSERT_TRUE(s.ok());
+            ASSERT_EQ(16, data.size());
+            ASSERT_EQ(0, memcmp(whole+ofs, data.data(), 16));
+        }
+        f->Hint(RandomAccessFile::DONTNEED);
+        s = f->Read(300, 16, &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(0, memcmp(whole+300, data.data(), 16));
+    }
+}
+
+TEST(GivenManifestHTTPEnv, PrefetchAfterSeeks) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.readahead_initial_size = 64;
+    opts.readahead_max_size = 256;
+    RequestLoggingEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(0, sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+
+    // brief sequential runs here and there, each leaving a prefetch of the
+    // window after it unread
+    s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char buf[16];
+    uint64_t runs[] = { 0, 512, 128, 640, 256, 768 };
+    for (uint64_t ofs : runs) {
+        for (uint64_t i = 0; i < 2; i++) {
+            s = f->Read(ofs+16*i, 16, &data, buf);
+            ASSERT_TRUE(s.ok());
+            ASSERT_EQ(0, memcmp(whole+ofs+16*i, data.data(), 16));
+        }
+    }
+
+    // another sequential run should still prefetch the window after the one
+    // its second read fetches, [456,520)
+    ASSERT_FALSE(env.Requested(520));
+    for (uint64_t ofs = 440; ofs < 600; ofs += 16) {
+        s = f->Read(ofs, 16, &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(0, memcmp(whole+ofs, data.data(), 16));
+        if (ofs == 456) {
+            ASSERT_TRUE(env.Requested(520));
+        }
+    }
+
+    // and DONTNEED drops any prefetches in flight
+    f->Hint(RandomAccessFile::DONTNEED);
+    s = f->Read(300, 16, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+300, data.data(), 16));
+}
+
+TEST(GivenManifestHTTPEnv, PrefetchThroughCache) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    char whole[sz];
+    Slice data;
+    {
+        GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, HTTPEnvOptions());
+        unique_ptr<RandomAccessFile> f;
+        Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+        ASSERT_TRUE(s.ok());
+        s = f->Read(0, sz, &data, whole);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(sz, data.size());
+    }
+
+    HTTPRangeCache cache(1048576, 256);
+    HTTPEnvOptions opts;
+    opts.range_cache = &cache;
+    opts.readahead_initial_size = 64;
+    opts.readahead_max_size = 256;
+    opts.sequential_chunk_size = 256;
+    char buf[sz];
+
+    // a prefetch fills the cache pages it spans...
+    RequestLoggingEnv env1("http://s3.amazonaws.com", manifest, opts);
+    unique_ptr<RandomAccessFile> f;
+    Status s = env1.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    ASSERT_TRUE(f->Prefetch(256, 512).ok());
+    s = f->Read(300, 16, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+300, data.data(), 16));
+
+    // ...so that another env sharing the cache needn't request them, whether
+    // read directly or prefetched
+    RequestLoggingEnv env2("http://s3.amazonaws.com", manifest, opts);
+    s = env2.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    s = f->Read(256, 100, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+256, data.data(), 100));
+    ASSERT_TRUE(f->Prefetch(512, 256).ok());
+    s = f->Read(600, 100, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(0, memcmp(whole+600, data.data(), 100));
+    ASSERT_TRUE(env2.offsets.empty());
+
+    // sequential files prefetch their chunks through the cache too
+    unique_ptr<SequentialFile> sf;
+    s = env2.NewSequentialFile("1000genomes/README.alignment_data", &sf, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    for (uint64_t ofs = 0; ofs < sz; ofs += 100) {
+        s = sf->Read(100, &data, buf);
+        ASSERT_TRUE(s.ok());
+        ASSERT_EQ(min(uint64_t(100), sz-ofs), data.size());
+        ASSERT_EQ(0, memcmp(whole+ofs, data.data(), data.size()));
+    }
+    s = env2.NewSequentialFile("1000genomes/README.alignment_data", &sf, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    size_t requests = env2.offsets.size();
+    s = sf->Read(sz, &data, buf);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(sz, data.size());
+    ASSERT_EQ(0, memcmp(whole, data.data(), sz));
+    ASSERT_EQ(requests, env2.offsets.size());
+}
+
+TEST(HTTPFetchModel, Estimate) {
+    HTTPFetchModel model;
+    double latency, bandwidth;
+    ASSERT_FALSE(model.Estimate(latency, bandwidth));
+    ASSERT_EQ(65536, model.FetchUnit(65536, 8388608));
+
+    // requests all of the same size can't separate latency from throughput
+    for (int i = 0; i < 100; i++) {
+        model.Observe(16384, 0.05);
+    }
+    ASSERT_FALSE(model.Estimate(latency, bandwidth));
+
+    // 50ms latency, 50MB/s, with some noise
+    for (int i = 0; i < 1000; i++) {
+        size_t sz = 4096 << (i%9);
+        model.Observe(sz, 0.05 + sz/50e6 + ((i%7)-3)*0.001);
+    }
+    ASSERT_TRUE(model.Estimate(latency, bandwidth));
+    ASSERT_LT(0.045, latency);
+    ASSERT_GT(0.055, latency);
+    ASSERT_LT(45e6, bandwidth);
+    ASSERT_GT(55e6, bandwidth);
+    // bandwidth-delay product ~2.5MB
+    ASSERT_EQ(4194304, model.FetchUnit(65536, 8388608));
+    ASSERT_EQ(1048576, model.FetchUnit(65536, 1048576));
+}
+
+TEST(HTTPMirrorSet, Ranking) {
+    HTTPMirrorSet mirrors("http://a.example.com/db/", {"https://b.example.com/x/y/", "http://c.example.com"});
+    ASSERT_EQ(3, mirrors.size());
+    vector<bool> tried(3, false);
+
+    // unsampled mirrors are tried first, in order
+    ASSERT_EQ(0, mirrors.Best(tried));
+    mirrors.Observe(0, true, 0.1);
+    ASSERT_EQ(1, mirrors.Best(tried));
+    mirrors.Observe(1, true, 0.05);
+    ASSERT_EQ(2, mirrors.Best(tried));
+    mirrors.Observe(2, true, 0.2);
+
+    // then the fastest, unless it's failing
+    ASSERT_EQ(1, mirrors.Best(tried));
+    tried[1] = true;
+    ASSERT_EQ(0, mirrors.Best(tried));
+    tried[1] = false;
+    mirrors.Observe(1, false, 0.01);
+    mirrors.Observe(1, false, 0.01);
+    ASSERT_EQ(0, mirrors.Best(tried));
+    ASSERT_LT(mirrors.Cost(2), mirrors.Cost(1));
+    for (int i = 0; i < 100; i++) {
+        mirrors.Observe(1, true, 0.05);
+    }
+    ASSERT_EQ(1, mirrors.Best(tried));
+
+    // URLs are rewritten by the base URL or its directory
+    ASSERT_EQ("http://a.example.com/db/CURRENT", mirrors.Rewrite("http://a.example.com/db/CURRENT", 0));
+    ASSERT_EQ("https://b.example.com/x/y/CURRENT", mirrors.Rewrite("http://a.example.com/db/CURRENT", 1));
+    ASSERT_EQ("http://c.example.com/CURRENT", mirrors.Rewrite("http://a.example.com/db/CURRENT", 2));
+    ASSERT_EQ("https://b.example.com/x/y", mirrors.Rewrite("http://a.example.com/db", 1));
+    ASSERT_EQ("https://b.example.com/x/1.db", mirrors.Rewrite("http://a.example.com/1.db", 1));
+    ASSERT_EQ("http://elsewhere.com/db", mirrors.Rewrite("http://elsewhere.com/db", 1));
+}
+
+TEST(GivenManifestHTTPEnv, ConcurrentReads) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPEnvOptions opts;
+    opts.readahead_max_size = 0;
+    GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+    char whole[sz];
+    Slice data;
+    s = f->Read(0, sz, &data, whole);
+    ASSERT_TRUE(s.ok());
+
+    // overlapping reads from many threads at once, which may be coalesced
+    const int N = 16;
+    char bufs[N][sz];
+    Slice results[N];
+    Status statuses[N];
+    vector<thread> threads;
+    for (int i = 0; i < N; i++) {
+        threads.push_back(thread([&, i]() {
+            statuses[i] = f->Read((i%4)*100, 500+(i%3)*100, &results[i], bufs[i]);
+        }));
+    }
+    for (auto& t : threads) t.join();
+    for (int i = 0; i < N; i++) {
+        ASSERT_TRUE(statuses[i].ok());
+        ASSERT_EQ(500+(i%3)*100, results[i].size());
+        ASSERT_EQ(0, memcmp(whole+(i%4)*100, results[i].data(), results[i].size()));
+    }
+}
+
 TEST(GivenManifestHTTPEnv, HTTPError) {
     GivenManifestHTTPEnv::manifest manifest;
     manifest["BOGUS"] = 1;
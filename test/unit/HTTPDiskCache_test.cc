@@ -0,0 +1,137 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "gtest/gtest.h"
+#include "RocksWorm/HTTPDiskCache.h"
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace std;
+using namespace rocksdb;
+
+const char *DISK_CACHE_DIR = "/tmp/RocksWorm_unit_tests_HTTPDiskCache";
+
+TEST(HTTPDiskCache, LookupInsert) {
+    ASSERT_EQ(0, system((string("rm -rf ") + DISK_CACHE_DIR).c_str()));
+    HTTPDiskCache cache(DISK_CACHE_DIR, 1048576, 1024);
+    ASSERT_TRUE(cache.Open().ok());
+
+    string page(1024, 'x'), ans;
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 0, "etag1/4096", ans));
+    cache.Insert("http://a", "foo", 0, "etag1/4096", page.data(), page.size());
+    ASSERT_TRUE(cache.Lookup("http://a", "foo", 0, "etag1/4096", ans));
+    ASSERT_EQ(page, ans);
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 1, "etag1/4096", ans));
+    ASSERT_FALSE(cache.Lookup("http://a", "bar", 0, "etag1/4096", ans));
+
+    // a changed validator renders the page stale
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 0, "etag2/4096", ans));
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 0, "etag1/4096", ans));
+
+    HTTPDiskCache::Stats stats = cache.GetStats();
+    ASSERT_EQ(1, stats.hits);
+    ASSERT_EQ(1, stats.stale);
+    ASSERT_EQ(1, stats.inserts);
+    ASSERT_EQ(0, stats.usage);
+}
+
+TEST(HTTPDiskCache, Persistence) {
+    ASSERT_EQ(0, system((string("rm -rf ") + DISK_CACHE_DIR).c_str()));
+    {
+        HTTPDiskCache cache(DISK_CACHE_DIR, 4*1200, 1024);
+        ASSERT_TRUE(cache.Open().ok());
+        for (uint64_t i = 0; i < 6; i++) {
+            string page(1024, 'a'+i);
+            cache.Insert("http://a", "foo", i, "etag", page.data(), page.size());
+        }
+        // capacity admits only four pages, so the first two were evicted
+        HTTPDiskCache::Stats stats = cache.GetStats();
+        ASSERT_EQ(2, stats.evictions);
+    }
+
+    // a crash could leave behind a temporary file, and a corrupt page
+    ASSERT_EQ(0, system((string("touch -d '2 hours ago' ") + DISK_CACHE_DIR + "/0123.page.tmp.1.1").c_str()));
+    ASSERT_EQ(0, system((string("echo garbage > ") + DISK_CACHE_DIR + "/0123456789abcdef01234567.page").c_str()));
+
+    HTTPDiskCache cache(DISK_CACHE_DIR, 4*1200, 1024);
+    ASSERT_TRUE(cache.Open().ok());
+    string ans;
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 1, "etag", ans));
+    for (uint64_t i = 2; i < 6; i++) {
+        ASSERT_TRUE(cache.Lookup("http://a", "foo", i, "etag", ans));
+        ASSERT_EQ(string(1024, 'a'+i), ans);
+    }
+}
+
+static bool Exists(const string& name) {
+    return access((string(DISK_CACHE_DIR) + "/" + name).c_str(), F_OK) == 0;
+}
+
+TEST(HTTPDiskCache, TemporaryFiles) {
+    ASSERT_EQ(0, system((string("rm -rf ") + DISK_CACHE_DIR + " && mkdir -p " + DISK_CACHE_DIR).c_str()));
+
+    // pid of a process that has exited
+    pid_t dead = fork();
+    ASSERT_GE(dead, 0);
+    if (dead == 0) _exit(0);
+    ASSERT_EQ(dead, waitpid(dead, nullptr, 0));
+
+    ostringstream abandoned, live, old;
+    abandoned << "0123.page.tmp." << dead << ".1";
+    live << "4567.page.tmp." << getpid() << ".1";
+    old << "89ab.page.tmp." << getpid() << ".2";
+    ASSERT_EQ(0, system((string("touch ") + DISK_CACHE_DIR + "/" + abandoned.str()).c_str()));
+    ASSERT_EQ(0, system((string("touch ") + DISK_CACHE_DIR + "/" + live.str()).c_str()));
+    ASSERT_EQ(0, system((string("touch -d '2 hours ago' ") + DISK_CACHE_DIR + "/" + old.str()).c_str()));
+
+    // Open removes temporary files of exited processes, and old ones, but
+    // not those a live process may still be writing
+    HTTPDiskCache cache(DISK_CACHE_DIR, 1048576, 1024);
+    ASSERT_TRUE(cache.Open().ok());
+    ASSERT_FALSE(Exists(abandoned.str()));
+    ASSERT_TRUE(Exists(live.str()));
+    ASSERT_FALSE(Exists(old.str()));
+}
+
+TEST(HTTPDiskCache, StaleLookupRacingInsert) {
+    ASSERT_EQ(0, system((string("rm -rf ") + DISK_CACHE_DIR).c_str()));
+    HTTPDiskCache cache(DISK_CACHE_DIR, 1048576, 1024);
+    ASSERT_TRUE(cache.Open().ok());
+
+    // a lookup finding the stale page mustn't remove the fresh one, which
+    // another thread may insert between the lookup's read and its cleanup
+    string page(1024, 'x');
+    for (int i = 0; i < 1000; i++) {
+        cache.Insert("http://a", "foo", 0, "etag1", page.data(), page.size());
+        thread lookup([&]() {
+            string ans;
+            cache.Lookup("http://a", "foo", 0, "etag2", ans);
+        });
+        cache.Insert("http://a", "foo", 0, "etag2", page.data(), page.size());
+        lookup.join();
+        string ans;
+        ASSERT_TRUE(cache.Lookup("http://a", "foo", 0, "etag2", ans));
+        ASSERT_EQ(page, ans);
+    }
+}
+
+TEST(HTTPDiskCache, URLNotPersisted) {
+    ASSERT_EQ(0, system((string("rm -rf ") + DISK_CACHE_DIR).c_str()));
+    const string url = "http://a/db?X-Amz-Signature=SECRET";
+    string page(1024, 'x'), ans;
+    {
+        HTTPDiskCache cache(DISK_CACHE_DIR, 1048576, 1024);
+        ASSERT_TRUE(cache.Open().ok());
+        cache.Insert(url, "foo", 0, "etag", page.data(), page.size());
+    }
+
+    // the page files (names and contents) record only a digest of the URL
+    ASSERT_NE(0, system((string("grep -rq SECRET ") + DISK_CACHE_DIR).c_str()));
+    ASSERT_NE(0, system((string("ls ") + DISK_CACHE_DIR + " | grep -q SECRET").c_str()));
+
+    // which a later process finds again
+    HTTPDiskCache cache(DISK_CACHE_DIR, 1048576, 1024);
+    ASSERT_TRUE(cache.Open().ok());
+    ASSERT_TRUE(cache.Lookup(url, "foo", 0, "etag", ans));
+    ASSERT_EQ(page, ans);
+    ASSERT_FALSE(cache.Lookup("http://a/db?X-Amz-Signature=OTHER", "foo", 0, "etag", ans));
+}
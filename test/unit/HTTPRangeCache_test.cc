@@ -0,0 +1,83 @@
+#include <iostream>
+#include <sstream>
+#include "gtest/gtest.h"
+#include "RocksWorm/HTTPRangeCache.h"
+#include "RocksWorm/GivenManifestHTTPEnv.h"
+using namespace std;
+using namespace rocksdb;
+
+TEST(HTTPRangeCache, LookupInsert) {
+    HTTPRangeCache cache(4096, 1024, 0);
+    shared_ptr<const string> page;
+
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 0, page));
+    cache.Insert("http://a", "foo", 0, make_shared<const string>(1024, 'x'));
+    ASSERT_TRUE(cache.Lookup("http://a", "foo", 0, page));
+    ASSERT_EQ(string(1024, 'x'), *page);
+
+    // distinct URL, file and page number are distinct keys
+    ASSERT_FALSE(cache.Lookup("http://b", "foo", 0, page));
+    ASSERT_FALSE(cache.Lookup("http://a", "bar", 0, page));
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 1, page));
+
+    HTTPRangeCache::Stats stats = cache.GetStats();
+    ASSERT_EQ(1, stats.hits);
+    ASSERT_EQ(4, stats.misses);
+    ASSERT_EQ(1, stats.inserts);
+    ASSERT_EQ(1024, stats.usage);
+}
+
+TEST(HTTPRangeCache, Eviction) {
+    HTTPRangeCache cache(4096, 1024, 0);
+    shared_ptr<const string> page;
+
+    for (uint64_t i = 0; i < 4; i++) {
+        cache.Insert("http://a", "foo", i, make_shared<const string>(1024, 'a'+i));
+    }
+    // touch page 0 so that page 1 becomes least recently used
+    ASSERT_TRUE(cache.Lookup("http://a", "foo", 0, page));
+    cache.Insert("http://a", "foo", 4, make_shared<const string>(100, 'e'));
+
+    ASSERT_TRUE(cache.Lookup("http://a", "foo", 0, page));
+    ASSERT_FALSE(cache.Lookup("http://a", "foo", 1, page));
+    ASSERT_TRUE(cache.Lookup("http://a", "foo", 4, page));
+    ASSERT_EQ(100, page->size());
+
+    HTTPRangeCache::Stats stats = cache.GetStats();
+    ASSERT_EQ(1, stats.evictions);
+    ASSERT_EQ(3*1024+100, stats.usage);
+}
+
+TEST(HTTPRangeCache, GivenManifestHTTPEnv) {
+    const uint64_t sz = 1024;
+    GivenManifestHTTPEnv::manifest manifest;
+    manifest["1000genomes/README.alignment_data"] = sz;
+    HTTPRangeCache cache(1048576, 256);
+    HTTPEnvOptions opts;
+    opts.range_cache = &cache;
+    opts.readahead_max_size = 0;
+    GivenManifestHTTPEnv env("http://s3.amazonaws.com", manifest, opts);
+
+    unique_ptr<RandomAccessFile> f;
+    Status s = env.NewRandomAccessFile("1000genomes/README.alignment_data", &f, EnvOptions());
+    ASSERT_TRUE(s.ok());
+
+    // an unaligned read fills the overlapping pages
+    char buf1[sz], buf2[sz];
+    Slice data1, data2;
+    s = f->Read(300, 300, &data1, buf1);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(300, data1.size());
+    HTTPRangeCache::Stats stats = cache.GetStats();
+    ASSERT_EQ(0, stats.hits);
+    ASSERT_EQ(2, stats.inserts);
+
+    // a read within those pages is served entirely from the cache
+    s = f->Read(256, 256, &data2, buf2);
+    ASSERT_TRUE(s.ok());
+    ASSERT_EQ(256, data2.size());
+    stats = cache.GetStats();
+    ASSERT_EQ(1, stats.hits);
+    ASSERT_EQ(2, stats.inserts);
+    ASSERT_EQ(0, memcmp(data1.data(), data2.data()+44, 212));
+}
@@ -58,3 +58,101 @@ TEST(HTTP, bogus_url) {
 
     ASSERT_NE(CURLE_OK, c);
 }
+
+TEST(HTTP, GET_buffer) {
+    HTTP::headers request_headers, response_headers;
+    long response_code = -1;
+    char buf[1024];
+    size_t response_size = 0;
+
+    request_headers["range"] = "bytes=0-99";
+    CURLcode c = HTTP::GET("http://www.mlin.net/", request_headers,
+                           response_code, response_headers, buf, sizeof(buf), response_size);
+
+    ASSERT_EQ(CURLE_OK, c);
+    ASSERT_EQ(206, response_code);
+    ASSERT_EQ(100, response_size);
+
+    // response body exceeding the buffer capacity
+    request_headers.clear();
+    c = HTTP::GET("http://www.mlin.net/", request_headers,
+                  response_code, response_headers, buf, 16, response_size);
+    ASSERT_EQ(CURLE_WRITE_ERROR, c);
+    ASSERT_LE(response_size, 16);
+}
+
+TEST(HTTP, AsyncClient) {
+    HTTP::AsyncClient client(4);
+    const int N = 16;
+    HTTP::headers request_headers, response_headers[N];
+    long response_code[N];
+    size_t response_size[N];
+    char buf[N][100];
+    vector<future<CURLcode>> results;
+
+    // many concurrent range requests
+    for (int i = 0; i < N; i++) {
+        ostringstream range;
+        range << "bytes=" << i*100 << "-" << (i*100+99);
+        request_headers["range"] = range.str();
+        results.push_back(client.GET("http://www.mlin.net/", request_headers,
+                                     response_code[i], response_headers[i], buf[i], sizeof(buf[i]), response_size[i]));
+    }
+    for (int i = 0; i < N; i++) {
+        ASSERT_EQ(CURLE_OK, results[i].get());
+        ASSERT_EQ(206, response_code[i]);
+        ASSERT_EQ(100, response_size[i]);
+    }
+
+    HTTP::headers head_response_headers;
+    long head_response_code = -1;
+    request_headers.clear();
+    ASSERT_EQ(CURLE_OK, client.HEAD("http://www.mlin.net/", request_headers,
+                                    head_response_code, head_response_headers).get());
+    ASSERT_EQ(200, head_response_code);
+
+    ASSERT_NE(CURLE_OK, client.GET("http://asdf/", request_headers, head_response_code, head_response_headers,
+                                   buf[0], sizeof(buf[0]), response_size[0]).get());
+}
+
+TEST(HTTP, ParseMultipartByteranges) {
+    uint64_t first, last, total;
+    ASSERT_TRUE(HTTP::ParseContentRange("bytes 10-19/100", first, last, total));
+    ASSERT_EQ(10, first);
+    ASSERT_EQ(19, last);
+    ASSERT_EQ(100, total);
+    ASSERT_TRUE(HTTP::ParseContentRange("bytes 0-0/*", first, last, total));
+    ASSERT_EQ(UINT64_MAX, total);
+    ASSERT_FALSE(HTTP::ParseContentRange("bytes 10-9/100", first, last, total));
+    ASSERT_FALSE(HTTP::ParseContentRange("bytes */100", first, last, total));
+
+    // part contents may contain CRLF and even the boundary
+    string body = "preamble\r\n--THIS_STRING\r\n"
+                  "Content-Type: application/octet-stream\r\n"
+                  "Content-Range: bytes 5-14/1000\r\n\r\n"
+                  "--THIS_STR"
+                  "\r\n--THIS_STRING\r\n"
+                  "content-range: bytes 500-503/1000\r\n\r\n"
+                  "\r\n\r\n"
+                  "\r\n--THIS_STRING--\r\n";
+    vector<HTTP::ByteRange> parts;
+    ASSERT_TRUE(HTTP::ParseMultipartByteranges("multipart/byteranges; boundary=THIS_STRING",
+                                               body.data(), body.size(), parts));
+    ASSERT_EQ(2, parts.size());
+    ASSERT_EQ(5, parts[0].offset);
+    ASSERT_EQ(10, parts[0].size);
+    ASSERT_EQ(string("--THIS_STR"), string(parts[0].data, parts[0].size));
+    ASSERT_EQ(500, parts[1].offset);
+    ASSERT_EQ(string("\r\n\r\n"), string(parts[1].data, parts[1].size));
+
+    ASSERT_TRUE(HTTP::ParseMultipartByteranges("multipart/byteranges; boundary=\"THIS_STRING\"",
+                                               body.data(), body.size(), parts));
+    ASSERT_EQ(2, parts.size());
+
+    // truncated body
+    ASSERT_FALSE(HTTP::ParseMultipartByteranges("multipart/byteranges; boundary=THIS_STRING",
+                                                body.data(), body.size()-30, parts));
+    // not multipart
+    ASSERT_FALSE(HTTP::ParseMultipartByteranges("application/octet-stream",
+                                                body.data(), body.size(), parts));
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <sstream>
+#include "gtest/gtest.h"
+#include "RocksWorm/RocksWormDeltaHTTPEnv.h"
+#include "RocksWormFormat.h"
+using namespace std;
+using namespace rocksdb;
+
+TEST(RocksWormDeltaHTTPEnv, ResolveURL) {
+    auto resolve = RocksWormDeltaHTTPEnv::ResolveURL;
+    const string base = "https://example.com/dbs/v2.rocksworm?token=a/b";
+
+    ASSERT_EQ("http://other.com/v1.rocksworm", resolve(base, "http://other.com/v1.rocksworm"));
+    ASSERT_EQ("https://example.com/dbs/v1.rocksworm", resolve(base, "v1.rocksworm"));
+    ASSERT_EQ("https://example.com/dbs/1.v1.rocksworm?x=1", resolve(base, "./1.v1.rocksworm?x=1"));
+    ASSERT_EQ("https://example.com/old/v1.rocksworm", resolve(base, "../old/v1.rocksworm"));
+    ASSERT_EQ("https://example.com/v1.rocksworm", resolve(base, "../../../v1.rocksworm"));
+    ASSERT_EQ("https://example.com/old/v1.rocksworm", resolve(base, "/old/./v1.rocksworm"));
+    ASSERT_EQ("https://mirror.com/v1.rocksworm", resolve(base, "//mirror.com/v1.rocksworm"));
+    ASSERT_EQ("http://example.com/v1.rocksworm", resolve("http://example.com", "v1.rocksworm"));
+    ASSERT_EQ("http://example.com/v1.rocksworm", resolve("http://example.com?a=/b", "v1.rocksworm"));
+}
+
+// exposes whether an env accepts delta files
+template<class Env> class DeltaPolicy : public Env {
+public:
+    DeltaPolicy() : Env("https://example.com/dbs/v2.rocksworm", HTTPEnvOptions()) {}
+    bool Accepts() const { return this->AcceptsDeltas(); }
+};
+
+TEST(RocksWormDeltaHTTPEnv, ParseObjects) {
+    // an objects section listing a stripe, then an object of a prior file
+    // followed by its ETag
+    string section;
+    for (const string name : {"1.v2.rocksworm", "https://example.com/dbs/v1.rocksworm"}) {
+        char buf[RocksWormFormat::kObjectSize] = {0};
+        RocksWormFormat::EncodeFixed64(buf, 12345);
+        RocksWormFormat::EncodeFixed32(buf+12, name.size());
+        section.append(buf, sizeof(buf));
+        section += name;
+    }
+    const string etag = "\"abc\"";
+    char etag_size[4];
+    RocksWormFormat::EncodeFixed32(etag_size, etag.size());
+    section.append(etag_size, sizeof(etag_size));
+    section += etag;
+
+    // a plain RocksWormHTTPEnv rejects the object named by URL
+    vector<RocksWormObject> objects(1);
+    DeltaPolicy<RocksWormHTTPEnv> plain;
+    ASSERT_TRUE(RocksWormHTTPEnv::ParseObjects(section, plain.Accepts(), objects).IsCorruption());
+
+    // RocksWormDeltaHTTPEnv accepts it, under an alias
+    objects.resize(1);
+    DeltaPolicy<RocksWormDeltaHTTPEnv> delta;
+    ASSERT_TRUE(RocksWormHTTPEnv::ParseObjects(section, delta.Accepts(), objects).ok());
+    ASSERT_EQ(3, objects.size());
+    ASSERT_EQ("1.v2.rocksworm", objects[1].name);
+    ASSERT_TRUE(objects[1].url.empty());
+    ASSERT_EQ("@2", objects[2].name);
+    ASSERT_EQ("https://example.com/dbs/v1.rocksworm", objects[2].url);
+    ASSERT_EQ(12345, objects[2].size);
+    ASSERT_EQ(etag, objects[2].etag);
+
+    // ...and rejects a truncated ETag
+    objects.resize(1);
+    ASSERT_TRUE(RocksWormHTTPEnv::ParseObjects(section.substr(0, section.size()-1), delta.Accepts(),
+                                               objects).IsCorruption());
+}